@@ -0,0 +1,631 @@
+/* Microbenchmarks for the interpreter, world generation and robot lookup.
+ *
+ * Built and run with `./run.sh --bench`. lang.c and common.c are compiled
+ * into this file so that their static functions can be timed directly.
+ * Allocations are counted by the tracking allocator (src/mem.c). */
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <bench.h>
+#include "../src/lang.c"
+#include "../src/common.c"
+#include <sight.h>
+
+
+/* Minimum time spent in each measured run. */
+#ifndef BENCH_DEFAULT_MS
+# define BENCH_DEFAULT_MS 200
+#endif
+
+/* Measured runs per benchmark, the fastest one is reported. */
+#ifndef BENCH_RUNS
+# define BENCH_RUNS 5
+#endif
+
+#ifndef BENCH_MAXRESULTS
+# define BENCH_MAXRESULTS 128
+#endif
+
+
+/* Perform `n` operations. */
+typedef void (*BenchFn)(void *data, unsigned long n);
+
+typedef struct
+{
+	char name[64];
+	unsigned long ops;    /* operations in the fastest run */
+	double ns_per_op;
+	double allocs_per_op; /* averaged over every run */
+} BenchResult;
+
+static struct
+{
+	FILE *out; /* stdout, even while `print` is being silenced */
+	long run_ns;
+	const char *filter;
+	bool json;
+	int nresults;
+	BenchResult results[BENCH_MAXRESULTS];
+} bench = { .run_ns=BENCH_DEFAULT_MS * 1000000L };
+
+
+static
+long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static
+long time_ops(BenchFn fn, void *data, unsigned long n)
+{
+	long start = now_ns();
+	fn(data, n);
+	return now_ns() - start;
+}
+
+static
+void run_bench(const char *name, BenchFn fn, void *data)
+{
+	if (bench.filter && !strstr(name, bench.filter))
+		return;
+	if (bench.nresults == BENCH_MAXRESULTS)
+	{
+		fprintf(stderr, "error: too many benchmarks\n");
+		return;
+	}
+
+	/* grow the batch until it takes long enough to time */
+	unsigned long n = 1;
+	long t;
+	while ((t = time_ops(fn, data, n)) < bench.run_ns / 16 && n < (1UL << 40))
+		n *= 2;
+	if (t > 0)
+		n = (double)n * bench.run_ns / t + 1;
+
+	BenchResult *r = &bench.results[bench.nresults++];
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	r->ops = n;
+	r->ns_per_op = -1;
+	unsigned long allocs = mem_allocs();
+	for (int i = 0 ; i < BENCH_RUNS ; i++)
+	{
+		double ns = (double)time_ops(fn, data, n) / n;
+		if (r->ns_per_op < 0 || ns < r->ns_per_op)
+			r->ns_per_op = ns;
+	}
+	r->allocs_per_op = (double)(mem_allocs() - allocs) / ((double)n * BENCH_RUNS);
+
+	if (!bench.json)
+		fprintf(bench.out, "%-32s %12.1f ns/op %10.2f allocs/op %12lu ops\n", r->name, r->ns_per_op, r->allocs_per_op, r->ops);
+}
+
+
+/* parse_ins */
+
+typedef struct
+{
+	LangContext *ctx;
+	char *program;
+	long pos;
+} ParseBench;
+
+static
+void bench_parse(void *data, unsigned long n)
+{
+	ParseBench *b = data;
+	for (unsigned long i = 0 ; i < n ; )
+	{
+		parse_ins(b->ctx, &b->pos, b->program);
+		/* wrap around at the end of the program */
+		if (b->pos < 0)
+			b->pos = 0;
+		else
+			i++;
+	}
+}
+
+static
+void bench_parse_showcases(void)
+{
+	for (int i = 1 ; i <= 3 ; i++)
+	{
+		char path[64], name[64];
+		snprintf(path, sizeof(path), "showcases/%d.rbt", i);
+		snprintf(name, sizeof(name), "parse_ins/showcase%d", i);
+		char *program = read_program(path);
+		if (!program)
+			continue;
+		ParseBench b = { .ctx=new_context(0), .program=program };
+		run_bench(name, bench_parse, &b);
+		if (b.ctx->errored)
+			fprintf(stderr, "error: `%s` did not parse\n", path);
+		del_context(b.ctx);
+		mem_free(program);
+	}
+}
+
+
+/* eval_ins */
+
+typedef struct
+{
+	State *state;
+	LangContext *ctx;
+	LangIns ins;
+	Direction dir;
+} EvalBench;
+
+static
+void bench_eval(void *data, unsigned long n)
+{
+	EvalBench *b = data;
+	Robots *rs = &b->state->robots;
+	World *w = b->state->world;
+	for (unsigned long i = 0 ; i < n ; i++)
+	{
+		/* put everything the instruction may have changed back */
+		bitset_set(&w->robots, rs->x[0], rs->y[0], false);
+		bitset_set(&w->robots, 2, 2, true);
+		rs->x[0] = 2;
+		rs->y[0] = 2;
+		rs->dir[0] = b->dir;
+		rs->fuel[0] = rs->max_fuel;
+		set_tile(w, 2, 2, TILE_ENERGY);
+		b->ctx->registers[1] = 1000;
+		b->ctx->_nfns = 1;
+		b->ctx->_curfn = 0;
+		eval_ins(b->state, b->ctx, NULL, b->ins);
+	}
+}
+
+static
+void bench_eval_ops(void)
+{
+	/* the player stands on an energy tile with an empty tile to the north
+	 * and an enemy to the east */
+	static const struct { const char *text; Direction dir; } cases[] =
+	{
+		{ "print 1",                   East  },
+		{ "forward",                   North },
+		{ "backward",                  North },
+		{ "turn cw",                   North },
+		{ "refuel",                    North },
+		{ "ram",                       North },
+		{ "scan $2",                   East  },
+		{ "run f",                     North },
+		{ "if $0 == 0 then add $1 1",  North },
+		{ "set $1 5",                  North },
+		{ "fn g",                      North },
+		{ "end",                       North },
+		{ "add $1 3",                  North },
+		{ "sub $1 3",                  North },
+		{ "mul $1 3",                  North },
+		{ "div $1 3",                  North },
+		{ "mod $1 3",                  North },
+		{ "goto 5 5",                  North },
+		{ "seek robot",                North },
+		{ "radar $2 8 robot",          North },
+	};
+
+	State *state = new_state(8, 8, MAX_FUEL, FUEL_CANISTER_AMOUNT);
+	for (int i = 0 ; i < 8 ; i++)
+	{
+		set_tile(state->world, i, 0, TILE_WALL);
+		set_tile(state->world, i, 7, TILE_WALL);
+		set_tile(state->world, 0, i, TILE_WALL);
+		set_tile(state->world, 7, i, TILE_WALL);
+	}
+	robots_add(&state->robots, true, 2, 2, North);
+	robots_add(&state->robots, false, 3, 2, West);
+	world_sync(state);
+
+	/* `run f` calls a one instruction function */
+	LangContext *ctx = new_context(0);
+	long pos = 0;
+	eval_ins(state, ctx, NULL, parse_ins(ctx, &pos, "fn f"));
+	pos = 0;
+	LangFn *f = &ctx->fns[0];
+	f->code[f->_codelen++] = parse_ins(ctx, &pos, "add $1 1");
+	ctx->_curfn = -1;
+
+	/* keep `print` off the terminal */
+	fflush(stdout);
+	int out = dup(STDOUT_FILENO), null = open("/dev/null", O_WRONLY);
+
+	for (size_t i = 0 ; i < sizeof(cases) / sizeof(cases[0]) ; i++)
+	{
+		pos = 0;
+		EvalBench b = { .state=state, .ctx=ctx, .dir=cases[i].dir };
+		b.ins = parse_ins(ctx, &pos, (char *)cases[i].text);
+
+		char name[64];
+		snprintf(name, sizeof(name), "eval_ins/%s", rbt_optos[b.ins.op]);
+		bool quiet = b.ins.op == rbt_op_print && null >= 0;
+		if (quiet)
+			dup2(null, STDOUT_FILENO);
+		run_bench(name, bench_eval, &b);
+		if (quiet)
+		{
+			fflush(stdout);
+			dup2(out, STDOUT_FILENO);
+		}
+		if (ctx->errored)
+		{
+			fprintf(stderr, "error: `%s` panicked\n", cases[i].text);
+			ctx->errored = false;
+		}
+	}
+
+	if (null >= 0)
+		close(null);
+	close(out);
+	del_context(ctx);
+	free_state(state);
+}
+
+
+/* get_fn */
+
+typedef struct
+{
+	LangContext *ctx;
+	LangSlice name;
+} FnBench;
+
+static
+void bench_get_fn(void *data, unsigned long n)
+{
+	FnBench *b = data;
+	LangFn *volatile sink;
+	for (unsigned long i = 0 ; i < n ; i++)
+		sink = get_fn(b->ctx, b->name);
+	(void)sink;
+}
+
+static
+void bench_get_fns(void)
+{
+	static const int counts[] = { 1, 16, 64, LANG_NFNS };
+	for (size_t k = 0 ; k < sizeof(counts) / sizeof(counts[0]) ; k++)
+	{
+		LangContext *ctx = new_context(0);
+		char name[64];
+		for (int i = 0 ; i < counts[k] ; i++)
+		{
+			snprintf(name, sizeof(name), "function%d", i);
+			ctx->fns[i].name = mem_alloc(MEM_LANG_PARSE, strlen(name) + 1);
+			strcpy(ctx->fns[i].name, name);
+		}
+		ctx->_nfns = counts[k];
+
+		/* the last function defined is the slowest to find */
+		FnBench b = { .ctx=ctx, .name={ ctx->fns[counts[k] - 1].name, strlen(ctx->fns[counts[k] - 1].name) } };
+		snprintf(name, sizeof(name), "get_fn/%d", counts[k]);
+		run_bench(name, bench_get_fn, &b);
+		del_context(ctx);
+	}
+}
+
+
+/* generate_world */
+
+typedef struct
+{
+	int width, height, robot_count;
+	WorldLayout layout;
+	int threads;
+} WorldBench;
+
+static
+void bench_world(void *data, unsigned long n)
+{
+	WorldBench *b = data;
+	worldgen_threads = b->threads;
+	for (unsigned long i = 0 ; i < n ; i++)
+		free_state(generate_world(1, b->width, b->height, b->robot_count, b->layout));
+	worldgen_threads = 0;
+}
+
+static
+void bench_worlds(void)
+{
+	static const WorldBench sizes[] =
+	{
+		{ DEFAULT_WORLD_WIDTH, DEFAULT_WORLD_HEIGHT, DEFAULT_ROBOT_COUNT, LAYOUT_SCATTER, 0 },
+		{ 32, 32, 16, LAYOUT_SCATTER, 0 },
+		{ 128, 128, 256, LAYOUT_SCATTER, 0 },
+		{ 512, 512, 4096, LAYOUT_SCATTER, 0 },
+	};
+	for (size_t i = 0 ; i < sizeof(sizes) / sizeof(sizes[0]) ; i++)
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "generate_world/%dx%d", sizes[i].width, sizes[i].height);
+		WorldBench b = sizes[i];
+		run_bench(name, bench_world, &b);
+	}
+
+	/* chunked layouts on one thread and on four */
+	for (int layout = LAYOUT_MAZE ; layout < LAYOUT_COUNT ; layout++)
+	{
+		for (int threads = 1 ; threads <= 4 ; threads *= 4)
+		{
+			char name[64];
+			snprintf(name, sizeof(name), "generate_world/%s/1024x1024/%dt", worldgen_layout_names[layout], threads);
+			WorldBench b = { 1024, 1024, 256, layout, threads };
+			run_bench(name, bench_world, &b);
+		}
+	}
+}
+
+static
+void bench_solvable(void *data, unsigned long n)
+{
+	volatile bool sink;
+	for (unsigned long i = 0 ; i < n ; i++)
+		sink = world_solvable(data);
+	(void)sink;
+}
+
+static
+void bench_solvables(void)
+{
+	static const int sides[] = { 128, 1024 };
+	for (size_t i = 0 ; i < sizeof(sides) / sizeof(sides[0]) ; i++)
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "world_solvable/%dx%d", sides[i], sides[i]);
+		State *state = generate_world(1, sides[i], sides[i], sides[i] / 4, LAYOUT_SCATTER);
+		run_bench(name, bench_solvable, state);
+		free_state(state);
+	}
+}
+
+
+/* paths_toward */
+
+static
+void bench_path_build(void *data, unsigned long n)
+{
+	State *state = data;
+	Direction dir;
+	volatile int sink;
+	for (unsigned long i = 0 ; i < n ; i++)
+	{
+		paths_invalidate(state->world->paths);
+		sink = paths_toward(state, 0, PATH_FUEL, 0, 0, &dir);
+	}
+	(void)sink;
+}
+
+static
+void bench_path_step(void *data, unsigned long n)
+{
+	State *state = data;
+	Direction dir;
+	volatile int sink;
+	for (unsigned long i = 0 ; i < n ; i++)
+		sink = paths_toward(state, 0, PATH_FUEL, 0, 0, &dir);
+	(void)sink;
+}
+
+static
+void bench_paths(void)
+{
+	static const int sides[] = { 128, 1024 };
+	for (size_t i = 0 ; i < sizeof(sides) / sizeof(sides[0]) ; i++)
+	{
+		char name[64];
+		State *state = generate_world(1, sides[i], sides[i], sides[i] / 4, LAYOUT_MAZE);
+		Direction dir;
+		paths_toward(state, 0, PATH_FUEL, 0, 0, &dir);
+		snprintf(name, sizeof(name), "paths/build/%dx%d", sides[i], sides[i]);
+		run_bench(name, bench_path_build, state);
+		snprintf(name, sizeof(name), "paths/step/%dx%d", sides[i], sides[i]);
+		run_bench(name, bench_path_step, state);
+		free_state(state);
+	}
+}
+
+/* sight_cast */
+
+static
+void bench_sight(void *data, unsigned long n)
+{
+	State *state = data;
+	World *w = state->world;
+	static Bitset seen;
+	if (seen.width != w->width)
+	{
+		bitset_free(&seen);
+		bitset_init(&seen, w->width, w->height);
+	}
+	for (unsigned long i = 0 ; i < n ; i++)
+		sight_cast(&seen, &w->walls, state->robots.x[0], state->robots.y[0], SIGHT_RADIUS);
+}
+
+static
+void bench_sights(void)
+{
+	static const WorldLayout layouts[] = { LAYOUT_SCATTER, LAYOUT_CAVE };
+	for (size_t i = 0 ; i < sizeof(layouts) / sizeof(layouts[0]) ; i++)
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "sight_cast/%s", worldgen_layout_names[layouts[i]]);
+		State *state = generate_world(1, 128, 128, 32, layouts[i]);
+		run_bench(name, bench_sight, state);
+		free_state(state);
+	}
+}
+
+/* find_robot_pos */
+
+#define ROBOT_QUERIES 1024
+
+typedef struct
+{
+	State *state;
+	int qx[ROBOT_QUERIES], qy[ROBOT_QUERIES];
+} RobotBench;
+
+static
+void bench_find_robot(void *data, unsigned long n)
+{
+	RobotBench *b = data;
+	volatile int sink;
+	for (unsigned long i = 0 ; i < n ; i++)
+	{
+		int q = i % ROBOT_QUERIES;
+		sink = find_robot_pos(b->state, b->qx[q], b->qy[q]);
+	}
+	(void)sink;
+}
+
+static
+void bench_find_robots(void)
+{
+	static const int counts[] = { 16, 256, 1024, 10000 };
+	for (size_t k = 0 ; k < sizeof(counts) / sizeof(counts[0]) ; k++)
+	{
+		/* robots cover about a quarter of the tiles */
+		int side = 2;
+		while (side * side < counts[k] * 4)
+			side++;
+
+		static RobotBench b;
+		b.state = new_state(side, side, MAX_FUEL, FUEL_CANISTER_AMOUNT);
+		srand(1);
+		for (int i = 0 ; i < counts[k] ; i++)
+		{
+			int x, y;
+			do
+			{
+				x = rand() % side;
+				y = rand() % side;
+			} while (find_robot_pos(b.state, x, y) != -1);
+			robots_add(&b.state->robots, i == 0, x, y, North);
+			bitset_set(&b.state->world->robots, x, y, true);
+		}
+
+		/* half of the queries hit a robot, the rest are random tiles */
+		for (int q = 0 ; q < ROBOT_QUERIES ; q++)
+		{
+			if (q % 2 == 0)
+			{
+				int id = rand() % counts[k];
+				b.qx[q] = b.state->robots.x[id];
+				b.qy[q] = b.state->robots.y[id];
+			}
+			else
+			{
+				b.qx[q] = rand() % side;
+				b.qy[q] = rand() % side;
+			}
+		}
+
+		char name[64];
+		snprintf(name, sizeof(name), "find_robot_pos/%d", counts[k]);
+		run_bench(name, bench_find_robot, &b);
+		free_state(b.state);
+	}
+}
+
+
+/* Heap use per subsystem over every benchmark, live is what was left behind. */
+static
+void print_memory(void)
+{
+#if MEM_TRACKING
+	MemStats stats[MEM_NTAGS];
+	mem_stats(stats);
+	if (bench.json)
+	{
+		fprintf(bench.out, "\t\"memory\": [\n");
+		for (int i = 0 ; i < MEM_NTAGS ; i++)
+			fprintf(bench.out, "\t\t{ \"tag\": \"%s\", \"live\": %zu, \"peak\": %zu, \"allocs\": %lu }%s\n",
+				mem_tag_names[i], stats[i].live, stats[i].peak, stats[i].allocs, i + 1 < MEM_NTAGS ? "," : "");
+		fprintf(bench.out, "\t],\n");
+		return;
+	}
+	fprintf(bench.out, "\n%-14s %12s %12s %12s\n", "memory", "live bytes", "peak bytes", "allocs");
+	for (int i = 0 ; i < MEM_NTAGS ; i++)
+		fprintf(bench.out, "%-14s %12zu %12zu %12lu\n", mem_tag_names[i], stats[i].live, stats[i].peak, stats[i].allocs);
+#endif
+}
+
+static
+void print_json(void)
+{
+	fprintf(bench.out, "{\n");
+	print_memory();
+	fprintf(bench.out, "\t\"benchmarks\": [\n");
+	for (int i = 0 ; i < bench.nresults ; i++)
+	{
+		BenchResult *r = &bench.results[i];
+		fprintf(bench.out, "\t\t{ \"name\": \"%s\", \"ns_per_op\": %.2f, \"allocs_per_op\": %.3f, \"ops\": %lu }%s\n",
+			r->name, r->ns_per_op, r->allocs_per_op, r->ops, i + 1 < bench.nresults ? "," : "");
+	}
+	fprintf(bench.out, "\t]\n}\n");
+}
+
+static
+void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [--json] [--time MS] [FILTER]\n"
+		"       %s --scenarios --help\n"
+		"\n"
+		"  --json     print the results as JSON\n"
+		"  --time MS  minimum time for each measured run (default %d)\n"
+		"  FILTER     only run benchmarks whose name contains FILTER\n",
+		prog, prog, BENCH_DEFAULT_MS);
+}
+
+int main(int argc, char **argv)
+{
+	/* panics in measured code should not write crash logs */
+	flight_path = NULL;
+	if (argc > 1 && strcmp(argv[1], "--scenarios") == 0)
+		return scenario_main(argc - 1, argv + 1);
+
+	for (int i = 1 ; i < argc ; i++)
+	{
+		if (strcmp(argv[i], "--json") == 0)
+			bench.json = true;
+		else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc)
+			bench.run_ns = atol(argv[++i]) * 1000000L;
+		else if (argv[i][0] == '-')
+		{
+			usage(argv[0]);
+			return 1;
+		}
+		else
+			bench.filter = argv[i];
+	}
+
+	bench.out = fdopen(dup(STDOUT_FILENO), "w");
+	if (!bench.out)
+		bench.out = stdout;
+	setvbuf(bench.out, NULL, _IOLBF, 0);
+
+	bench_parse_showcases();
+	bench_eval_ops();
+	bench_get_fns();
+	bench_worlds();
+	bench_solvables();
+	bench_paths();
+	bench_sights();
+	bench_find_robots();
+
+	if (bench.json)
+		print_json();
+	else
+		print_memory();
+	fclose(bench.out);
+	return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef __robots_bench__
+#define __robots_bench__
+
+
+/* Run the end-to-end scenarios. `argv` holds the options that followed
+ * `--scenarios`. Returns an exit code, 1 on a regression. */
+int scenario_main(int argc, char **argv);
+
+
+#endif
@@ -0,0 +1,459 @@
+/* End-to-end scenario benchmarks.
+ *
+ * Every scenario generates a world and runs a program headlessly to the end,
+ * the same way `robots --headless` does. Each measurement is taken in a fresh
+ * child process so that its peak RSS is its own. */
+#define _POSIX_C_SOURCE 200809L /* clock_gettime, mkstemp */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <bench.h>
+#include <common.h>
+#include <lang.h>
+#include <worldgen.h>
+#include <headless.h>
+
+
+/* A child repeats its scenario for at least this long and reports the fastest run. */
+#ifndef SCENARIO_MIN_NS
+# define SCENARIO_MIN_NS (100 * 1000000L)
+#endif
+
+/* Regression threshold in percent when --threshold is not given. */
+#ifndef SCENARIO_DEFAULT_THRESHOLD
+# define SCENARIO_DEFAULT_THRESHOLD 15
+#endif
+
+/* Peak RSS differences smaller than this are allocator and page noise. */
+#ifndef SCENARIO_RSS_SLACK_KB
+# define SCENARIO_RSS_SLACK_KB 512
+#endif
+
+#ifndef SCENARIO_DEFAULT_BASELINE
+# define SCENARIO_DEFAULT_BASELINE "bench/baseline.json"
+#endif
+
+#ifndef SCENARIO_MAX
+# define SCENARIO_MAX 32
+#endif
+
+
+typedef struct
+{
+	char name[64];
+	char *program;     /* path of the program to run */
+	long seed;
+	int width, height, robot_count;
+	WorldLayout layout;
+	bool endless_fuel; /* keep the player going until the program ends */
+	bool must_win;     /* a showcase, which is broken if it doesn't win its level */
+	unsigned max_steps;
+} Scenario;
+
+typedef struct
+{
+	unsigned steps;
+	bool won;
+	double wall_ms;       /* fastest run, generation included */
+	double steps_per_sec;
+	long peak_rss_kb;
+} ScenarioResult;
+
+
+/* The wander program walks around the world scanning, ramming and refueling.
+ * It is written out `blocks` times so that it runs for a long while. */
+static
+char *write_wander_program(int blocks)
+{
+	static const char *head =
+		"fn look\n"
+		"\tscan $0\n"
+		"\tif $0 == robot then ram\n"
+		"\tif $0 == wall then turn cw\n"
+		"end\n";
+	static const char *block =
+		"run look\n"
+		"forward\n"
+		"refuel\n"
+		"if $1 == 3 then turn ccw\n"
+		"add $1 1\n"
+		"mod $1 4\n";
+
+	char *path = malloc(64);
+	strcpy(path, "/tmp/robots_wanderXXXXXX");
+	int fd = mkstemp(path);
+	FILE *fp = fd < 0 ? NULL : fdopen(fd, "w");
+	if (!fp)
+	{
+		fprintf(stderr, "error: failed to create a temporary program\n");
+		free(path);
+		return NULL;
+	}
+	fputs(head, fp);
+	for (int i = 0 ; i < blocks ; i++)
+		fputs(block, fp);
+	fclose(fp);
+	return path;
+}
+
+/* Read the `;args;` line at the top of a showcase, the same options that
+ * showcase.sh passes to the game. */
+static
+void read_showcase_args(Scenario *sc)
+{
+	FILE *fp = fopen(sc->program, "r");
+	if (!fp)
+		return;
+	char line[256];
+	if (fgets(line, sizeof(line), fp) && strncmp(line, ";args;", 6) == 0)
+	{
+		char *save = NULL;
+		for (char *arg = strtok_r(line + 6, " \t\r\n", &save) ; arg ; arg = strtok_r(NULL, " \t\r\n", &save))
+		{
+			int *field = NULL;
+			if (strcmp(arg, "--layout") == 0 && (arg = strtok_r(NULL, " \t\r\n", &save)))
+				worldgen_parse_layout(arg, &sc->layout);
+			else if (strcmp(arg, "-w") == 0 || strcmp(arg, "--width") == 0)
+				field = &sc->width;
+			else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--height") == 0)
+				field = &sc->height;
+			else if (strcmp(arg, "-r") == 0 || strcmp(arg, "--nrobots") == 0)
+				field = &sc->robot_count;
+			/* everything else only changes how the level looks */
+			if (field && (arg = strtok_r(NULL, " \t\r\n", &save)))
+				*field = strtol(arg, NULL, 10);
+		}
+	}
+	fclose(fp);
+}
+
+static
+long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static
+HeadlessResult run_once(Scenario *sc)
+{
+	State *state = generate_world(sc->seed, sc->width, sc->height, sc->robot_count, sc->layout);
+	if (sc->endless_fuel)
+	{
+		state->robots.max_fuel = 1 << 30;
+		if (state->robots.count)
+			state->robots.fuel[0] = state->robots.max_fuel;
+	}
+	HeadlessResult res = run_headless(state, sc->max_steps, NULL, NULL);
+	free_state(state);
+	return res;
+}
+
+/* Measure a scenario in a child process. */
+static
+bool measure(Scenario *sc, ScenarioResult *out)
+{
+	int fds[2];
+	if (pipe(fds) != 0)
+		return false;
+
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+	if (pid == 0)
+	{
+		/* programs may print */
+		if (!freopen("/dev/null", "w", stdout))
+			_exit(1);
+		close(fds[0]);
+		DEFAULT_PROGRAM_PATH = sc->program;
+
+		ScenarioResult r = {0};
+		long start = now_ns(), best = -1;
+		do
+		{
+			long t = now_ns();
+			HeadlessResult run = run_once(sc);
+			t = now_ns() - t;
+			r.steps = run.steps;
+			r.won = run.won;
+			if (best < 0 || t < best)
+				best = t;
+		} while (now_ns() - start < SCENARIO_MIN_NS);
+
+		r.wall_ms = best / 1e6;
+		r.steps_per_sec = r.steps / (r.wall_ms / 1e3);
+
+		struct rusage ru;
+		getrusage(RUSAGE_SELF, &ru);
+#		ifdef __APPLE__
+		r.peak_rss_kb = ru.ru_maxrss / 1024; /* bytes on macOS */
+#		else
+		r.peak_rss_kb = ru.ru_maxrss;
+#		endif
+
+		bool ok = write(fds[1], &r, sizeof(r)) == sizeof(r);
+		_exit(ok ? 0 : 1);
+	}
+
+	close(fds[1]);
+	bool ok = read(fds[0], out, sizeof(*out)) == sizeof(*out);
+	close(fds[0]);
+	int status;
+	waitpid(pid, &status, 0);
+	return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+
+typedef struct
+{
+	char name[64];
+	double wall_ms;
+	long peak_rss_kb;
+} Baseline;
+
+/* Read the scenarios back from a file written by --save. This only
+ * understands the layout that write_json produces. */
+static
+int read_baseline(const char *path, Baseline *out, int max)
+{
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+
+	int n = 0;
+	char line[512];
+	while (n < max && fgets(line, sizeof(line), fp))
+	{
+		char *name = strstr(line, "\"name\": \"");
+		char *wall = strstr(line, "\"wall_ms\": ");
+		char *rss = strstr(line, "\"peak_rss_kb\": ");
+		if (!name || !wall || !rss)
+			continue;
+		name += strlen("\"name\": \"");
+		int len = strcspn(name, "\"");
+		if (len >= (int)sizeof(out[n].name))
+			continue;
+		memcpy(out[n].name, name, len);
+		out[n].name[len] = '\0';
+		out[n].wall_ms = strtod(wall + strlen("\"wall_ms\": "), NULL);
+		out[n].peak_rss_kb = strtol(rss + strlen("\"peak_rss_kb\": "), NULL, 10);
+		n++;
+	}
+	fclose(fp);
+	return n;
+}
+
+static
+void write_json(FILE *fp, Scenario *scs, ScenarioResult *res, int n)
+{
+	fprintf(fp, "{\n\t\"scenarios\": [\n");
+	for (int i = 0 ; i < n ; i++)
+	{
+		fprintf(fp, "\t\t{ \"name\": \"%s\", \"steps\": %u, \"wall_ms\": %.4f, \"steps_per_sec\": %.0f, \"peak_rss_kb\": %ld }%s\n",
+			scs[i].name, res[i].steps, res[i].wall_ms, res[i].steps_per_sec, res[i].peak_rss_kb, i + 1 < n ? "," : "");
+	}
+	fprintf(fp, "\t]\n}\n");
+}
+
+static
+void usage(void)
+{
+	fprintf(stderr,
+		"usage: robots_bench --scenarios [options] [FILTER]\n"
+		"\n"
+		"  --runs N         measure each scenario N times and keep the fastest (default 5)\n"
+		"  --baseline FILE  compare against FILE (default %s)\n"
+		"  --threshold PCT  fail when a scenario is PCT%% slower or bigger (default %d)\n"
+		"  --save FILE      write the results as JSON to FILE\n"
+		"  --json           print the results as JSON\n"
+		"  FILTER           only run scenarios whose name contains FILTER\n",
+		SCENARIO_DEFAULT_BASELINE, SCENARIO_DEFAULT_THRESHOLD);
+}
+
+int scenario_main(int argc, char **argv)
+{
+	const char *baseline_path = SCENARIO_DEFAULT_BASELINE, *save_path = NULL, *filter = NULL;
+	double threshold = SCENARIO_DEFAULT_THRESHOLD;
+	int runs = 5;
+	bool json = false, baseline_given = false;
+
+	for (int i = 1 ; i < argc ; i++)
+	{
+		if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+			runs = strtol(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+		{
+			baseline_path = argv[++i];
+			baseline_given = true;
+		}
+		else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+			threshold = strtod(argv[++i], NULL);
+		else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc)
+			save_path = argv[++i];
+		else if (strcmp(argv[i], "--json") == 0)
+			json = true;
+		else if (argv[i][0] == '-')
+		{
+			usage();
+			return 2;
+		}
+		else
+			filter = argv[i];
+	}
+	if (runs < 1)
+		runs = 1;
+
+	Scenario scs[SCENARIO_MAX];
+	int n = 0;
+
+	/* the showcases, seeded with their number like showcase.sh does */
+	for (int i = 1 ; n < SCENARIO_MAX ; i++)
+	{
+		char path[64];
+		snprintf(path, sizeof(path), "showcases/%d.rbt", i);
+		if (access(path, R_OK) != 0)
+			break;
+		Scenario *sc = &scs[n++];
+		*sc = (Scenario){ .seed=i, .width=DEFAULT_WORLD_WIDTH, .height=DEFAULT_WORLD_HEIGHT, .robot_count=DEFAULT_ROBOT_COUNT, .must_win=true };
+		snprintf(sc->name, sizeof(sc->name), "showcase/%d", i);
+		sc->program = malloc(strlen(path) + 1);
+		strcpy(sc->program, path);
+		read_showcase_args(sc);
+	}
+
+	/* big worlds and crowds */
+	static const struct { int width, height, robot_count; WorldLayout layout; } sizes[] =
+	{
+		{ 64, 64, 16, LAYOUT_SCATTER },
+		{ 512, 512, 64, LAYOUT_SCATTER },
+		{ 128, 128, 4096, LAYOUT_SCATTER },
+		{ 512, 512, 64, LAYOUT_CAVE },
+	};
+	char *wander = write_wander_program(4000);
+	for (size_t i = 0 ; wander && i < sizeof(sizes) / sizeof(sizes[0]) && n < SCENARIO_MAX ; i++)
+	{
+		Scenario *sc = &scs[n++];
+		*sc = (Scenario){ .program=wander, .seed=1, .endless_fuel=true, .max_steps=20000 };
+		sc->width = sizes[i].width;
+		sc->height = sizes[i].height;
+		sc->robot_count = sizes[i].robot_count;
+		sc->layout = sizes[i].layout;
+		snprintf(sc->name, sizeof(sc->name), "wander/%dx%d/%d", sc->width, sc->height, sc->robot_count);
+		if (sc->layout != LAYOUT_SCATTER)
+			snprintf(sc->name, sizeof(sc->name), "wander/%s/%dx%d/%d", worldgen_layout_names[sc->layout], sc->width, sc->height, sc->robot_count);
+	}
+
+	Baseline base[SCENARIO_MAX];
+	int nbase = read_baseline(baseline_path, base, SCENARIO_MAX);
+	if (nbase < 0 && baseline_given)
+	{
+		fprintf(stderr, "error: failed to read `%s`, are you missing permissions?\n", baseline_path);
+		return 2;
+	}
+
+	if (!json)
+		printf("%-24s %8s %12s %14s %12s  %s\n", "scenario", "steps", "wall ms", "steps/sec", "peak rss kb", "vs baseline");
+
+	ScenarioResult res[SCENARIO_MAX];
+	Scenario ran[SCENARIO_MAX];
+	int nran = 0, regressions = 0;
+	for (int i = 0 ; i < n ; i++)
+	{
+		if (filter && !strstr(scs[i].name, filter))
+			continue;
+
+		ScenarioResult best = {0}, r;
+		bool ok = false;
+		for (int k = 0 ; k < runs ; k++)
+		{
+			if (!measure(&scs[i], &r))
+				continue;
+			/* the fastest time and the smallest footprint are the least noisy */
+			if (!ok)
+				best = r;
+			if (r.wall_ms < best.wall_ms)
+			{
+				best.wall_ms = r.wall_ms;
+				best.steps_per_sec = r.steps_per_sec;
+			}
+			if (r.peak_rss_kb < best.peak_rss_kb)
+				best.peak_rss_kb = r.peak_rss_kb;
+			ok = true;
+		}
+		if (!ok)
+		{
+			fprintf(stderr, "error: scenario `%s` failed\n", scs[i].name);
+			regressions++;
+			continue;
+		}
+		ran[nran] = scs[i];
+		res[nran++] = best;
+
+		/* a showcase that no longer wins is broken however fast it is */
+		if (scs[i].must_win && !best.won)
+		{
+			fprintf(stderr, "error: scenario `%s` did not win its level\n", scs[i].name);
+			regressions++;
+		}
+
+		/* compare against the baseline */
+		char verdict[64] = "";
+		for (int b = 0 ; b < nbase ; b++)
+		{
+			if (strcmp(base[b].name, scs[i].name) != 0)
+				continue;
+			double dt = base[b].wall_ms > 0 ? (best.wall_ms / base[b].wall_ms - 1) * 100 : 0;
+			double dm = base[b].peak_rss_kb > 0 ? ((double)best.peak_rss_kb / base[b].peak_rss_kb - 1) * 100 : 0;
+			bool bad = dt > threshold || (dm > threshold && best.peak_rss_kb - base[b].peak_rss_kb > SCENARIO_RSS_SLACK_KB);
+			snprintf(verdict, sizeof(verdict), "%+.1f%% time %+.1f%% rss%s", dt, dm, bad ? "  REGRESSED" : "");
+			regressions += bad;
+			break;
+		}
+		if (!json)
+		{
+			printf("%-24s %8u %12.4f %14.0f %12ld  %s\n", scs[i].name, best.steps, best.wall_ms,
+				best.steps_per_sec, best.peak_rss_kb, verdict[0] ? verdict : "-");
+		}
+	}
+
+	if (json)
+		write_json(stdout, ran, res, nran);
+	if (save_path)
+	{
+		FILE *fp = fopen(save_path, "w");
+		if (fp)
+		{
+			write_json(fp, ran, res, nran);
+			fclose(fp);
+		}
+		else
+			fprintf(stderr, "error: failed to create `%s`, are you missing permissions?\n", save_path);
+	}
+
+	fflush(stdout);
+	if (regressions)
+		fprintf(stderr, "%d scenario%s regressed by more than %g%%\n", regressions, regressions == 1 ? "" : "s", threshold);
+
+	if (wander)
+	{
+		remove(wander);
+		free(wander);
+	}
+	for (int i = 0 ; i < n ; i++)
+	{
+		if (scs[i].program != wander)
+			free(scs[i].program);
+	}
+	return regressions ? 1 : 0;
+}
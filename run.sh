@@ -2,9 +2,12 @@
 set -e
 
 CC="gcc"
-CFLAGS="-o robots -g -std=c99 -Iraylib/src/ -Isrc/"
+OUTPUT="robots"
+CFLAGS="-g -std=c99 -Iraylib/src/ -Isrc/"
 LFLAGS=""
-SOURCES="src/main.c src/rendering.c src/common.c src/lang.c src/audio.c src/ui.c src/editor.c src/render_test.c ./raylib/src/libraylib.a"
+SOURCES="src/main.c src/rendering.c src/common.c src/lang.c src/scan.c src/opstats.c src/frametime.c src/trace.c src/flight.c src/mem.c src/bitset.c src/sight.c src/parallel.c src/worldgen.c src/paths.c src/prefetch.c src/journal.c src/headless.c src/replay.c src/level.c src/watch.c src/textbuf.c src/audio.c src/ui.c src/editor.c src/render_test.c ./raylib/src/libraylib.a"
+# The benchmarks include lang.c and common.c themselves
+BENCH_SOURCES="bench/bench.c bench/scenario.c src/rendering.c src/scan.c src/opstats.c src/frametime.c src/trace.c src/flight.c src/mem.c src/bitset.c src/sight.c src/parallel.c src/worldgen.c src/paths.c src/prefetch.c src/journal.c src/headless.c src/replay.c src/level.c src/watch.c src/textbuf.c src/audio.c src/ui.c src/editor.c src/render_test.c ./raylib/src/libraylib.a"
 # Options
 RUN_MODE=""
 
@@ -32,6 +35,29 @@ do
 			echo "Will only compile"
 			shift
 			;;
+		--bench|-b)
+			RUN_MODE="bench"
+			OUTPUT="robots_bench"
+			CFLAGS="$CFLAGS -O2 -Ibench/"
+			SOURCES=$BENCH_SOURCES
+			echo "Will build and run the benchmarks"
+			shift
+			;;
+		--opstats|-O)
+			CFLAGS="$CFLAGS -DLANG_OPSTATS=1"
+			echo "Building with per-operation interpreter statistics (F9 prints them)"
+			shift
+			;;
+		--release|-R)
+			CFLAGS="$CFLAGS -O2 -DNDEBUG"
+			echo "Building for release (no allocation tracking)"
+			shift
+			;;
+		--native|-N)
+			CFLAGS="$CFLAGS -O2 -march=native"
+			echo "Building for this CPU (enables AVX2 scanning where available)"
+			shift
+			;;
 		--debug|-d)
 			CFLAGS="$CFLAGS -DDEBUG_GAME"
 			echo "Building with DEBUG_GAME enabled"
@@ -62,7 +88,7 @@ then
 fi
 
 # Compile
-$CC $CFLAGS $SOURCES $LFLAGS
+$CC -o $OUTPUT $CFLAGS $SOURCES $LFLAGS
 
 # Run
 case $RUN_MODE in
@@ -81,6 +107,9 @@ case $RUN_MODE in
 	"gdb")
 		gdb -q -ex=r --args ./robots $PROGRAM_FLAGS
 		;;
+	"bench")
+		./robots_bench $PROGRAM_FLAGS
+		;;
 	"none")
 		;;
 	*)
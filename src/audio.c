@@ -1,5 +1,6 @@
 #include <audio.h>
 #include <stdbool.h>
+#include <trace.h>
 
 static Sound sfx[SFX_COUNT];
 static Music music;
@@ -42,7 +43,9 @@ void play_music(const char *path)
 		UnloadMusicStream(music);
 	}
 
+	unsigned long long traced = trace_begin();
 	music = LoadMusicStream(path);
+	trace_end_path(traced, "asset", "load_music", path);
 	music.looping = true;
 	music_loaded = true;
 	SetMusicVolume(music, 1.0f);
@@ -61,7 +64,10 @@ void update_music(void)
 {
 	if (music_loaded)
 	{
+		// Refills the stream buffers the device has played
+		unsigned long long traced = trace_begin();
 		UpdateMusicStream(music);
+		trace_end(traced, "audio", "music_refill");
 	}
 }
 
@@ -69,7 +75,9 @@ void load_sfx(int id, const char *path)
 {
 	if (id >= 0 && id < SFX_COUNT)
 	{
+		unsigned long long traced = trace_begin();
 		sfx[id] = LoadSound(path);
+		trace_end_path(traced, "asset", "load_sfx", path);
 	}
 }
 
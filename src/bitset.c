@@ -0,0 +1,294 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <bitset.h>
+#include <mem.h>
+
+
+bool bitset_init(Bitset *b, int width, int height)
+{
+	b->width = width;
+	b->height = height;
+	b->stride = (width + 63) / 64;
+	b->words = mem_calloc(MEM_WORLD, (size_t)b->stride * height, sizeof(uint64_t));
+	return b->words != NULL;
+}
+
+void bitset_free(Bitset *b)
+{
+	mem_free(b->words);
+	b->words = NULL;
+}
+
+void bitset_clear(Bitset *b)
+{
+	memset(b->words, 0, (size_t)b->stride * b->height * sizeof(uint64_t));
+}
+
+
+/* Spread the set bits of `s` toward the high bits along the runs of `m` they
+ * are in (Kogge-Stone occluded fill). `s` must be a subset of `m`. */
+static
+uint64_t fill_up(uint64_t s, uint64_t m)
+{
+	s |= m & (s << 1);  m &= m << 1;
+	s |= m & (s << 2);  m &= m << 2;
+	s |= m & (s << 4);  m &= m << 4;
+	s |= m & (s << 8);  m &= m << 8;
+	s |= m & (s << 16); m &= m << 16;
+	s |= m & (s << 32);
+	return s;
+}
+
+static
+uint64_t fill_down(uint64_t s, uint64_t m)
+{
+	s |= m & (s >> 1);  m &= m >> 1;
+	s |= m & (s >> 2);  m &= m >> 2;
+	s |= m & (s >> 4);  m &= m >> 4;
+	s |= m & (s >> 8);  m &= m >> 8;
+	s |= m & (s >> 16); m &= m >> 16;
+	s |= m & (s >> 32);
+	return s;
+}
+
+/* Fill a row along its open runs, which may cross word boundaries. Words
+ * with nothing to spread or nothing left to reach are skipped, which after
+ * the first sweep is nearly all of them. */
+static
+void fill_row(uint64_t *r, const uint64_t *m, int stride)
+{
+	uint64_t carry = 0;
+	for (int i = 0 ; i < stride ; i++)
+	{
+		uint64_t s = r[i] | (carry & m[i]);
+		if (s != 0 && s != m[i])
+			s = fill_up(s, m[i]);
+		r[i] = s;
+		carry = s >> 63;
+	}
+	carry = 0;
+	for (int i = stride - 1 ; i >= 0 ; i--)
+	{
+		uint64_t s = r[i] | ((carry << 63) & m[i]);
+		if (s != 0 && s != m[i])
+			s = fill_down(s, m[i]);
+		r[i] = s;
+		carry = s & 1;
+	}
+}
+
+/* Rows are swept top to bottom and back, each taking what the row before it
+ * reached and filling it sideways, until a round trip adds nothing. Open
+ * areas take a single round trip, winding ones one per turn back. */
+void bitset_flood(Bitset *reach, const Bitset *open)
+{
+	int h = reach->height, n = reach->stride;
+	for (int y = 0 ; y < h ; y++)
+		fill_row(bitset_row(reach, y), bitset_row(open, y), n);
+
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (int pass = 0 ; pass < 2 ; pass++)
+		{
+			for (int k = 1 ; k < h ; k++)
+			{
+				int y = pass == 0 ? k : h - 1 - k;
+				const uint64_t *from = bitset_row(reach, pass == 0 ? y - 1 : y + 1);
+				const uint64_t *m = bitset_row(open, y);
+				uint64_t *r = bitset_row(reach, y);
+
+				uint64_t grew = 0;
+				for (int i = 0 ; i < n ; i++)
+				{
+					uint64_t add = from[i] & m[i] & ~r[i];
+					r[i] |= add;
+					grew |= add;
+				}
+				if (grew)
+				{
+					fill_row(r, m, n);
+					changed = true;
+				}
+			}
+		}
+	}
+}
+
+bool bitset_subset(const Bitset *a, const Bitset *b)
+{
+	long n = (long)a->stride * a->height;
+	for (long i = 0 ; i < n ; i++)
+	{
+		if (a->words[i] & ~b->words[i])
+			return false;
+	}
+	return true;
+}
+
+bool bitset_intersects(const Bitset *a, const Bitset *b)
+{
+	long n = (long)a->stride * a->height;
+	for (long i = 0 ; i < n ; i++)
+	{
+		if (a->words[i] & b->words[i])
+			return true;
+	}
+	return false;
+}
+
+bool bitset_first(const Bitset *b, int *x, int *y)
+{
+	long n = (long)b->stride * b->height;
+	for (long i = 0 ; i < n ; i++)
+	{
+		if (b->words[i])
+		{
+			*x = (int)(i % b->stride) * 64 + __builtin_ctzll(b->words[i]);
+			*y = (int)(i / b->stride);
+			return true;
+		}
+	}
+	return false;
+}
+
+void bitset_invert(Bitset *dst, const Bitset *src)
+{
+	/* the padding past the width has to stay clear */
+	int tail = src->width & 63;
+	uint64_t last = tail ? ((uint64_t)1 << tail) - 1 : ~(uint64_t)0;
+	for (int y = 0 ; y < src->height ; y++)
+	{
+		const uint64_t *s = bitset_row(src, y);
+		uint64_t *d = bitset_row(dst, y);
+		for (int i = 0 ; i < src->stride ; i++)
+			d[i] = ~s[i];
+		d[src->stride - 1] &= last;
+	}
+}
+
+/* Bits [lo, hi) of a word, for 0 <= lo < hi <= 64. */
+static
+uint64_t span_mask(int lo, int hi)
+{
+	uint64_t upto = hi == 64 ? ~(uint64_t)0 : ((uint64_t)1 << hi) - 1;
+	return upto & ~(((uint64_t)1 << lo) - 1);
+}
+
+int bitset_count_rect(const Bitset *b, int x0, int y0, int x1, int y1)
+{
+	x0 = x0 > 0 ? x0 : 0;
+	y0 = y0 > 0 ? y0 : 0;
+	x1 = x1 < b->width ? x1 : b->width;
+	y1 = y1 < b->height ? y1 : b->height;
+	if (x0 >= x1 || y0 >= y1)
+		return 0;
+
+	int w0 = x0 >> 6, w1 = (x1 - 1) >> 6;
+	int count = 0;
+	for (int y = y0 ; y < y1 ; y++)
+	{
+		const uint64_t *r = bitset_row(b, y);
+		if (w0 == w1)
+		{
+			count += __builtin_popcountll(r[w0] & span_mask(x0 & 63, ((x1 - 1) & 63) + 1));
+			continue;
+		}
+		count += __builtin_popcountll(r[w0] & span_mask(x0 & 63, 64));
+		for (int i = w0 + 1 ; i < w1 ; i++)
+			count += __builtin_popcountll(r[i]);
+		count += __builtin_popcountll(r[w1] & span_mask(0, ((x1 - 1) & 63) + 1));
+	}
+	return count;
+}
+
+void bitset_fill_rect(Bitset *b, int x0, int y0, int x1, int y1, bool on)
+{
+	x0 = x0 > 0 ? x0 : 0;
+	y0 = y0 > 0 ? y0 : 0;
+	x1 = x1 < b->width ? x1 : b->width;
+	y1 = y1 < b->height ? y1 : b->height;
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	int w0 = x0 >> 6, w1 = (x1 - 1) >> 6;
+	for (int y = y0 ; y < y1 ; y++)
+	{
+		uint64_t *r = bitset_row(b, y);
+		for (int i = w0 ; i <= w1 ; i++)
+		{
+			uint64_t m = span_mask(i == w0 ? x0 & 63 : 0, i == w1 ? ((x1 - 1) & 63) + 1 : 64);
+			r[i] = on ? r[i] | m : r[i] & ~m;
+		}
+	}
+}
+
+/* The set bits on the square ring `r` tiles out from (x, y), counted as the
+ * square minus the one inside it. */
+static
+int ring_count(const Bitset *b, int x, int y, int r)
+{
+	int n = bitset_count_rect(b, x - r, y - r, x + r + 1, y + r + 1);
+	if (r > 0)
+		n -= bitset_count_rect(b, x - r + 1, y - r + 1, x + r, y + r);
+	return n;
+}
+
+static
+void ring_check(const Bitset *b, int x, int y, int tx, int ty, int *best, int *bx, int *by)
+{
+	if (tx < 0 || ty < 0 || tx >= b->width || ty >= b->height || !bitset_get(b, tx, ty))
+		return;
+	int d = abs(tx - x) + abs(ty - y);
+	if (d < *best)
+	{
+		*best = d;
+		*bx = tx;
+		*by = ty;
+	}
+}
+
+int bitset_nearest(const Bitset *b, int x, int y, int rmin, int rmax, int *nx, int *ny)
+{
+	/* the first ring with anything on it, found by halving, since the square
+	 * counts only grow with the radius */
+	int base = rmin > 0 ? bitset_count_rect(b, x - rmin + 1, y - rmin + 1, x + rmin, y + rmin) : 0;
+	if (bitset_count_rect(b, x - rmax, y - rmax, x + rmax + 1, y + rmax + 1) == base)
+		return -1;
+	int lo = rmin, hi = rmax;
+	while (lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+		if (bitset_count_rect(b, x - mid, y - mid, x + mid + 1, y + mid + 1) > base)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	/* a bit on ring r is at most 2r steps away, so later rings can only
+	 * do better up to there */
+	int best = INT_MAX;
+	for (int r = lo ; r <= rmax && r < best ; r++)
+	{
+		if (ring_count(b, x, y, r) == 0)
+			continue;
+		if (r == 0)
+		{
+			ring_check(b, x, y, x, y, &best, nx, ny);
+			continue;
+		}
+		for (int k = -r ; k <= r ; k++)
+		{
+			ring_check(b, x, y, x + k, y - r, &best, nx, ny);
+			ring_check(b, x, y, x + k, y + r, &best, nx, ny);
+		}
+		for (int k = -r + 1 ; k < r ; k++)
+		{
+			ring_check(b, x, y, x - r, y + k, &best, nx, ny);
+			ring_check(b, x, y, x + r, y + k, &best, nx, ny);
+		}
+	}
+	return best;
+}
@@ -0,0 +1,67 @@
+#ifndef __robots_bitset__
+#define __robots_bitset__
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* One bit per tile of a width x height grid. Each row is padded to whole
+ * 64-bit words so that neighbouring tiles of a row share a word and a whole
+ * row can be shifted or masked at once. Bits past the width are always 0. */
+typedef struct
+{
+	int width, height;
+	int stride; /* words per row */
+	uint64_t *words;
+} Bitset;
+
+bool bitset_init(Bitset *b, int width, int height);
+void bitset_free(Bitset *b);
+void bitset_clear(Bitset *b);
+
+static inline
+uint64_t *bitset_row(const Bitset *b, int y)
+{
+	return &b->words[(long)y * b->stride];
+}
+
+static inline
+bool bitset_get(const Bitset *b, int x, int y)
+{
+	return bitset_row(b, y)[x >> 6] >> (x & 63) & 1;
+}
+
+static inline
+void bitset_set(Bitset *b, int x, int y, bool on)
+{
+	uint64_t bit = (uint64_t)1 << (x & 63);
+	if (on)
+		bitset_row(b, y)[x >> 6] |= bit;
+	else
+		bitset_row(b, y)[x >> 6] &= ~bit;
+}
+
+/* Grow `reach` to every bit of `open` that is 4-connected to one of its set
+ * bits through `open`. Both must be the same size, and `reach` should only
+ * start with bits that are in `open`. */
+void bitset_flood(Bitset *reach, const Bitset *open);
+/* True if every bit set in `a` is also set in `b`. */
+bool bitset_subset(const Bitset *a, const Bitset *b);
+/* True if `a` and `b` have a bit in common. */
+bool bitset_intersects(const Bitset *a, const Bitset *b);
+/* The first set bit in row order, false if there is none. */
+bool bitset_first(const Bitset *b, int *x, int *y);
+/* Set `dst` to every bit of the grid that is not set in `src`. */
+void bitset_invert(Bitset *dst, const Bitset *src);
+/* The number of set bits in [x0, x1) x [y0, y1), clipped to the grid. */
+int bitset_count_rect(const Bitset *b, int x0, int y0, int x1, int y1);
+/* Set or clear every bit in [x0, x1) x [y0, y1), clipped to the grid. */
+void bitset_fill_rect(Bitset *b, int x0, int y0, int x1, int y1, bool on);
+/* The set bit fewest steps (across plus down) from (x, y) among those in the
+ * square of rings `rmin` to `rmax` around it, stored in `*nx, *ny`. Returns
+ * the number of steps, or -1 if the square has none. */
+int bitset_nearest(const Bitset *b, int x, int y, int rmin, int rmax, int *nx, int *ny);
+
+
+#endif
@@ -2,111 +2,298 @@
 #include <time.h>
 #include <common.h>
 #include <lang.h>
+#include <trace.h>
+#include <mem.h>
+#include <bitset.h>
+#include <worldgen.h>
+#include <paths.h>
+
+const int direction_dx[4] = { [North]=0, [South]=0, [East]=1, [West]=-1 };
+const int direction_dy[4] = { [North]=-1, [South]=1, [East]=0, [West]=0 };
 
 World *new_world(int width, int height)
 {
-	World *w = malloc(sizeof(World) + (width * height * sizeof(int)));
+	World *w = mem_alloc(MEM_WORLD, sizeof(World) + (width * height * sizeof(int)));
 	w->width = width;
 	w->height = height;
 	for (int i = 0; i < width * height; i++)
 	{
 		w->tiles[i] = 0;
 	}
+	bitset_init(&w->walls, width, height);
+	bitset_init(&w->energy, width, height);
+	bitset_init(&w->robots, width, height);
+	w->paths = NULL;
+	w->wall_edits = 0;
+	w->ndirty = WORLD_DIRTY_ALL;
 	return w;
 }
 
-State *generate_world(long seed, int width, int height, int robot_count)
+void free_world(World *w)
 {
-    if (seed == -1)
-	    srand((unsigned int)time(NULL));
-    else
-        srand(seed);
+	if (w)
+	{
+		bitset_free(&w->walls);
+		bitset_free(&w->energy);
+		bitset_free(&w->robots);
+		paths_free(w->paths);
+		mem_free(w);
+	}
+}
 
-	State *state = malloc(sizeof(State));
+/* Make an empty level with a blank world and no robots
+ * Input/Pre-Condition: Takes the world size and the level's fuel settings
+ * Output/Post-Condition: Returns a State with a fresh language context
+*/
+State *new_state(int width, int height, int max_fuel, int canister_fuel)
+{
+	State *state = mem_alloc(MEM_WORLD, sizeof(State));
 	state->world = new_world(width, height);
-	state->robot_count = 0;
+	robots_init(&state->robots, 0);
+	state->robots.max_fuel = max_fuel;
+	state->canister_fuel = canister_fuel;
+
+    /* Create language context */
+    state->stepper = make_stepper(0, NULL);
+    state->journal = NULL;
+    state->program_running = false;
+
+	return state;
+}
+
+void rng_seed(Rng *r, long seed)
+{
+	static unsigned long calls;
+	if (seed == -1)
+		r->s = (unsigned long long)time(NULL) * 0x9e3779b97f4a7c15ULL + __atomic_add_fetch(&calls, 1, __ATOMIC_RELAXED);
+	else
+		r->s = (unsigned long long)seed;
+}
+
+/* splitmix64, whose state only ever advances by a constant */
+static unsigned rng_mix(unsigned long long z)
+{
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return (unsigned)((z ^ (z >> 31)) >> 32);
+}
+
+unsigned rng_next(Rng *r)
+{
+	return rng_mix(r->s += 0x9e3779b97f4a7c15ULL);
+}
+
+unsigned rng_at(unsigned long long key, unsigned long long n)
+{
+	return rng_mix(key + (n + 1) * 0x9e3779b97f4a7c15ULL);
+}
+
+int rng_range(Rng *r, int n)
+{
+	return (int)(((unsigned long long)rng_next(r) * (unsigned)n) >> 32);
+}
+
+/* Rebuild the bits of the world from its tiles and robots
+ * Input/Pre-Condition: Takes a State whose tiles or robots were written directly
+ * Output/Post-Condition: The walls, energy and robots bits match them again and distance fields are dropped
+*/
+void world_sync(State *state)
+{
+	World *w = state->world;
+	for (int y = 0; y < w->height; y++)
+	{
+		// pack a word of tiles at a time
+		const int *tiles = &w->tiles[y * w->width];
+		uint64_t *walls = bitset_row(&w->walls, y), *energy = bitset_row(&w->energy, y);
+		for (int i = 0; i < w->walls.stride; i++)
+		{
+			int n = w->width - i * 64 < 64 ? w->width - i * 64 : 64;
+			uint64_t ww = 0, ew = 0;
+			for (int b = 0; b < n; b++)
+			{
+				ww |= (uint64_t)(tiles[i * 64 + b] == TILE_WALL) << b;
+				ew |= (uint64_t)(tiles[i * 64 + b] == TILE_ENERGY) << b;
+			}
+			walls[i] = ww;
+			energy[i] = ew;
+		}
+	}
+
+	Robots *rs = &state->robots;
+	bitset_clear(&w->robots);
+	for (int k = 0; k < rs->nlive; k++)
+		bitset_set(&w->robots, rs->x[rs->live[k]], rs->y[rs->live[k]], true);
+
+	w->wall_edits++;
+	w->ndirty = WORLD_DIRTY_ALL;
+	if (w->paths)
+		paths_invalidate(w->paths);
+}
+
+/* Mark the tiles the player can walk to, treating other robots as passable
+ * since they can be rammed out of the way. `reach` is left empty when there
+ * is no player. */
+static void world_reach(State *state, const Bitset *open, Bitset *reach)
+{
+	bitset_clear(reach);
+	Robots *rs = &state->robots;
+	if (rs->count > 0 && robot_is_player(rs, 0))
+	{
+		bitset_set(reach, rs->x[0], rs->y[0], true);
+		bitset_flood(reach, open);
+	}
+}
+
+/* Find a robot or fuel canister the player cannot reach. Fuel only counts
+ * as unreachable when none of it can be reached.
+ * Output/Post-Condition: Returns false if there is none, else its position */
+static bool find_unreachable(State *state, const Bitset *reach, int *tx, int *ty)
+{
+	Robots *rs = &state->robots;
+	for (int i = 1; i < rs->count; i++)
+	{
+		if (!bitset_get(reach, rs->x[i], rs->y[i]))
+		{
+			*tx = rs->x[i];
+			*ty = rs->y[i];
+			return true;
+		}
+	}
+	const Bitset *energy = &state->world->energy;
+	return !bitset_intersects(energy, reach) && bitset_first(energy, tx, ty);
+}
+
+bool world_solvable(State *state)
+{
+	World *w = state->world;
+	Bitset open, reach;
+	bitset_init(&open, w->width, w->height);
+	bitset_init(&reach, w->width, w->height);
+	bitset_invert(&open, &w->walls);
+	world_reach(state, &open, &reach);
+	int tx, ty;
+	bool ok = !find_unreachable(state, &reach, &tx, &ty);
+	bitset_free(&open);
+	bitset_free(&reach);
+	return ok;
+}
+
+/* Knock down the walls on an L-shaped path from (x, y) towards the player
+ * until it joins the reachable area. Only interior tiles are on the path. */
+static void carve_to_player(State *state, Bitset *open, const Bitset *reach, int x, int y)
+{
+	World *w = state->world;
+	int px = state->robots.x[0], py = state->robots.y[0];
+	while (!bitset_get(reach, x, y))
+	{
+		if (bitset_get(&w->walls, x, y))
+		{
+			set_tile(w, x, y, TILE_EMPTY);
+			bitset_set(open, x, y, true);
+		}
+		if (x != px)
+			x += x < px ? 1 : -1;
+		else if (y != py)
+			y += y < py ? 1 : -1;
+		else
+			break;
+	}
+}
+
+State *generate_world(long seed, int width, int height, int robot_count, WorldLayout layout)
+{
+	unsigned long long traced = trace_begin();
+	Rng rng;
+	rng_seed(&rng, seed);
+
+	State *state = new_state(width, height, MAX_FUEL, FUEL_CANISTER_AMOUNT);
 
 	// Add walls around the border
 	for (int x = 0; x < width; x++)
 	{
-		*get_tile(state->world, x, 0) = TILE_WALL;
-		*get_tile(state->world, x, height - 1) = TILE_WALL;
+		set_tile(state->world, x, 0, TILE_WALL);
+		set_tile(state->world, x, height - 1, TILE_WALL);
 	}
 	for (int y = 0; y < height; y++)
 	{
-		*get_tile(state->world, 0, y) = TILE_WALL;
-		*get_tile(state->world, width - 1, y) = TILE_WALL;
+		set_tile(state->world, 0, y, TILE_WALL);
+		set_tile(state->world, width - 1, y, TILE_WALL);
 	}
 
-	// Scatter some random walls
 	int interior_tiles = (width - 2) * (height - 2);
-	int wall_count = interior_tiles / WALL_DIVISOR;
-	for (int i = 0; i < wall_count; i++)
+	if (layout == LAYOUT_SCATTER)
+	{
+		// Scatter some random walls
+		int wall_count = interior_tiles / WALL_DIVISOR;
+		for (int i = 0; i < wall_count; i++)
+		{
+			int x = 1 + rng_range(&rng, width - 2);
+			int y = 1 + rng_range(&rng, height - 2);
+			set_tile(state->world, x, y, TILE_WALL);
+		}
+	}
+	else
 	{
-		int x = 1 + rand() % (width - 2);
-		int y = 1 + rand() % (height - 2);
-		*get_tile(state->world, x, y) = TILE_WALL;
+		// Lay out the walls chunk by chunk from a key of their own
+		unsigned long long key = (unsigned long long)rng_next(&rng) << 32 | rng_next(&rng);
+		worldgen_layout(state->world, key, layout);
+		state->world->wall_edits++; // the chunks write their tiles without counting
 	}
 
 	// Scatter some energy pickups
 	int energy_count = interior_tiles / ENERGY_DIVISOR;
 	for (int i = 0; i < energy_count; i++)
 	{
-		int x = 1 + rand() % (width - 2);
-		int y = 1 + rand() % (height - 2);
+		int x = 1 + rng_range(&rng, width - 2);
+		int y = 1 + rng_range(&rng, height - 2);
 		if (is_tile_free(state->world, x, y))
 		{
-			*get_tile(state->world, x, y) = TILE_ENERGY;
+			set_tile(state->world, x, y, TILE_ENERGY);
 		}
 	}
 
-	// Place robots randomly
-	if (robot_count > MAX_ROBOTS)
+	// Place robots on distinct free tiles, drawn without replacement
+	int nfree = 0;
+	int *free_tiles = mem_alloc(MEM_WORLD, (interior_tiles > 0 ? interior_tiles : 1) * sizeof(int));
+	for (int y = 1; y < height - 1; y++)
 	{
-		robot_count = MAX_ROBOTS;
+		for (int x = 1; x < width - 1; x++)
+		{
+			if (is_tile_free(state->world, x, y))
+				free_tiles[nfree++] = y * width + x;
+		}
 	}
-
-    for (int i = 0 ; i < MAX_ROBOTS ; i++)
-        state->robots[i] = (Robot){0}; /* initialize robots to zero */
-
-	for (int i = 0; i < robot_count; i++)
+	for (int i = 0; i < robot_count && nfree > 0; i++)
 	{
-		int x, y;
-		int attempts = 0;
-		bool position_valid;
-		do
-		{
-			x = 1 + rand() % (width - 2);
-			y = 1 + rand() % (height - 2);
-			attempts++;
-
-			// Check if tile is free and no robot is already there
-			position_valid = is_tile_free(state->world, x, y);
-			if (position_valid)
-			{
-				for (int j = 0; j < state->robot_count; j++)
-				{
-					if (state->robots[j].x == x && state->robots[j].y == y)
-					{
-						position_valid = false;
-						break;
-					}
-				}
-			}
-		} while (!position_valid && attempts < MAX_PLACEMENT_ATTEMPTS);
+		int k = rng_range(&rng, nfree);
+		int tile = free_tiles[k];
+		free_tiles[k] = free_tiles[--nfree];
+		Direction dir = rng_range(&rng, 4);
+		robots_add(&state->robots, i == 0, tile % width, tile / width, dir);
+		bitset_set(&state->world->robots, tile % width, tile / width, true);
+	}
+	mem_free(free_tiles);
 
-		if (attempts < MAX_PLACEMENT_ATTEMPTS)
+	// Make sure the player can get to every enemy and to some fuel. Each
+	// repair joins one target to the reachable area, so this always ends.
+	if (state->robots.count > 0)
+	{
+		Bitset open, reach;
+		bitset_init(&open, width, height);
+		bitset_init(&reach, width, height);
+		bitset_invert(&open, &state->world->walls);
+		world_reach(state, &open, &reach);
+		int tx, ty;
+		while (find_unreachable(state, &reach, &tx, &ty))
 		{
-			Direction dir = rand() % 4;
-			Robot r = new_robot(i == 0, x, y, dir);
-			state->robots[state->robot_count++] = r;
+			carve_to_player(state, &open, &reach, tx, ty);
+			world_reach(state, &open, &reach);
 		}
+		bitset_free(&open);
+		bitset_free(&reach);
 	}
 
-    /* Create language context */
-    state->stepper = make_stepper(0, NULL);
-    state->program_running = false;
-
+	trace_end(traced, "world", "generate_world");
 	return state;
 }
 
@@ -115,8 +302,9 @@ void free_state(State *state)
 	if (state)
 	{
 		del_stepper(state->stepper);
-		free(state->world);
-		free(state);
+		robots_free(&state->robots);
+		free_world(state->world);
+		mem_free(state);
 	}
 }
 
@@ -151,163 +339,207 @@ int *get_tile(World *w, int x, int y)
 */
 int *get_tile_with_offset(World *w, int x, int y, Direction d)
 {
-    switch (d)
-    {
-    case North:
-        y--;
-        break;
-    case South:
-        y++;
-        break;
-    case East:
-        x++;
-        break;
-    case West:
-        x--;
-        break;
-    }
-    return get_tile(w, x, y);
+    return get_tile(w, x + direction_dx[d], y + direction_dy[d]);
 }
 
-bool is_tile_free(World *w, int x, int y)
+/* Change a tile without telling anything that caches the world
+ * Input/Pre-Condition: Takes the World, a position within it and the new tile
+ * Output/Post-Condition: The tile and the walls and energy bits are updated
+*/
+void write_tile(World *w, int x, int y, int tile)
 {
-	return *get_tile(w, x, y) == TILE_EMPTY;
+	w->tiles[y * w->width + x] = tile;
+	bitset_set(&w->walls, x, y, tile == TILE_WALL);
+	bitset_set(&w->energy, x, y, tile == TILE_ENERGY);
 }
 
-/* Make a new robot
- * Input/Pre-Condition: Need to know if the robot is a player or not
- * Output/Post-Condition: Will return a Robot with the default values
+/* Change a tile
+ * Input/Pre-Condition: Takes the World, a position within it and the new tile
+ * Output/Post-Condition: The tile, the walls and energy bits, any distance fields and the dirty tiles are updated
 */
-Robot new_robot(bool is_player, int x, int y, Direction dir)
+void set_tile(World *w, int x, int y, int tile)
 {
-    Robot r = {0};
-    r.x = x;
-    r.y = y;
-    r.fuel = MAX_FUEL;
-    r.dir = dir;
-    r.is_player = is_player;
-    return r;
+	if (w->paths)
+		paths_tile_changed(w->paths, x, y, w->tiles[y * w->width + x], tile);
+	if (bitset_get(&w->walls, x, y) != (tile == TILE_WALL))
+		w->wall_edits++;
+	if (w->ndirty < WORLD_DIRTY_TILES)
+		w->dirty[w->ndirty++] = y * w->width + x;
+	else
+		w->ndirty = WORLD_DIRTY_ALL;
+	write_tile(w, x, y, tile);
 }
 
-/* Make the Robot go forward
- * Input/Pre-Condition: Needs the Robot that's moving
- * Output/Post-Condition: The Robot's x & y position will get updated based on the Direction its facing
-*/
-bool robot_forward(State *state, Robot *r)
+bool is_tile_free(World *w, int x, int y)
 {
-    // get the Robot's current facing direction
-    Direction current_dir = (*r).dir;
+	return !bitset_get(&w->walls, x, y) && !bitset_get(&w->energy, x, y);
+}
 
-    int x = r->x;
-    int y = r->y;
+/* Grow the robot arrays so that they can hold at least `cap` robots
+ * Input/Pre-Condition: Takes the robot storage and the required capacity
+ * Output/Post-Condition: Every per-robot array has room for `cap` entries
+*/
+static void robots_reserve(Robots *rs, int cap)
+{
+	if (cap <= rs->cap)
+		return;
+
+	int newcap = rs->cap > 0 ? rs->cap : ROBOTS_INITIAL_CAP;
+	while (newcap < cap)
+		newcap *= 2;
+
+	rs->x = mem_realloc(MEM_WORLD, rs->x, newcap * sizeof(*rs->x));
+	rs->y = mem_realloc(MEM_WORLD, rs->y, newcap * sizeof(*rs->y));
+	rs->fuel = mem_realloc(MEM_WORLD, rs->fuel, newcap * sizeof(*rs->fuel));
+	rs->dir = mem_realloc(MEM_WORLD, rs->dir, newcap * sizeof(*rs->dir));
+	rs->flags = mem_realloc(MEM_WORLD, rs->flags, newcap * sizeof(*rs->flags));
+	rs->live = mem_realloc(MEM_WORLD, rs->live, newcap * sizeof(*rs->live));
+	rs->slot = mem_realloc(MEM_WORLD, rs->slot, newcap * sizeof(*rs->slot));
+	rs->cap = newcap;
+}
 
-    // move based on the robot's current facing direction
-    switch(current_dir)
-    {
-        case North:
-            // move up 1
-            y--;
-            break;
-        case East:
-            // move right 1
-            x++;
-            break;
-        case South:
-            // move down 1
-            y++;
-            break;
-        case West:
-            // move left 1
-            x--;
-            break;
-        default:
-            // do nothing
-    }
+void robots_init(Robots *rs, int cap)
+{
+	*rs = (Robots){0};
+	rs->max_fuel = MAX_FUEL;
+	robots_reserve(rs, cap);
+}
 
-    if (find_robot_pos(state, x, y) != -1)
-        return false;
+void robots_free(Robots *rs)
+{
+	mem_free(rs->x);
+	mem_free(rs->y);
+	mem_free(rs->fuel);
+	mem_free(rs->dir);
+	mem_free(rs->flags);
+	mem_free(rs->live);
+	mem_free(rs->slot);
+	*rs = (Robots){0};
+}
 
-    if (*get_tile(state->world, x, y) != TILE_WALL)
-    {
-        r->x = x;
-        r->y = y;
-        return true;
-    }
+/* Add a new robot
+ * Input/Pre-Condition: Need to know if the robot is a player or not
+ * Output/Post-Condition: Appends a robot with the default values and returns its index
+*/
+int robots_add(Robots *rs, bool is_player, int x, int y, Direction dir)
+{
+	robots_reserve(rs, rs->count + 1);
+
+	int id = rs->count++;
+	rs->x[id] = x;
+	rs->y[id] = y;
+	rs->fuel[id] = rs->max_fuel;
+	rs->dir[id] = dir;
+	rs->flags[id] = is_player ? ROBOT_PLAYER : 0;
+
+	rs->slot[id] = rs->nlive;
+	rs->live[rs->nlive++] = id;
+	return id;
+}
 
-    return false;
+/* Rebuild the live list from the robot flags
+ * Input/Pre-Condition: Takes robot storage whose flags were overwritten wholesale
+ * Output/Post-Condition: `live` and `slot` match the ROBOT_DISASSEMBLED flags again
+*/
+void robots_relink(Robots *rs)
+{
+	rs->nlive = 0;
+	for (int i = 0; i < rs->count; i++)
+	{
+		if (rs->flags[i] & ROBOT_DISASSEMBLED)
+		{
+			rs->slot[i] = -1;
+			continue;
+		}
+		rs->slot[i] = rs->nlive;
+		rs->live[rs->nlive++] = i;
+	}
 }
 
-/* Make the Robot go backwards
- * Input/Pre-Condition: Needs the Robot that's moving
- * Output/Post-Condition: The Robot's x & y position will get updated based on the Direction its facing
+/* Count the enemy robots that are still in play
+ * Input/Pre-Condition: Takes the robot storage
+ * Output/Post-Condition: Returns the number of live enemies that still have fuel
 */
-bool robot_backward(State *state, Robot *r)
+int robots_alive_enemies(Robots *rs)
 {
-    // get the Robot's current facing direction
-    Direction current_dir = (*r).dir;
+	int n = 0;
+	for (int k = 0; k < rs->nlive; k++)
+	{
+		int i = rs->live[k];
+		n += !(rs->flags[i] & ROBOT_PLAYER) && rs->fuel[i] > 0;
+	}
+	return n;
+}
 
-    int x = r->x;
-    int y = r->y;
+bool robot_is_player(Robots *rs, int id) { return rs->flags[id] & ROBOT_PLAYER; }
 
-    // move based on the robot's current facing direction
-    switch(current_dir)
-    {
-        case North:
-            // move down 1
-            y++;
-            break;
-        case East:
-            // move left 1
-            x--;
-            break;
-        case South:
-            // move up 1
-            y--;
-            break;
-        case West:
-            // move right 1
-            x++;
-            break;
-        default:
-            // do nothing
-    }
+bool robot_is_disassembled(Robots *rs, int id) { return rs->flags[id] & ROBOT_DISASSEMBLED; }
 
-    if (find_robot_pos(state, x, y) != -1)
+/* Move a robot one tile in the given direction, if nothing is in the way
+ * Input/Pre-Condition: Needs the State, the robot index, and the direction to move in
+ * Output/Post-Condition: The Robot's x & y position will get updated if the tile is free
+*/
+static bool robot_step(State *state, int id, Direction d)
+{
+    Robots *rs = &state->robots;
+    World *w = state->world;
+    int x = rs->x[id] + direction_dx[d];
+    int y = rs->y[id] + direction_dy[d];
+
+    // walls and other robots are in the way
+    if (!in_bounds(w, x, y) || bitset_get(&w->walls, x, y) || bitset_get(&w->robots, x, y))
         return false;
 
-    if (*get_tile(state->world, x, y) != TILE_WALL)
-    {
-        r->x = x;
-        r->y = y;
-        return true;
-    }
+    bitset_set(&w->robots, rs->x[id], rs->y[id], false);
+    bitset_set(&w->robots, x, y, true);
+    rs->x[id] = x;
+    rs->y[id] = y;
 
-    return false;
+    // the player is never something to path to, everyone else is
+    if (w->paths && !(rs->flags[id] & ROBOT_PLAYER))
+        paths_robots_moved(w->paths);
+    return true;
+}
+
+/* Make the Robot go forward
+ * Input/Pre-Condition: Needs the index of the Robot that's moving
+ * Output/Post-Condition: The Robot's x & y position will get updated based on the Direction its facing
+*/
+bool robot_forward(State *state, int id)
+{
+    return robot_step(state, id, state->robots.dir[id]);
+}
+
+/* Make the Robot go backwards
+ * Input/Pre-Condition: Needs the index of the Robot that's moving
+ * Output/Post-Condition: The Robot's x & y position will get updated based on the Direction its facing
+*/
+bool robot_backward(State *state, int id)
+{
+    static const Direction opposite[] = { [North]=South, [South]=North, [East]=West, [West]=East };
+    return robot_step(state, id, opposite[state->robots.dir[id]]);
 }
 
 /* Make the Robot pivot left
  * Input/Pre-Condition: Takes the given robot
  * Output/Post-Condition: Changes the direction based on it's current direction
 */
-void robot_turn_left(Robot *r)
+void robot_turn_left(Robots *rs, int id)
 {
-    // get the Robot's current facing direction
-    Direction current_dir = (*r).dir;
-
     // move based on the robot's current facing direction
-    switch(current_dir)
+    switch(rs->dir[id])
     {
         case North:
-            (*r).dir = West;
+            rs->dir[id] = West;
             break;
         case East:
-            (*r).dir = North;
+            rs->dir[id] = North;
             break;
         case South:
-            (*r).dir = East;
+            rs->dir[id] = East;
             break;
         case West:
-            (*r).dir = South;
+            rs->dir[id] = South;
             break;
         default:
             // do nothing
@@ -319,25 +551,22 @@ void robot_turn_left(Robot *r)
  * Input/Pre-Condition: Takes the given Robot
  * Output/Post-Condition: Changes the position based on the current position
 */
-void robot_turn_right(Robot *r)
+void robot_turn_right(Robots *rs, int id)
 {
-    // get the Robot's current facing direction
-    Direction current_dir = (*r).dir;
-
     // move based on the robot's current facing direction
-    switch(current_dir)
+    switch(rs->dir[id])
     {
         case North:
-            (*r).dir = East;
+            rs->dir[id] = East;
             break;
         case East:
-            (*r).dir = South;
+            rs->dir[id] = South;
             break;
         case South:
-            (*r).dir = West;
+            rs->dir[id] = West;
             break;
         case West:
-            (*r).dir = North;
+            rs->dir[id] = North;
             break;
         default:
             // do nothing
@@ -346,17 +575,17 @@ void robot_turn_right(Robot *r)
 
 
 /* Refuel the robot the specified amount
- * Input/Pre-Condition: Takes a pointer to a Robot and the amount to refuel
+ * Input/Pre-Condition: Takes the robot storage, the robot index and the amount to refuel
  * Output/Post-Condition: Fill the robot to the given fuel_amount
 */
-void robot_refuel(Robot *r, int fuel_amount)
+void robot_refuel(Robots *rs, int id, int fuel_amount)
 {
-    (*r).fuel += fuel_amount;
+    rs->fuel[id] += fuel_amount;
 
-    // can't go over the MAX_FUEL amount
-    if ((*r).fuel > MAX_FUEL)
+    // can't go over the level's maximum
+    if (rs->fuel[id] > rs->max_fuel)
     {
-        (*r).fuel = MAX_FUEL;
+        rs->fuel[id] = rs->max_fuel;
     }
 }
 
@@ -365,11 +594,11 @@ void robot_refuel(Robot *r, int fuel_amount)
  * Input/Pre-Condition: Need the Robot that's being attacked
  * Output/Post-Condition: The Robot's fuel will be set to 0, subtract from the total robots
 */
-void robot_ram(Robot *r)
+void robot_ram(Robots *rs, int id)
 {
-    if (!(*r).is_player)
+    if (!robot_is_player(rs, id))
     {
-        (*r).fuel = 0;
+        rs->fuel[id] = 0;
     }
 }
 
@@ -378,19 +607,33 @@ void robot_ram(Robot *r)
  * Input/Pre-Condition: Get the Robot's current position
  * Output/Post-Condition: Returns the tile in front of the Robot
 */
-int robot_scan(Robot *r, World *w)
+int robot_scan(State *state, int id)
 {
-    return *get_tile_with_offset(w, r->x, r->y, r->dir);
+    Robots *rs = &state->robots;
+    return *get_tile_with_offset(state->world, rs->x[id], rs->y[id], rs->dir[id]);
 }
 
 
-/* Get the Robot's position and scan the tile in front of it and get that tile ID
- * Input/Pre-Condition: Get the Robot's current position
- * Output/Post-Condition: Returns the tile in front of the Robot
+/* Mark the Robot as disassembled and drop it from the live list
+ * Input/Pre-Condition: Needs the index of the Robot being disassembled
+ * Output/Post-Condition: The Robot is flagged and no longer takes part in queries
 */
-void robot_disassemble(Robot *r)
+void robot_disassemble(State *state, int id)
 {
-    (*r).is_disassembled = true;
+    Robots *rs = &state->robots;
+    if (rs->flags[id] & ROBOT_DISASSEMBLED)
+        return;
+    rs->flags[id] |= ROBOT_DISASSEMBLED;
+    bitset_set(&state->world->robots, rs->x[id], rs->y[id], false);
+    if (state->world->paths && !(rs->flags[id] & ROBOT_PLAYER))
+        paths_robot_removed(state->world->paths, rs->x[id], rs->y[id]);
+
+    // swap the last live robot into this robot's slot
+    int k = rs->slot[id];
+    int last = rs->live[--rs->nlive];
+    rs->live[k] = last;
+    rs->slot[last] = k;
+    rs->slot[id] = -1;
 }
 
 
@@ -398,7 +641,7 @@ void robot_disassemble(Robot *r)
  * Input/Pre-Condition: Needs the Robut and how much fuel to take
  * Output/Post-Condition: Returns true if the fuel is above 0 and false if not
 */
-bool robot_use_fuel(Robot *r, int amount)
+bool robot_use_fuel(Robots *rs, int id, int amount)
 {
     // handle invalid amounts
     if (amount <= 0)
@@ -407,34 +650,37 @@ bool robot_use_fuel(Robot *r, int amount)
     }
 
     // bot is out of fuel
-    if ((*r).fuel <= 0)
+    if (rs->fuel[id] <= 0)
     {
         return false;
     }
 
     // use amount
-    (*r).fuel -= amount;
-    if ((*r).fuel < 0)
+    rs->fuel[id] -= amount;
+    if (rs->fuel[id] < 0)
     {
         // can't have negative fuel
-        (*r).fuel = 0;
+        rs->fuel[id] = 0;
     }
 
     // return whether it's out or not
-    return ((*r).fuel > 0);
+    return (rs->fuel[id] > 0);
 }
 
 
 int find_robot_pos(State *state, int x, int y)
 {
-	for (int i = 0; i < (*state).robot_count; i++)
-	{
-		Robot *rr = &state->robots[i];
+	// most tiles have no robot, which the occupancy bits answer at once
+	if (!in_bounds(state->world, x, y) || !bitset_get(&state->world->robots, x, y))
+		return -1;
 
-		if ((*rr).fuel > 0 &&
-			!(*rr).is_disassembled &&
-			(*rr).x == x &&
-			(*rr).y == y)
+	const Robots *rs = &state->robots;
+	const int *live = rs->live, *xs = rs->x, *ys = rs->y, *fuel = rs->fuel;
+
+	for (int k = 0; k < rs->nlive; k++)
+	{
+		int i = live[k];
+		if (xs[i] == x && ys[i] == y && fuel[i] > 0)
 		{
 			// return index of the alive robot
 			return i;
@@ -3,6 +3,7 @@
 
 
 #include <stdbool.h>
+#include <bitset.h>
 
 
 #define TILE_EMPTY 0
@@ -11,7 +12,7 @@
 
 #define MAX_FUEL 50
 #define FUEL_CANISTER_AMOUNT 25
-#define MAX_ROBOTS 16
+#define ROBOTS_INITIAL_CAP 16
 #define EXEC_SPEED_SECONDS (0.50f)
 #define EXEC_SPEED ((int)(EXEC_SPEED_SECONDS*60)) /* frames per statement executed */
 
@@ -21,7 +22,6 @@
 #define DEFAULT_ROBOT_COUNT 4
 #define WALL_DIVISOR 10      // Interior tiles / this = wall count
 #define ENERGY_DIVISOR 20    // Interior tiles / this = energy count
-#define MAX_PLACEMENT_ATTEMPTS 100
 
 // Window constants
 #define VIRTUAL_WIDTH 200
@@ -39,52 +39,139 @@ typedef enum
 } Direction;
 
 
+/* Tile offsets of a step in each direction */
+extern const int direction_dx[4], direction_dy[4];
+
+
+typedef struct rbt_paths Paths;
+
+/* Tile changes a world remembers between journal steps, see `dirty`. */
+#ifndef WORLD_DIRTY_TILES
+# define WORLD_DIRTY_TILES 32
+#endif
+#define WORLD_DIRTY_ALL (WORLD_DIRTY_TILES + 1)
+
+/* `tiles` holds one tile per position. Walls, energy and the tiles that have
+ * a live robot on them are mirrored one bit per tile, so that collision and
+ * area queries can look at 64 tiles at once. Tiles are changed through
+ * set_tile and robots through the robot functions, which keep the bits in
+ * step; anything that writes `tiles` or the robot arrays directly has to call
+ * world_sync afterwards. The distance fields in `paths` (see paths.h) are
+ * built on first use and kept in step the same way. */
 typedef struct
 {
 	int width, height;
+	Bitset walls, energy, robots;
+	Paths *paths; /* NULL until a robot first asks for a path */
+	unsigned wall_edits; /* bumped whenever walls may have changed, for caches of them */
+	/* The tiles set_tile changed since the journal last caught up, so that it
+	 * only compares those. WORLD_DIRTY_ALL when there were more than fit or the
+	 * tiles were written some other way, and every tile has to be compared. */
+	int ndirty;
+	int dirty[WORLD_DIRTY_TILES];
 	int tiles[];
 } World;
 
 World *new_world(int width, int height);
+void free_world(World *w);
 bool in_bounds(World *w, int x, int y);
+/* The tile at a position, NULL out of bounds. Only for reading. */
 int *get_tile(World *w, int x, int y);
 int *get_tile_with_offset(World *w, int x, int y, Direction d);
+void set_tile(World *w, int x, int y, int tile);
+/* set_tile without bumping `wall_edits` or updating `paths` and `dirty`, for
+ * writers that run in parallel and account for their changes once they are
+ * done. */
+void write_tile(World *w, int x, int y, int tile);
 bool is_tile_free(World *w, int x, int y);
 
 
+/* Robot flags */
+#define ROBOT_PLAYER       (1 << 0)
+#define ROBOT_DISASSEMBLED (1 << 1)
+
+/* Robots are stored as a structure of arrays so that per-tick queries only
+ * touch the fields they need. `live` is a dense list of the indices of every
+ * robot that has not been disassembled, and `slot[i]` is the position of robot
+ * `i` within `live` (or -1 once it has been removed). */
 typedef struct
 {
-	int x, y;
-	int fuel;
-	Direction dir;
-	bool is_player;
-	bool is_disassembled;
-} Robot;
+	int count, cap;
+	int max_fuel; /* starting and maximum fuel for every robot */
+	int *x, *y;
+	int *fuel;
+	Direction *dir;
+	unsigned char *flags;
+	int nlive;
+	int *live;
+	int *slot;
+} Robots;
+
+void robots_init(Robots *rs, int cap);
+void robots_free(Robots *rs);
+int robots_add(Robots *rs, bool is_player, int x, int y, Direction dir);
+void robots_relink(Robots *rs);
+int robots_alive_enemies(Robots *rs);
+bool robot_is_player(Robots *rs, int id);
+bool robot_is_disassembled(Robots *rs, int id);
 
 typedef struct rbt_state State;
-Robot new_robot(bool is_player, int x, int y, Direction dir);
-bool robot_forward(State *w, Robot *r);
-bool robot_backward(State *w, Robot *r);
-void robot_turn_left(Robot *r);
-void robot_turn_right(Robot *r);
-void robot_refuel(Robot *r, int fuel_amount);
-void robot_ram(Robot *r);
-int robot_scan(Robot *r, World *w);
-void robot_disassemble(Robot *r);
-bool robot_use_fuel(Robot *r, int amount);
+bool robot_forward(State *state, int id);
+bool robot_backward(State *state, int id);
+void robot_turn_left(Robots *rs, int id);
+void robot_turn_right(Robots *rs, int id);
+void robot_refuel(Robots *rs, int id, int fuel_amount);
+void robot_ram(Robots *rs, int id);
+int robot_scan(State *state, int id);
+void robot_disassemble(State *state, int id);
+bool robot_use_fuel(Robots *rs, int id, int amount);
+
+
+/* Random numbers owned by the caller rather than the C library, so that worlds
+ * can be generated on any thread without disturbing each other. */
+typedef struct
+{
+	unsigned long long s;
+} Rng;
+
+/* A seed of -1 picks one from the clock that differs on every call. */
+void rng_seed(Rng *r, long seed);
+unsigned rng_next(Rng *r);
+/* Uniform in [0, n) for small n. */
+int rng_range(Rng *r, int n);
+/* The `n`th number a generator seeded with `key` would give, without drawing
+ * the ones before it, so that threads can share a stream in any order. */
+unsigned rng_at(unsigned long long key, unsigned long long n);
 
 
 typedef struct rbt_stepper LangStepper;
+typedef struct rbt_journal Journal;
 typedef struct rbt_state
 {
 	World *world;
-	Robot robots[MAX_ROBOTS];
-	int robot_count;
+	Robots robots;
 	LangStepper *stepper;
+	Journal *journal; /* optional, not owned by the state */
+	int canister_fuel; /* fuel restored by one canister */
 	bool program_running;
 } State;
 
-State *generate_world(long seed, int width, int height, int robot_count);
+/* How the walls of a generated world are laid out, see worldgen.h */
+typedef enum
+{
+	LAYOUT_SCATTER, /* walls dropped on random tiles */
+	LAYOUT_MAZE,
+	LAYOUT_CAVE,
+	LAYOUT_ROOMS,
+	LAYOUT_COUNT,
+} WorldLayout;
+
+State *new_state(int width, int height, int max_fuel, int canister_fuel);
+State *generate_world(long seed, int width, int height, int robot_count, WorldLayout layout);
+/* Rebuild the bits of the world from its tiles and robots. */
+void world_sync(State *state);
+/* True if the player can reach every enemy and, when there is any, some fuel. */
+bool world_solvable(State *state);
 void free_state(State *state);
 
 int find_robot_pos(State *state, int x, int y);
@@ -3,16 +3,47 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <mem.h>
 
 // Colors matching ui.c palette
 static const Color EDITOR_BG = { 20, 35, 60, 255 };
 static const Color EDITOR_BORDER = { 140, 190, 215, 255 };
 static const Color EDITOR_TEXT = { 200, 220, 240, 255 };
+static const Color EDITOR_DIM = { 90, 115, 150, 255 };
+static const Color EDITOR_ERROR = { 235, 90, 90, 255 };
+static const Color EDITOR_HEAT = { 235, 150, 60, 140 };
+
+// Syntax highlighting, indexed by LangTokKind
+static const Color EDITOR_TOKEN_COLORS[] =
+{
+	[rbt_tok_op]       = { 140, 190, 215, 255 },
+	[rbt_tok_register] = { 235, 200, 120, 255 },
+	[rbt_tok_number]   = { 170, 225, 150, 255 },
+	[rbt_tok_const]    = { 210, 160, 230, 255 },
+	[rbt_tok_name]     = { 200, 220, 240, 255 },
+	[rbt_tok_keyword]  = { 120, 160, 200, 255 },
+	[rbt_tok_comment]  = { 90, 115, 150, 255 },
+	[rbt_tok_error]    = { 235, 90, 90, 255 },
+};
+
+// Cached analysis of one line. `info` only depends on the line's own text and
+// is redone when the line changes; `block_err` depends on the lines around it.
+struct editor_line
+{
+	LangLine info;
+	bool block_errored;
+	LangErr block_err;
+	unsigned long fuel; // spent on this line in the last run, cleared when it is edited
+};
+
+// Text area between the title and the input field
+#define EDITOR_TEXT_TOP 14
+#define EDITOR_TEXT_BOTTOM 30
 
 void editor_init(Editor *e, int x, int y, int width, int height)
 {
 	e->active = false;
-	e->program[0] = '\0';
+	textbuf_init(&e->text);
 	e->input[0] = '\0';
 	e->input_len = 0;
 	e->x = x;
@@ -20,6 +51,21 @@ void editor_init(Editor *e, int x, int y, int width, int height)
 	e->width = width;
 	e->height = height;
 
+	// Laid out lines are cached so only edited or newly scrolled in lines are drawn
+	e->scroll = 0;
+	int text_h = height - EDITOR_TEXT_TOP - EDITOR_TEXT_BOTTOM;
+	e->visible_lines = (text_h + EDITOR_LINE_HEIGHT - 1) / EDITOR_LINE_HEIGHT;
+	e->cache = LoadRenderTexture(width - 8, e->visible_lines * EDITOR_LINE_HEIGHT);
+	e->cache_lines = mem_alloc(MEM_EDITOR, e->visible_lines * sizeof(*e->cache_lines));
+	for (int i = 0; i < e->visible_lines; i++)
+		e->cache_lines[i] = -1;
+
+	e->line_info = NULL;
+	e->line_info_cap = 0;
+	e->error_line = -1;
+	e->error_count = 0;
+	e->heat_max = 0;
+
 	// Buttons at bottom
 	int btn_width = 40;
 	int btn_height = 12;
@@ -31,131 +77,253 @@ void editor_init(Editor *e, int x, int y, int width, int height)
 	button_init(&e->buttons[EDITOR_BTN_CANCEL], btn_start_x + btn_width + btn_gap, btn_y, btn_width, btn_height, "Cancel");
 }
 
-void editor_open(Editor *e)
+void editor_free(Editor *e)
 {
-	char *program = read_program(DEFAULT_PROGRAM_PATH);
-	if (program)
-	{
-		strncpy(e->program, program, EDITOR_MAX_TEXT - 1);
-		e->program[EDITOR_MAX_TEXT - 1] = '\0';
-		free(program);
-	}
-	else
+	textbuf_free(&e->text);
+	UnloadRenderTexture(e->cache);
+	mem_free(e->cache_lines);
+	mem_free(e->line_info);
+}
+
+// Mark cached rows for `first` and every line after it as stale
+static void invalidate_from(Editor *e, int first)
+{
+	for (int i = 0; i < e->visible_lines; i++)
 	{
-		e->program[0] = '\0';
+		if (e->cache_lines[i] >= first)
+			e->cache_lines[i] = -1;
 	}
-	e->input[0] = '\0';
-	e->input_len = 0;
-	e->active = true;
 }
 
-void editor_close(Editor *e)
+static void invalidate_line(Editor *e, int line)
 {
-	e->active = false;
+	int row = line % e->visible_lines;
+	if (e->cache_lines[row] == line)
+		e->cache_lines[row] = -1;
 }
 
-// Count lines in program
-static int count_lines(const char *program)
+static void check_line(Editor *e, int line)
 {
-	int count = 0;
-	if (*program) count = 1;
-	while (*program)
-	{
-		if (*program == '\n') count++;
-		program++;
-	}
-	return count;
+	char line_buf[256];
+	int len = textbuf_copy_line(&e->text, line, line_buf, sizeof(line_buf));
+	lang_check_line(line_buf, len, &e->line_info[line].info);
 }
 
-// Replace or add a line in the program text
-static void replace_line(char *program, int line_num, const char *new_text)
+// Function nesting only needs the cached ops, so this pass never re-lexes
+static void check_blocks(Editor *e)
 {
-	int total_lines = count_lines(program);
+	int nlines = textbuf_line_count(&e->text);
+	bool in_fn = false;
+	e->error_line = -1;
+	e->error_count = 0;
 
-	// If line doesn't exist, append new lines until we reach it
-	if (line_num > total_lines)
+	for (int line = 0; line < nlines; line++)
 	{
-		int len = strlen(program);
-		while (total_lines < line_num)
+		struct editor_line *l = &e->line_info[line];
+		bool was_errored = l->block_errored;
+		LangErr was_err = l->block_err;
+
+		l->block_errored = false;
+		if (l->info.op == rbt_op_fn)
 		{
-			if (len > 0 && program[len - 1] != '\n')
-			{
-				if (len < EDITOR_MAX_TEXT - 1)
-					program[len++] = '\n';
-			}
-			else if (len < EDITOR_MAX_TEXT - 1)
-			{
-				program[len++] = '\n';
-			}
-			total_lines++;
+			l->block_errored = in_fn;
+			l->block_err = rbt_errcode_syn_fn_in_fn;
+			in_fn = true;
 		}
-		// Add the new text
-		int new_len = strlen(new_text);
-		if (len + new_len < EDITOR_MAX_TEXT)
+		else if (l->info.op == rbt_op_end)
 		{
-			memcpy(program + len, new_text, new_len + 1);
+			l->block_errored = !in_fn;
+			l->block_err = rbt_errcode_syn_end_outside_fn;
+			in_fn = false;
+		}
+
+		if (l->block_errored != was_errored || (l->block_errored && l->block_err != was_err))
+			invalidate_line(e, line);
+		if (l->info.errored || l->block_errored)
+		{
+			if (e->error_line == -1)
+				e->error_line = line;
+			e->error_count++;
 		}
-		return;
 	}
+}
 
-	// Find the start of the target line
-	int current_line = 1;
-	char *line_start = program;
+// Bring the per-line cache in step with the text after `line` was replaced
+// or deleted, re-lexing only the lines whose text changed
+static void lines_changed(Editor *e, int line, int old_lines)
+{
+	int nlines = textbuf_line_count(&e->text);
+	if (nlines > e->line_info_cap)
+	{
+		while (e->line_info_cap < nlines)
+			e->line_info_cap = e->line_info_cap ? e->line_info_cap * 2 : 256;
+		e->line_info = mem_realloc(MEM_EDITOR, e->line_info, e->line_info_cap * sizeof(*e->line_info));
+	}
 
-	while (current_line < line_num && *line_start)
+	if (nlines > old_lines)
+	{
+		// Lines are only ever added at the end
+		for (int i = old_lines; i < nlines; i++)
+		{
+			e->line_info[i] = (struct editor_line){0};
+			check_line(e, i);
+		}
+	}
+	else if (nlines < old_lines)
+	{
+		memmove(&e->line_info[line], &e->line_info[line + 1], (old_lines - line - 1) * sizeof(*e->line_info));
+	}
+	else if (line < nlines)
 	{
-		if (*line_start == '\n')
-			current_line++;
-		line_start++;
+		check_line(e, line);
+		e->line_info[line].fuel = 0;
 	}
 
-	// Find end of this line
-	char *line_end = line_start;
-	while (*line_end && *line_end != '\n')
-		line_end++;
+	check_blocks(e);
+}
+
+static void check_all_lines(Editor *e)
+{
+	lines_changed(e, 0, 0);
+}
 
-	// Build new program: before + new_text + after
-	int before_len = line_start - program;
-	int after_len = strlen(line_end);
-	int new_len = strlen(new_text);
+static void scroll_to(Editor *e, int scroll)
+{
+	int max_scroll = textbuf_line_count(&e->text) - e->visible_lines;
+	if (scroll > max_scroll)
+		scroll = max_scroll;
+	if (scroll < 0)
+		scroll = 0;
+	e->scroll = scroll;
+}
 
-	if (before_len + new_len + after_len >= EDITOR_MAX_TEXT)
-		return; // Too long
+// Width of the first `cols` characters of `s` as DrawText lays them out
+static int text_width(const char *s, int cols)
+{
+	char buf[256];
+	if (cols <= 0)
+		return 0;
+	if (cols > (int)sizeof(buf) - 1)
+		cols = sizeof(buf) - 1;
+	memcpy(buf, s, cols);
+	buf[cols] = '\0';
+	return MeasureText(buf, EDITOR_FONT_SIZE) + 1; // spacing before the next glyph
+}
 
-	char temp[EDITOR_MAX_TEXT];
-	memcpy(temp, program, before_len);
-	memcpy(temp + before_len, new_text, new_len);
-	memcpy(temp + before_len + new_len, line_end, after_len + 1);
-	strcpy(program, temp);
+static void draw_span(const char *s, int start, int len, int x, int y, Color color)
+{
+	char buf[256];
+	if (len > (int)sizeof(buf) - 1)
+		len = sizeof(buf) - 1;
+	memcpy(buf, s + start, len);
+	buf[len] = '\0';
+	DrawText(buf, x + text_width(s, start), y, EDITOR_FONT_SIZE, color);
 }
 
-// Delete a line from the program
-static void delete_line(char *program, int line_num)
+// Draw "N: text" with highlighting and error markers into a cache row
+static void draw_line(Editor *e, int line, int y, char *line_buf, int size)
 {
-	int total_lines = count_lines(program);
-	if (line_num > total_lines || line_num < 1)
-		return;
+	struct editor_line *l = &e->line_info[line];
+	int len = textbuf_copy_line(&e->text, line, line_buf, size);
+
+	char number[16];
+	snprintf(number, sizeof(number), "%d: ", line + 1);
+	bool errored = l->info.errored || l->block_errored;
+	if (errored)
+		DrawRectangle(0, y, 2, EDITOR_LINE_HEIGHT - 1, EDITOR_ERROR);
+	int number_w = MeasureText(number, EDITOR_FONT_SIZE);
+
+	// Heat gutter, the line that spent the most fuel fills its whole number
+	if (l->fuel > 0 && e->heat_max > 0)
+	{
+		int w = (int)((unsigned long long)number_w * l->fuel / e->heat_max);
+		DrawRectangle(3, y, w > 0 ? w : 1, EDITOR_LINE_HEIGHT - 1, EDITOR_HEAT);
+	}
+	DrawText(number, 3, y, EDITOR_FONT_SIZE, errored ? EDITOR_ERROR : EDITOR_DIM);
+	int x = 3 + number_w + 1;
 
-	// Find the start of the target line
-	int current_line = 1;
-	char *line_start = program;
+	int end = 0;
+	for (int i = 0; i < l->info.ntokens; i++)
+	{
+		LangToken *t = &l->info.tokens[i];
+		if (t->start >= len)
+			break;
+		int tlen = t->start + t->len > len ? len - t->start : t->len;
+		draw_span(line_buf, t->start, tlen, x, y, EDITOR_TOKEN_COLORS[t->kind]);
+		end = t->start + tlen;
+	}
+	if (end < len) // past the last token the cache has room for
+		draw_span(line_buf, end, len - end, x, y, EDITOR_TEXT);
 
-	while (current_line < line_num && *line_start)
+	// Underline the error, or the whole line for errors that span lines
+	int err_start = l->info.errored ? l->info.err_start : 0;
+	int err_len = l->info.errored ? l->info.err_len : len;
+	if (errored && err_start < len)
 	{
-		if (*line_start == '\n')
-			current_line++;
-		line_start++;
+		if (err_len <= 0 || err_start + err_len > len)
+			err_len = len - err_start;
+		int ux = x + text_width(line_buf, err_start);
+		int uw = text_width(line_buf + err_start, err_len);
+		DrawRectangle(ux, y + EDITOR_LINE_HEIGHT - 1, uw, 1, EDITOR_ERROR);
 	}
+}
 
-	// Find end of this line (including newline)
-	char *line_end = line_start;
-	while (*line_end && *line_end != '\n')
-		line_end++;
-	if (*line_end == '\n')
-		line_end++;
+// Redraw stale rows of the cache. This runs from editor_update since texture
+// modes can't be nested and editor_draw is called while rendering the frame.
+static void refresh_cache(Editor *e)
+{
+	int nlines = textbuf_line_count(&e->text);
+	char line_buf[256];
+	bool drawing = false;
 
-	// Shift everything after the line back
-	memmove(line_start, line_end, strlen(line_end) + 1);
+	for (int line = e->scroll; line < e->scroll + e->visible_lines; line++)
+	{
+		int row = line % e->visible_lines;
+		if (e->cache_lines[row] == line)
+			continue;
+
+		if (!drawing)
+		{
+			BeginTextureMode(e->cache);
+			drawing = true;
+		}
+		int y = row * EDITOR_LINE_HEIGHT;
+		DrawRectangle(0, y, e->cache.texture.width, EDITOR_LINE_HEIGHT, EDITOR_BG);
+		if (line < nlines)
+			draw_line(e, line, y, line_buf, sizeof(line_buf));
+		e->cache_lines[row] = line;
+	}
+
+	if (drawing)
+		EndTextureMode();
+}
+
+void editor_open(Editor *e, const struct rbt_profile *profile)
+{
+	char *program = read_program(DEFAULT_PROGRAM_PATH);
+	textbuf_set(&e->text, program ? program : "");
+	mem_free(program);
+	e->input[0] = '\0';
+	e->input_len = 0;
+	e->scroll = 0;
+	invalidate_from(e, 0);
+	check_all_lines(e);
+
+	e->heat_max = 0;
+	int nlines = textbuf_line_count(&e->text);
+	for (int i = 0; profile && i < profile->nlines && i < nlines; i++)
+	{
+		e->line_info[i].fuel = profile->lines[i].fuel;
+		if (profile->lines[i].fuel > e->heat_max)
+			e->heat_max = profile->lines[i].fuel;
+	}
+	refresh_cache(e);
+	e->active = true;
+}
+
+void editor_close(Editor *e)
+{
+	e->active = false;
 }
 
 int editor_update(Editor *e, float scale)
@@ -174,10 +342,25 @@ int editor_update(Editor *e, float scale)
 		char *space = strchr(e->input, ' ');
 		if (line_num > 0)
 		{
+			int old_lines = textbuf_line_count(&e->text);
 			if (space)
-				replace_line(e->program, line_num, space + 1);
+				textbuf_replace_line(&e->text, line_num - 1, space + 1);
+			else
+				textbuf_delete_line(&e->text, line_num - 1);
+
+			// Lines below an insertion or deletion move, so their rows are stale too
+			if (textbuf_line_count(&e->text) != old_lines)
+				invalidate_from(e, line_num - 1 < old_lines ? line_num - 1 : old_lines - 1);
+			else
+				invalidate_line(e, line_num - 1);
+			if (line_num - 1 < old_lines || space)
+				lines_changed(e, line_num - 1, old_lines);
+
+			// Keep the edited line in view
+			if (line_num - 1 < e->scroll || line_num - 1 >= e->scroll + e->visible_lines)
+				scroll_to(e, line_num - 1 - e->visible_lines / 2);
 			else
-				delete_line(e->program, line_num);
+				scroll_to(e, e->scroll);
 		}
 		// Clear input for next edit
 		e->input[0] = '\0';
@@ -187,11 +370,18 @@ int editor_update(Editor *e, float scale)
 	// Check Save - write to file and close
 	if (button_clicked(&e->buttons[EDITOR_BTN_SAVE]))
 	{
-		FILE *fp = fopen(DEFAULT_PROGRAM_PATH, "w");
+		// Write a new file and rename it over the old one, a running
+		// program may have the old one mapped
+		char tmp_path[1024];
+		snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", DEFAULT_PROGRAM_PATH);
+		FILE *fp = fopen(tmp_path, "w");
 		if (fp)
 		{
-			fprintf(fp, "%s", e->program);
-			fclose(fp);
+			bool ok = textbuf_write(&e->text, fp);
+			if (fclose(fp) == 0 && ok)
+				rename(tmp_path, DEFAULT_PROGRAM_PATH);
+			else
+				remove(tmp_path);
 		}
 		editor_close(e);
 		return 1;
@@ -221,6 +411,24 @@ int editor_update(Editor *e, float scale)
 			e->input[--e->input_len] = '\0';
 	}
 
+	// Scrolling
+	int scroll = e->scroll - (int)GetMouseWheelMove() * 3;
+	if (IsKeyPressed(KEY_UP) || IsKeyPressedRepeat(KEY_UP))
+		scroll--;
+	if (IsKeyPressed(KEY_DOWN) || IsKeyPressedRepeat(KEY_DOWN))
+		scroll++;
+	if (IsKeyPressed(KEY_PAGE_UP) || IsKeyPressedRepeat(KEY_PAGE_UP))
+		scroll -= e->visible_lines;
+	if (IsKeyPressed(KEY_PAGE_DOWN) || IsKeyPressedRepeat(KEY_PAGE_DOWN))
+		scroll += e->visible_lines;
+	if (IsKeyPressed(KEY_HOME))
+		scroll = 0;
+	if (IsKeyPressed(KEY_END))
+		scroll = textbuf_line_count(&e->text);
+	scroll_to(e, scroll);
+
+	refresh_cache(e);
+
 	return 0;
 }
 
@@ -240,29 +448,44 @@ void editor_draw(Editor *e)
 	int title_w = MeasureText(title, EDITOR_FONT_SIZE);
 	DrawText(title, e->x + (e->width - title_w) / 2, e->y + 2, EDITOR_FONT_SIZE, EDITOR_BORDER);
 
-	// Draw program with line numbers
-	int y = e->y + 14;
-	int line_num = 1;
-	char *p = e->program;
-	char line_buf[256];
+	// First diagnostic
+	if (e->error_line >= 0)
+	{
+		struct editor_line *l = &e->line_info[e->error_line];
+		LangErr err = l->info.errored ? l->info.err : l->block_err;
+		const char *msg = TextFormat("%d: %s", e->error_line + 1, lang_strerror(err));
+		if (e->error_count > 1)
+			msg = TextFormat("%s (+%d)", msg, e->error_count - 1);
+		DrawText(msg, e->x + 4, e->y + 2, EDITOR_FONT_SIZE, EDITOR_ERROR);
+	}
 
-	while (*p && y < e->y + e->height - 30)
+	// Draw the visible lines from the cache, the ring starts at the scroll
+	// position's row so it takes at most two blits. Render textures are
+	// stored upside down, hence the negative source heights.
+	int text_y = e->y + EDITOR_TEXT_TOP;
+	int text_h = e->height - EDITOR_TEXT_TOP - EDITOR_TEXT_BOTTOM;
+	int cache_w = e->cache.texture.width, cache_h = e->cache.texture.height;
+	int first_row = e->scroll % e->visible_lines;
+	int top_h = (e->visible_lines - first_row) * EDITOR_LINE_HEIGHT;
+	if (top_h > text_h)
+		top_h = text_h;
+	DrawTextureRec(e->cache.texture,
+		(Rectangle){ 0, cache_h - first_row * EDITOR_LINE_HEIGHT - top_h, cache_w, -top_h },
+		(Vector2){ e->x + 4, text_y }, WHITE);
+	if (top_h < text_h)
+		DrawTextureRec(e->cache.texture,
+			(Rectangle){ 0, cache_h - (text_h - top_h), cache_w, -(text_h - top_h) },
+			(Vector2){ e->x + 4, text_y + top_h }, WHITE);
+
+	// Scroll bar
+	int nlines = textbuf_line_count(&e->text);
+	if (nlines > e->visible_lines)
 	{
-		// Extract line
-		int i = 0;
-		while (*p && *p != '\n' && i < 255)
-			line_buf[i++] = *p++;
-		line_buf[i] = '\0';
-		if (*p == '\n')
-			p++;
-
-		// Draw "N: text"
-		char display[280];
-		snprintf(display, sizeof(display), "%d: %s", line_num, line_buf);
-		DrawText(display, e->x + 4, y, EDITOR_FONT_SIZE, EDITOR_TEXT);
-
-		y += EDITOR_LINE_HEIGHT;
-		line_num++;
+		int bar_h = text_h * e->visible_lines / nlines;
+		if (bar_h < 4)
+			bar_h = 4;
+		int bar_y = text_y + (text_h - bar_h) * e->scroll / (nlines - e->visible_lines);
+		DrawRectangle(e->x + e->width - 4, bar_y, 2, bar_h, EDITOR_BORDER);
 	}
 
 	// Input field label and box
@@ -4,12 +4,14 @@
 #include <raylib.h>
 #include <stdbool.h>
 #include <ui.h>
+#include <textbuf.h>
 
-#define EDITOR_MAX_TEXT 4096
 #define EDITOR_MAX_INPUT 128
 #define EDITOR_FONT_SIZE 8
 #define EDITOR_LINE_HEIGHT 9
 
+struct rbt_profile;
+
 // Editor button indices
 #define EDITOR_BTN_SAVE 0
 #define EDITOR_BTN_CANCEL 1
@@ -18,15 +20,26 @@
 typedef struct
 {
 	bool active;
-	char program[EDITOR_MAX_TEXT];   // The full program text
+	TextBuffer text;                 // The full program text
 	char input[EDITOR_MAX_INPUT];    // Line number + replacement text input
 	int input_len;
 	Button buttons[EDITOR_BTN_COUNT];
 	int x, y, width, height;
+	int scroll;                      // First visible line
+	int visible_lines;
+	RenderTexture2D cache;           // One row per visible line, reused as a ring
+	int *cache_lines;                // Line drawn in each row, -1 if stale
+	struct editor_line *line_info;   // Tokens and diagnostics per line, kept in step with `text`
+	int line_info_cap;
+	int error_line, error_count;     // First line with an error (-1 if none), and how many
+	unsigned long heat_max;          // Most fuel spent on one line in the last run
 } Editor;
 
 void editor_init(Editor *e, int x, int y, int width, int height);
-void editor_open(Editor *e);
+void editor_free(Editor *e);
+// Open the program file. Lines are shaded by the fuel `profile` spent on
+// them, which may be NULL.
+void editor_open(Editor *e, const struct rbt_profile *profile);
 void editor_close(Editor *e);
 int editor_update(Editor *e, float scale);  // 0=editing, 1=saved, -1=cancelled
 void editor_draw(Editor *e);
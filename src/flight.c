@@ -0,0 +1,148 @@
+#define _XOPEN_SOURCE 700 /* sigaction, sigaltstack */
+#include <flight.h>
+#include <lang.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+
+extern char *rbt_optos[];
+
+FlightRecorder flight;
+const char *flight_path = "flight.log";
+
+
+/* snprintf is not async-signal-safe, so lines are put together by hand. */
+typedef struct
+{
+	char buf[256];
+	int len;
+} Line;
+
+static
+void put_str(Line *l, const char *s)
+{
+	while (*s && l->len < (int)sizeof(l->buf) - 1)
+		l->buf[l->len++] = *s++;
+}
+
+static
+void put_int(Line *l, long n)
+{
+	char digits[24];
+	int i = 0;
+	unsigned long u = n < 0 ? -(unsigned long)n : (unsigned long)n;
+	do
+		digits[i++] = '0' + u % 10;
+	while ((u /= 10) && i < (int)sizeof(digits));
+	if (n < 0)
+		put_str(l, "-");
+	while (i > 0 && l->len < (int)sizeof(l->buf) - 1)
+		l->buf[l->len++] = digits[--i];
+}
+
+static
+void decode(Line *l, const FlightRecord *r)
+{
+	if (r->kind == FLIGHT_STEP)
+	{
+		put_str(l, "step ");
+		put_int(l, r->value);
+		return;
+	}
+
+	put_str(l, "  robot ");
+	put_int(l, r->robot);
+	put_str(l, " line ");
+	put_int(l, r->line);
+	put_str(l, ": ");
+	switch (r->kind)
+	{
+	case FLIGHT_OP:
+		put_str(l, r->op < LANG_NOPS ? rbt_optos[r->op] : "?");
+		put_str(l, " at ");
+		put_int(l, r->x);
+		put_str(l, ",");
+		put_int(l, r->y);
+		put_str(l, " fuel ");
+		put_int(l, r->value);
+		break;
+	case FLIGHT_REG:
+		put_str(l, "$");
+		put_int(l, r->op);
+		put_str(l, " = ");
+		put_int(l, r->value);
+		break;
+	case FLIGHT_PANIC:
+		put_str(l, "panic, error ");
+		put_int(l, r->value);
+		break;
+	default:
+		put_str(l, "unknown record");
+		break;
+	}
+}
+
+int flight_dump(const char *why)
+{
+	if (!flight_path)
+		return -1;
+	int fd = open(flight_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+
+	Line l = { .len = 0 };
+	put_str(&l, "flight recorder: ");
+	put_str(&l, why);
+	put_str(&l, "\n");
+	write(fd, l.buf, l.len);
+
+	unsigned long head = flight.head;
+	unsigned long first = head > FLIGHT_SIZE ? head - FLIGHT_SIZE : 0;
+	for (unsigned long i = first ; i < head ; i++)
+	{
+		l.len = 0;
+		decode(&l, &flight.ring[i % FLIGHT_SIZE]);
+		put_str(&l, "\n");
+		write(fd, l.buf, l.len);
+	}
+	close(fd);
+	return head - first;
+}
+
+static
+void on_signal(int sig)
+{
+	const char *why = sig == SIGSEGV ? "segmentation fault" : sig == SIGFPE ? "arithmetic exception" :
+		sig == SIGBUS ? "bus error" : "signal";
+	if (flight_dump(why) >= 0)
+	{
+		Line l = { .len = 0 };
+		put_str(&l, "flight recorder: ");
+		put_str(&l, why);
+		put_str(&l, ", recent events written to ");
+		put_str(&l, flight_path);
+		put_str(&l, "\n");
+		write(STDERR_FILENO, l.buf, l.len);
+	}
+	/* SA_RESETHAND restored the default action, which kills the process */
+	raise(sig);
+}
+
+void flight_catch_signals(void)
+{
+	/* a stack overflow leaves no room to run the handler on the normal stack */
+	static char altstack[64 * 1024];
+	stack_t ss = { .ss_sp=altstack, .ss_size=sizeof(altstack), .ss_flags=0 };
+	sigaltstack(&ss, NULL);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sa.sa_flags = SA_RESETHAND | SA_ONSTACK;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGSEGV, &sa, NULL);
+	sigaction(SIGFPE, &sa, NULL);
+	sigaction(SIGBUS, &sa, NULL); /* a mapped program was cut short */
+}
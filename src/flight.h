@@ -0,0 +1,64 @@
+#ifndef __robots_flight__
+#define __robots_flight__
+
+#include <stdint.h>
+
+
+/* Flight recorder: the interpreter always logs its most recent events into a
+ * fixed ring of small binary records. The ring is only decoded when something
+ * goes wrong, on a panic, a crash or when asked for with a key. */
+
+/* Records kept, a power of two. */
+#ifndef FLIGHT_SIZE
+# define FLIGHT_SIZE 4096
+#endif
+
+enum
+{
+	FLIGHT_STEP,  /* a stepper started step `value` */
+	FLIGHT_OP,    /* robot at x,y with `value` fuel runs `op` */
+	FLIGHT_REG,   /* register `op` was set to `value` */
+	FLIGHT_PANIC, /* the program stopped with error code `value` */
+};
+
+typedef struct
+{
+	uint8_t kind;
+	uint8_t op;    /* operation or register */
+	uint16_t robot;
+	int32_t line;
+	int16_t x, y;
+	int32_t value;
+} FlightRecord;
+
+typedef struct
+{
+	FlightRecord ring[FLIGHT_SIZE];
+	unsigned long head; /* total records written, the next goes at head % FLIGHT_SIZE */
+} FlightRecorder;
+
+extern FlightRecorder flight;
+/* Where dumps are written, NULL disables them. Defaults to "flight.log". */
+extern const char *flight_path;
+
+static inline
+void flight_record(int kind, int op, int robot, int line, int x, int y, int value)
+{
+	FlightRecord *r = &flight.ring[flight.head++ % FLIGHT_SIZE];
+	r->kind = kind;
+	r->op = op;
+	r->robot = robot;
+	r->line = line;
+	r->x = x;
+	r->y = y;
+	r->value = value;
+}
+
+/* Decode the ring, oldest first, to `flight_path` under a line saying why.
+ * Only uses async-signal-safe calls so that it works from a crash handler.
+ * Returns the number of records written, or -1 if the file can't be created. */
+int flight_dump(const char *why);
+/* Dump the ring on SIGSEGV, SIGFPE and SIGBUS before the default action runs. */
+void flight_catch_signals(void);
+
+#endif
@@ -0,0 +1,145 @@
+#include <frametime.h>
+#include <raylib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *phase_names[PHASE_COUNT] =
+{
+	[PHASE_MUSIC]   = "music",
+	[PHASE_UPDATE]  = "update",
+	[PHASE_STEP]    = "step",
+	[PHASE_LOGIC]   = "logic",
+	[PHASE_RENDER]  = "render",
+	[PHASE_PRESENT] = "present",
+};
+
+// Milliseconds per phase for the last FRAMETIME_WINDOW frames, plus the whole
+// frame in the last column
+static float samples[PHASE_COUNT + 1][FRAMETIME_WINDOW];
+static int nsamples, head;
+
+static double current[PHASE_COUNT]; // seconds charged to each phase this frame
+static int stack[PHASE_COUNT * 2];  // phases being timed, innermost last
+static int depth;
+static double mark;                 // when the innermost phase was last charged
+static double frame_start;
+static unsigned long frame;
+
+static FILE *log_file;
+static bool overlay;
+
+bool frametime_init(const char *log_path)
+{
+	memset(current, 0, sizeof(current));
+	nsamples = head = depth = 0;
+	frame = 0;
+	frame_start = mark = GetTime();
+	overlay = false;
+
+	log_file = NULL;
+	if (log_path)
+	{
+		log_file = fopen(log_path, "w");
+		if (!log_file)
+		{
+			fprintf(stderr, "error: failed to create `%s`, are you missing permissions?\n", log_path);
+			return false;
+		}
+		fprintf(log_file, "frame");
+		for (int i = 0; i < PHASE_COUNT; i++)
+			fprintf(log_file, ",%s_ms", phase_names[i]);
+		fprintf(log_file, ",frame_ms\n");
+	}
+	return true;
+}
+
+void frametime_shutdown(void)
+{
+	if (log_file)
+	{
+		fclose(log_file);
+		log_file = NULL;
+	}
+}
+
+// Charge the time since the last mark to the innermost phase
+static void charge(double now)
+{
+	if (depth > 0)
+		current[stack[depth - 1]] += now - mark;
+	mark = now;
+}
+
+void frametime_begin(int phase)
+{
+	charge(GetTime());
+	if (depth < (int)(sizeof(stack) / sizeof(stack[0])))
+		stack[depth] = phase;
+	depth++;
+}
+
+void frametime_end(int phase)
+{
+	(void)phase;
+	charge(GetTime());
+	if (depth > 0)
+		depth--;
+}
+
+void frametime_end_frame(void)
+{
+	double now = GetTime();
+	charge(now);
+
+	for (int i = 0; i < PHASE_COUNT; i++)
+		samples[i][head] = current[i] * 1000.0;
+	samples[PHASE_COUNT][head] = (now - frame_start) * 1000.0;
+
+	if (log_file)
+	{
+		fprintf(log_file, "%lu", frame);
+		for (int i = 0; i <= PHASE_COUNT; i++)
+			fprintf(log_file, ",%.4f", samples[i][head]);
+		fprintf(log_file, "\n");
+	}
+
+	head = (head + 1) % FRAMETIME_WINDOW;
+	if (nsamples < FRAMETIME_WINDOW)
+		nsamples++;
+	memset(current, 0, sizeof(current));
+	frame_start = now;
+	frame++;
+}
+
+void frametime_toggle_overlay(void)
+{
+	overlay = !overlay;
+}
+
+static int compare_floats(const void *a, const void *b)
+{
+	float x = *(const float *)a, y = *(const float *)b;
+	return (x > y) - (x < y);
+}
+
+void frametime_draw(int x, int y)
+{
+	if (!overlay || nsamples == 0)
+		return;
+
+	const int size = 8;
+	DrawRectangle(x, y, 92, size * (PHASE_COUNT + 2) + 2, (Color){ 0, 0, 0, 180 });
+	DrawText("ms      p50    p99", x + 2, y + 1, size, WHITE);
+	for (int i = 0; i <= PHASE_COUNT; i++)
+	{
+		float sorted[FRAMETIME_WINDOW];
+		memcpy(sorted, samples[i], nsamples * sizeof(float));
+		qsort(sorted, nsamples, sizeof(float), compare_floats);
+		float p50 = sorted[nsamples / 2];
+		float p99 = sorted[(nsamples * 99) / 100];
+
+		const char *name = i < PHASE_COUNT ? phase_names[i] : "frame";
+		DrawText(TextFormat("%-7s %6.2f %6.2f", name, p50, p99), x + 2, y + 1 + size * (i + 1), size, i < PHASE_COUNT ? YELLOW : WHITE);
+	}
+}
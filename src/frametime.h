@@ -0,0 +1,34 @@
+#ifndef __robots_frametime__
+#define __robots_frametime__
+
+#include <stdbool.h>
+
+// Parts of a frame of the main loop. Phases may nest, time is charged to the
+// innermost one, so `stepper_step` is not counted again as game logic and the
+// final blit and buffer swap are not counted as rendering.
+#define PHASE_MUSIC   0 // update_music
+#define PHASE_UPDATE  1 // renderer_update
+#define PHASE_STEP    2 // stepper_step
+#define PHASE_LOGIC   3 // input, level and win checks
+#define PHASE_RENDER  4 // renderer_render and the other screens
+#define PHASE_PRESENT 5 // scaling to the window and EndDrawing
+#define PHASE_COUNT   6
+
+// Frames kept for the overlay percentiles
+#define FRAMETIME_WINDOW 240
+
+// Start timing. Writes one CSV row per frame to `log_path` unless it is NULL.
+bool frametime_init(const char *log_path);
+void frametime_shutdown(void);
+
+void frametime_begin(int phase);
+void frametime_end(int phase);
+// Close the current frame and start the next one
+void frametime_end_frame(void);
+
+void frametime_toggle_overlay(void);
+// Draw p50/p99 per phase over the last FRAMETIME_WINDOW frames, if the
+// overlay is on. Coordinates are virtual screen pixels.
+void frametime_draw(int x, int y);
+
+#endif
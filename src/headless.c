@@ -0,0 +1,52 @@
+#include <stddef.h>
+#include <headless.h>
+#include <common.h>
+#include <lang.h>
+
+
+HeadlessResult run_headless(State *state, unsigned max_steps, HeadlessStepFn on_step, void *data)
+{
+	HeadlessResult res = {0};
+	if (state->robots.count == 0)
+		return res;
+
+	state->program_running = true;
+	stepper_reload(state->stepper);
+
+	while (max_steps == 0 || res.steps < max_steps)
+	{
+		if (!stepper_step(state, state->stepper, NULL))
+			break;
+		res.steps++;
+
+		if (on_step && !on_step(state, data))
+			break;
+
+		/* same end-of-level checks as the game loop, minus the animations */
+		if (state->robots.fuel[0] <= 0)
+		{
+			res.out_of_fuel = true;
+			break;
+		}
+		if (robots_alive_enemies(&state->robots) == 0)
+		{
+			res.won = true;
+			break;
+		}
+	}
+
+	res.errored = state->stepper->ctx->errored;
+	state->program_running = false;
+	return res;
+}
+
+const char *headless_outcome(HeadlessResult *res)
+{
+	if (res->errored)
+		return "error";
+	if (res->won)
+		return "won";
+	if (res->out_of_fuel)
+		return "out of fuel";
+	return "finished";
+}
@@ -0,0 +1,27 @@
+#ifndef __robots_headless__
+#define __robots_headless__
+
+
+#include <stdbool.h>
+#include <common.h>
+
+
+typedef struct
+{
+	unsigned steps;
+	bool won;         /* every enemy was disassembled */
+	bool out_of_fuel; /* the player ran dry */
+	bool errored;     /* the program panicked */
+} HeadlessResult;
+
+/* Called after every step. Return false to stop the run early. */
+typedef bool (*HeadlessStepFn)(State *state, void *data);
+
+/* Run the state's program to completion without a window or audio.
+ * A `max_steps` of 0 means no limit. */
+HeadlessResult run_headless(State *state, unsigned max_steps, HeadlessStepFn on_step, void *data);
+/* Human-readable outcome of a run. */
+const char *headless_outcome(HeadlessResult *res);
+
+
+#endif
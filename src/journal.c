@@ -0,0 +1,463 @@
+#include <stdlib.h>
+#include <string.h>
+#include <journal.h>
+#include <lang.h>
+#include <common.h>
+#include <mem.h>
+
+
+/* Delta records are a list of (tag, value) varint pairs ended by a zero tag.
+ * The low bits of a tag say which field changed and the rest is the element
+ * index. Values are zigzag-encoded differences from the previous value, so a
+ * typical step (one coordinate, fuel and the program counter) costs ~8 bytes. */
+enum journal_kind
+{
+	journal_end,
+	journal_reg,
+	journal_tile,
+	journal_x,
+	journal_y,
+	journal_fuel,
+	journal_dir,
+	journal_flags,
+	journal_pc,
+	journal_n,
+	journal_curfn,
+	journal_nfns,
+};
+
+#define JOURNAL_KIND_BITS 4
+#define JOURNAL_MAGIC 0x4e524a52 /* "RJRN" */
+
+
+static
+void buf_reserve(JournalBuf *b, size_t extra)
+{
+	if (b->len + extra <= b->cap)
+		return;
+	size_t newcap = b->cap ? b->cap : 256;
+	while (newcap < b->len + extra)
+		newcap *= 2;
+	b->data = mem_realloc(MEM_JOURNAL, b->data, newcap);
+	b->cap = newcap;
+}
+
+static
+void put_uvarint(JournalBuf *b, unsigned long v)
+{
+	buf_reserve(b, 10);
+	while (v >= 0x80)
+	{
+		b->data[b->len++] = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	b->data[b->len++] = (unsigned char)v;
+}
+
+static
+void put_svarint(JournalBuf *b, long v)
+{
+	put_uvarint(b, ((unsigned long)v << 1) ^ (unsigned long)(v >> (sizeof(long) * 8 - 1)));
+}
+
+static
+unsigned long get_uvarint(const unsigned char **p, const unsigned char *end)
+{
+	unsigned long v = 0;
+	int shift = 0;
+	while (*p < end)
+	{
+		unsigned char c = *(*p)++;
+		v |= (unsigned long)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			break;
+		shift += 7;
+	}
+	return v;
+}
+
+static
+long get_svarint(const unsigned char **p, const unsigned char *end)
+{
+	unsigned long v = get_uvarint(p, end);
+	return (long)(v >> 1) ^ -(long)(v & 1);
+}
+
+
+static
+void frame_free(JournalFrame *f)
+{
+	mem_free(f->tiles);
+	mem_free(f->x);
+	mem_free(f->y);
+	mem_free(f->fuel);
+	mem_free(f->dir);
+	mem_free(f->flags);
+	*f = (JournalFrame){0};
+}
+
+/* Size the frame's arrays for the given world and robot count. */
+static
+void frame_resize(JournalFrame *f, int width, int height, int nrobots)
+{
+	if (f->width * f->height != width * height)
+		f->tiles = mem_realloc(MEM_JOURNAL, f->tiles, width * height * sizeof(*f->tiles));
+	if (f->nrobots != nrobots)
+	{
+		f->x = mem_realloc(MEM_JOURNAL, f->x, nrobots * sizeof(*f->x));
+		f->y = mem_realloc(MEM_JOURNAL, f->y, nrobots * sizeof(*f->y));
+		f->fuel = mem_realloc(MEM_JOURNAL, f->fuel, nrobots * sizeof(*f->fuel));
+		f->dir = mem_realloc(MEM_JOURNAL, f->dir, nrobots * sizeof(*f->dir));
+		f->flags = mem_realloc(MEM_JOURNAL, f->flags, nrobots * sizeof(*f->flags));
+	}
+	f->width = width;
+	f->height = height;
+	f->nrobots = nrobots;
+}
+
+static
+void frame_capture(JournalFrame *f, State *state)
+{
+	Robots *rs = &state->robots;
+	LangStepper *ls = state->stepper;
+
+	frame_resize(f, state->world->width, state->world->height, rs->count);
+	memcpy(f->tiles, state->world->tiles, f->width * f->height * sizeof(*f->tiles));
+	memcpy(f->x, rs->x, rs->count * sizeof(*f->x));
+	memcpy(f->y, rs->y, rs->count * sizeof(*f->y));
+	memcpy(f->fuel, rs->fuel, rs->count * sizeof(*f->fuel));
+	memcpy(f->dir, rs->dir, rs->count * sizeof(*f->dir));
+	memcpy(f->flags, rs->flags, rs->count * sizeof(*f->flags));
+	memcpy(f->registers, ls->ctx->registers, sizeof(f->registers));
+	f->lexpos = ls->_lexpos;
+	f->n = ls->n;
+	f->curfn = ls->ctx->_curfn;
+	f->nfns = ls->ctx->_nfns;
+}
+
+static
+bool frame_apply(JournalFrame *f, State *state)
+{
+	Robots *rs = &state->robots;
+	LangStepper *ls = state->stepper;
+
+	if (f->width != state->world->width || f->height != state->world->height || f->nrobots != rs->count)
+		return false;
+
+	memcpy(state->world->tiles, f->tiles, f->width * f->height * sizeof(*f->tiles));
+	memcpy(rs->x, f->x, rs->count * sizeof(*f->x));
+	memcpy(rs->y, f->y, rs->count * sizeof(*f->y));
+	memcpy(rs->fuel, f->fuel, rs->count * sizeof(*f->fuel));
+	memcpy(rs->dir, f->dir, rs->count * sizeof(*f->dir));
+	memcpy(rs->flags, f->flags, rs->count * sizeof(*f->flags));
+	robots_relink(rs);
+	world_sync(state);
+	memcpy(ls->ctx->registers, f->registers, sizeof(f->registers));
+	ls->_lexpos = f->lexpos;
+	ls->n = f->n;
+	ls->ctx->_curfn = f->curfn;
+	ls->ctx->_nfns = f->nfns; /* later definitions stay compiled, see get_fn */
+	return true;
+}
+
+static
+void frame_write(JournalFrame *f, JournalBuf *out)
+{
+	put_uvarint(out, JOURNAL_MAGIC);
+	put_uvarint(out, f->width);
+	put_uvarint(out, f->height);
+
+	/* tiles are mostly runs of the same value */
+	int ntiles = f->width * f->height;
+	for (int i = 0 ; i < ntiles ; )
+	{
+		int run = 1;
+		while (i + run < ntiles && f->tiles[i + run] == f->tiles[i])
+			run++;
+		put_uvarint(out, run);
+		put_svarint(out, f->tiles[i]);
+		i += run;
+	}
+
+	put_uvarint(out, f->nrobots);
+	for (int i = 0 ; i < f->nrobots ; i++)
+	{
+		put_svarint(out, f->x[i]);
+		put_svarint(out, f->y[i]);
+		put_svarint(out, f->fuel[i]);
+		put_uvarint(out, f->dir[i]);
+		put_uvarint(out, f->flags[i]);
+	}
+
+	for (int i = 0 ; i < LANG_NREGS ; i++)
+		put_svarint(out, f->registers[i]);
+	put_svarint(out, f->lexpos);
+	put_uvarint(out, f->n);
+	put_svarint(out, f->curfn);
+	put_uvarint(out, f->nfns);
+}
+
+static
+bool frame_read(JournalFrame *f, const unsigned char *p, const unsigned char *end)
+{
+	if (get_uvarint(&p, end) != JOURNAL_MAGIC)
+		return false;
+
+	int width = get_uvarint(&p, end);
+	int height = get_uvarint(&p, end);
+	frame_resize(f, width, height, f->nrobots);
+	for (int i = 0 ; i < width * height && p < end ; )
+	{
+		int run = get_uvarint(&p, end);
+		int tile = get_svarint(&p, end);
+		while (run-- > 0 && i < width * height)
+			f->tiles[i++] = tile;
+	}
+
+	int nrobots = get_uvarint(&p, end);
+	frame_resize(f, width, height, nrobots);
+
+	for (int i = 0 ; i < nrobots ; i++)
+	{
+		f->x[i] = get_svarint(&p, end);
+		f->y[i] = get_svarint(&p, end);
+		f->fuel[i] = get_svarint(&p, end);
+		f->dir[i] = get_uvarint(&p, end);
+		f->flags[i] = get_uvarint(&p, end);
+	}
+
+	for (int i = 0 ; i < LANG_NREGS ; i++)
+		f->registers[i] = get_svarint(&p, end);
+	f->lexpos = get_svarint(&p, end);
+	f->n = get_uvarint(&p, end);
+	f->curfn = get_svarint(&p, end);
+	f->nfns = get_uvarint(&p, end);
+	return p <= end;
+}
+
+
+/* Emit a record entry for every element of `cur` that differs from `old`,
+ * updating `old` as we go. The memcmp lets unchanged arrays cost nothing. */
+#define DIFF_ARRAY(out, kind, old, cur, count) \
+	do { \
+		if (memcmp((old), (cur), (count) * sizeof(*(cur))) == 0) \
+			break; \
+		for (int _i = 0 ; _i < (count) ; _i++) \
+		{ \
+			if ((old)[_i] == (cur)[_i]) \
+				continue; \
+			put_uvarint((out), ((unsigned long)_i << JOURNAL_KIND_BITS) | (kind)); \
+			put_svarint((out), (long)(cur)[_i] - (long)(old)[_i]); \
+			(old)[_i] = (cur)[_i]; \
+		} \
+	} while (0)
+
+/* Tiles only change a few at a time, so only the ones the world says were
+ * set are looked at unless it lost count. */
+static
+void diff_tiles(JournalFrame *f, World *w, JournalBuf *out)
+{
+	if (w->ndirty == WORLD_DIRTY_ALL)
+		DIFF_ARRAY(out, journal_tile, f->tiles, w->tiles, f->width * f->height);
+	else
+	{
+		/* a tile set twice is equal to the shadow by the second time */
+		for (int k = 0 ; k < w->ndirty ; k++)
+		{
+			int i = w->dirty[k];
+			if (f->tiles[i] == w->tiles[i])
+				continue;
+			put_uvarint(out, ((unsigned long)i << JOURNAL_KIND_BITS) | journal_tile);
+			put_svarint(out, (long)w->tiles[i] - (long)f->tiles[i]);
+			f->tiles[i] = w->tiles[i];
+		}
+	}
+	w->ndirty = 0;
+}
+
+static
+void frame_diff(JournalFrame *f, State *state, JournalBuf *out)
+{
+	Robots *rs = &state->robots;
+	LangStepper *ls = state->stepper;
+
+	DIFF_ARRAY(out, journal_reg, f->registers, ls->ctx->registers, LANG_NREGS);
+	diff_tiles(f, state->world, out);
+	DIFF_ARRAY(out, journal_x, f->x, rs->x, rs->count);
+	DIFF_ARRAY(out, journal_y, f->y, rs->y, rs->count);
+	DIFF_ARRAY(out, journal_fuel, f->fuel, rs->fuel, rs->count);
+	DIFF_ARRAY(out, journal_dir, f->dir, rs->dir, rs->count);
+	DIFF_ARRAY(out, journal_flags, f->flags, rs->flags, rs->count);
+
+	if (ls->_lexpos != f->lexpos)
+	{
+		put_uvarint(out, journal_pc);
+		put_svarint(out, ls->_lexpos - f->lexpos);
+		f->lexpos = ls->_lexpos;
+	}
+	/* the step counter normally advances by one, so only record surprises */
+	if (ls->n != f->n + 1)
+	{
+		put_uvarint(out, journal_n);
+		put_svarint(out, (long)ls->n - (long)(f->n + 1));
+	}
+	f->n = ls->n;
+	if (ls->ctx->_curfn != f->curfn)
+	{
+		put_uvarint(out, journal_curfn);
+		put_svarint(out, ls->ctx->_curfn - f->curfn);
+		f->curfn = ls->ctx->_curfn;
+	}
+	if (ls->ctx->_nfns != f->nfns)
+	{
+		put_uvarint(out, journal_nfns);
+		put_svarint(out, ls->ctx->_nfns - f->nfns);
+		f->nfns = ls->ctx->_nfns;
+	}
+
+	put_uvarint(out, journal_end);
+}
+
+/* Apply one delta record to the frame, returning a pointer just past it. */
+static
+const unsigned char *frame_patch(JournalFrame *f, const unsigned char *p, const unsigned char *end)
+{
+	f->n++;
+	while (p < end)
+	{
+		unsigned long tag = get_uvarint(&p, end);
+		if (tag == journal_end)
+			break;
+		long v = get_svarint(&p, end);
+		unsigned long i = tag >> JOURNAL_KIND_BITS;
+		switch (tag & ((1 << JOURNAL_KIND_BITS) - 1))
+		{
+		case journal_reg:   f->registers[i] += v; break;
+		case journal_tile:  f->tiles[i] += v; break;
+		case journal_x:     f->x[i] += v; break;
+		case journal_y:     f->y[i] += v; break;
+		case journal_fuel:  f->fuel[i] += v; break;
+		case journal_dir:   f->dir[i] += v; break;
+		case journal_flags: f->flags[i] += v; break;
+		case journal_pc:    f->lexpos += v; break;
+		case journal_n:     f->n += v; break;
+		case journal_curfn: f->curfn += v; break;
+		case journal_nfns:  f->nfns += v; break;
+		default: break;
+		}
+	}
+	return p;
+}
+
+
+static
+void journal_keyframe(Journal *j)
+{
+	if (j->nkeys == j->_keycap)
+	{
+		j->_keycap = j->_keycap ? j->_keycap * 2 : 16;
+		j->key_log = mem_realloc(MEM_JOURNAL, j->key_log, j->_keycap * sizeof(*j->key_log));
+		j->key_blob = mem_realloc(MEM_JOURNAL, j->key_blob, j->_keycap * sizeof(*j->key_blob));
+	}
+	j->key_log[j->nkeys] = j->log.len;
+	j->key_blob[j->nkeys] = j->keyframes.len;
+	j->nkeys++;
+	frame_write(&j->shadow, &j->keyframes);
+}
+
+Journal *new_journal(void)
+{
+	return mem_calloc(MEM_JOURNAL, 1, sizeof(Journal));
+}
+
+void del_journal(Journal *j)
+{
+	if (!j)
+		return;
+	mem_free(j->log.data);
+	mem_free(j->keyframes.data);
+	mem_free(j->key_log);
+	mem_free(j->key_blob);
+	frame_free(&j->shadow);
+	mem_free(j);
+}
+
+void journal_begin(Journal *j, State *state)
+{
+	j->log.len = 0;
+	j->keyframes.len = 0;
+	j->nkeys = 0;
+	j->nsteps = 0;
+	j->cursor = 0;
+	j->cursor_off = 0;
+	frame_capture(&j->shadow, state);
+	state->world->ndirty = 0;
+	journal_keyframe(j);
+}
+
+void journal_record(Journal *j, State *state)
+{
+	/* recording after a seek discards the steps that came after it */
+	if (j->cursor < j->nsteps)
+	{
+		unsigned nkeys = j->cursor / JOURNAL_KEYFRAME_INTERVAL + 1;
+		if (nkeys < j->nkeys)
+		{
+			j->keyframes.len = j->key_blob[nkeys];
+			j->nkeys = nkeys;
+		}
+		j->log.len = j->cursor_off;
+		j->nsteps = j->cursor;
+	}
+
+	frame_diff(&j->shadow, state, &j->log);
+	j->nsteps++;
+	j->cursor = j->nsteps;
+	j->cursor_off = j->log.len;
+
+	if (j->nsteps % JOURNAL_KEYFRAME_INTERVAL == 0)
+		journal_keyframe(j);
+}
+
+bool journal_seek(Journal *j, State *state, unsigned step)
+{
+	if (step > j->nsteps || j->nkeys == 0)
+		return false;
+
+	unsigned key = step / JOURNAL_KEYFRAME_INTERVAL;
+	size_t blob_end = key + 1 < j->nkeys ? j->key_blob[key + 1] : j->keyframes.len;
+	if (!frame_read(&j->shadow, j->keyframes.data + j->key_blob[key], j->keyframes.data + blob_end))
+		return false;
+
+	const unsigned char *p = j->log.data + j->key_log[key], *end = j->log.data + j->log.len;
+	for (unsigned s = key * JOURNAL_KEYFRAME_INTERVAL ; s < step ; s++)
+		p = frame_patch(&j->shadow, p, end);
+
+	j->cursor = step;
+	j->cursor_off = p - j->log.data;
+	if (!frame_apply(&j->shadow, state))
+		return false;
+	state->world->ndirty = 0; /* the shadow is what the tiles now are */
+	return true;
+}
+
+size_t journal_size(Journal *j)
+{
+	return j->log.len + j->keyframes.len;
+}
+
+void journal_snapshot(State *state, JournalBuf *out)
+{
+	JournalFrame f = {0};
+	frame_capture(&f, state);
+	frame_write(&f, out);
+	frame_free(&f);
+}
+
+bool journal_restore(State *state, const unsigned char *data, size_t len)
+{
+	JournalFrame f = {0};
+	bool ok = frame_read(&f, data, data + len) && frame_apply(&f, state);
+	frame_free(&f);
+	return ok;
+}
@@ -0,0 +1,67 @@
+#ifndef __robots_journal__
+#define __robots_journal__
+
+
+#include <stddef.h>
+#include <common.h>
+#include <lang.h>
+
+
+/* Steps between keyframes. Seeking costs at most this many delta records. */
+#ifndef JOURNAL_KEYFRAME_INTERVAL
+# define JOURNAL_KEYFRAME_INTERVAL 64
+#endif
+
+
+typedef struct
+{
+	unsigned char *data;
+	size_t len, cap;
+} JournalBuf;
+
+/* Plain copy of everything the journal tracks. */
+typedef struct
+{
+	int width, height;
+	int *tiles;
+	int nrobots;
+	int *x, *y, *fuel;
+	Direction *dir;
+	unsigned char *flags;
+	int registers[LANG_NREGS];
+	long lexpos;
+	unsigned n;
+	int curfn, nfns;
+} JournalFrame;
+
+typedef struct rbt_journal
+{
+	JournalBuf log;       /* append-only delta records, one per step */
+	JournalBuf keyframes; /* serialized frames */
+	size_t *key_log;      /* offset into `log` where each keyframe's deltas start */
+	size_t *key_blob;     /* offset into `keyframes` of each keyframe */
+	unsigned nkeys, _keycap;
+	unsigned nsteps;      /* number of recorded steps */
+	unsigned cursor;      /* step that `shadow` currently holds */
+	size_t cursor_off;    /* offset into `log` just past the cursor's record */
+	JournalFrame shadow;
+} Journal;
+
+Journal *new_journal(void);
+void del_journal(Journal *j);
+/* Reset the journal and take the initial keyframe from `state`. */
+void journal_begin(Journal *j, State *state);
+/* Append the delta for the step that was just executed. */
+void journal_record(Journal *j, State *state);
+/* Restore `state` to how it was after `step` steps. */
+bool journal_seek(Journal *j, State *state, unsigned step);
+/* Total bytes used by the delta log and keyframes. */
+size_t journal_size(Journal *j);
+
+/* Serialize `state` compactly, appending to `out`. */
+void journal_snapshot(State *state, JournalBuf *out);
+/* Restore a snapshot made by journal_snapshot into a state with the same world size. */
+bool journal_restore(State *state, const unsigned char *data, size_t len);
+
+
+#endif
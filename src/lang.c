@@ -3,16 +3,21 @@
 #include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <lang.h>
 #include <rendering.h>
 #include <audio.h>
 #include <common.h>
-
-
-#ifndef LANG_ARGBUFSIZ
-# define LANG_ARGBUFSIZ 256
-#endif
+#include <journal.h>
+#include <scan.h>
+#include <opstats.h>
+#include <trace.h>
+#include <flight.h>
+#include <mem.h>
+#include <paths.h>
 
 
 #if DEBUG_GAME
@@ -23,6 +28,7 @@
 
 
 char *DEFAULT_PROGRAM_PATH = "program.rbt";
+bool lang_map_programs = true;
 
 
 enum rbt_const
@@ -63,6 +69,9 @@ char *rbt_optos[] =
 	"mul",
 	"div",
 	"mod",
+	"goto",
+	"seek",
+	"radar",
 	NULL,
 };
 
@@ -86,13 +95,14 @@ char *rbt_consttos[] =
 struct rbt_opinfo
 {
 	int argc;
+	int optargs; /* how many of the trailing arguments may be left out */
 	char *usage;
 };
 
 struct rbt_opinfo rbt_ops[] =
 {
 	[rbt_op_err]      = { .argc=0 },
-	[rbt_op_print]    = { .argc=1, .usage="print [VALUE]" },
+	[rbt_op_print]    = { .argc=1, .optargs=1, .usage="print [VALUE]" },
 	[rbt_op_forward]  = { .argc=0, .usage="forward" },
 	[rbt_op_backward] = { .argc=0, .usage="backward" },
 	[rbt_op_turn]     = { .argc=1, .usage="turn cw|ccw" },
@@ -101,6 +111,7 @@ struct rbt_opinfo rbt_ops[] =
 	[rbt_op_scan]     = { .argc=1, .usage="scan REGISTER" },
 	[rbt_op_run]      = { .argc=1, .usage="run FUNCTION" },
 	[rbt_op_if]       = { .argc=4, .usage="if VALUE OPERATION VALUE then STATEMENT" },
+	[rbt_op_set]      = { .argc=2, .usage="set REGISTER VALUE" },
 	[rbt_op_fn]       = { .argc=1, .usage="fn NAME" },
 	[rbt_op_end]      = { .argc=0, .usage="end" },
 	[rbt_op_add]      = { .argc=2, .usage="add REGISTER N" },
@@ -108,11 +119,16 @@ struct rbt_opinfo rbt_ops[] =
 	[rbt_op_mul]      = { .argc=2, .usage="mul REGISTER N" },
 	[rbt_op_div]      = { .argc=2, .usage="div REGISTER N" },
 	[rbt_op_mod]      = { .argc=2, .usage="mod REGISTER N" },
+	[rbt_op_goto]     = { .argc=3, .optargs=1, .usage="goto X Y [REGISTER]" },
+	[rbt_op_seek]     = { .argc=2, .optargs=1, .usage="seek fuel|robot [REGISTER]" },
+	[rbt_op_radar]    = { .argc=3, .usage="radar REGISTER N wall|fuel|robot" },
 };
 
 
 static
 void print_ins(LangIns ins);
+static
+LangIns parse_ins(LangContext *ctx, long *index, char *program);
 
 
 static
@@ -123,7 +139,22 @@ void panic(LangContext *ctx, LangErr code, char *fmt, ...)
 	vsnprintf(ctx->error_msg, sizeof(ctx->error_msg) - 1, fmt, ap);
 	va_end(ap);
 
+	/* the failing instruction is the last one this robot started */
+	int line = 0;
+	for (unsigned long i = flight.head ; i > 0 && flight.head - i < FLIGHT_SIZE ; i--)
+	{
+		FlightRecord *r = &flight.ring[(i - 1) % FLIGHT_SIZE];
+		if (r->kind == FLIGHT_OP && r->robot == ctx->robot)
+		{
+			line = r->line;
+			break;
+		}
+	}
+	flight_record(FLIGHT_PANIC, 0, ctx->robot, line, 0, 0, code);
+
 	fprintf(stderr, "panic: %s\n", ctx->error_msg);
+	if (flight_dump(ctx->error_msg) >= 0)
+		fprintf(stderr, "panic: recent events written to %s\n", flight_path);
 	if (ctx->_renderer)
 		renderer_set_notif(ctx->_renderer, (char *)TextFormat("ERROR: %u", code));
 
@@ -134,31 +165,36 @@ void panic(LangContext *ctx, LangErr code, char *fmt, ...)
 }
 
 static
-LangFn *get_fn(LangContext *ctx, char *name)
+bool slice_is(LangSlice sl, const char *s);
+
+static
+LangFn *get_fn(LangContext *ctx, LangSlice name)
 {
-	for (int i = 0 ; i < LANG_NFNS ; i++)
+	/* only the first `_nfns` are live, later slots may be left over from a rewind. */
+	for (int i = 0 ; i < ctx->_nfns ; i++)
 	{
-		if (ctx->fns[i].name && strcmp(ctx->fns[i].name, name) == 0)
+		if (ctx->fns[i].name && slice_is(name, ctx->fns[i].name))
 			return &ctx->fns[i];
 	}
 	return NULL;
 }
 
 static
-int *get_reg(LangContext *ctx, char *text)
+int *get_reg(LangContext *ctx, LangSlice text)
 {
 	static int invalid_register = 0; /* used instead of NULL to prevent segfaults. */
-	if (!text)
+	if (!text.s)
 	{
 		panic(ctx, rbt_errcode_internal, "get_reg: `text` was NULL.");
 		return NULL;
 	}
-	if (text[0] != '$')
+	if (text.s[0] != '$')
 	{
 		panic(ctx, rbt_errcode_syn_register, "register argument must start with a dollar sign (`$`)");
 		return &invalid_register;
 	}
-	int reg = strtol(text+1, NULL, 10); /* +1 because of $ prefix. */
+	/* the slice is followed by whitespace or a newline, which ends the number */
+	int reg = strtol(text.s+1, NULL, 10); /* +1 because of $ prefix. */
 	if (reg >= LANG_NREGS)
 	{
 		panic(ctx, rbt_errcode_syn_register, "register out of bounds (range is 0-15 inclusive)");
@@ -169,98 +205,172 @@ int *get_reg(LangContext *ctx, char *text)
 }
 
 static
-int eval_val(LangContext *ctx, char *val)
+int eval_val(LangContext *ctx, LangSlice val)
 {
-	if (!val)
+	if (!val.s)
 		return -1;
-	else if (val[0] == '$')
+	else if (val.s[0] == '$')
 		return *get_reg(ctx, val);
-	else if (isalpha(val[0]))
+	else if (isalpha(val.s[0]))
 	{
 		for (char **c = &rbt_consttos[0] ; *c != NULL ; c++)
 		{
-			if (strcmp(*c, val) == 0)
+			if (slice_is(val, *c))
 			{
 				return c - &rbt_consttos[0];
 			}
 		}
-		panic(ctx, rbt_errcode_syn_unknown_const, "unknown constant: `%s`", val);
+		panic(ctx, rbt_errcode_syn_unknown_const, "unknown constant: `%.*s`", val.len, val.s);
 		return -1;
 	}
-	else if (isdigit(val[0]) || val[0] == '-')
+	else if (isdigit(val.s[0]) || val.s[0] == '-')
 	{
-		return strtol(val, NULL, 10);
+		return strtol(val.s, NULL, 10);
 	}
 	else
 	{
-		panic(ctx, rbt_errcode_syn_invalid_value, "invalid value: `%s`", val);
+		panic(ctx, rbt_errcode_syn_invalid_value, "invalid value: `%.*s`", val.len, val.s);
 		return -1;
 	}
 }
 
+/* Log a register write to the flight recorder. */
+static
+void record_reg(LangContext *ctx, int *reg, int line)
+{
+	if (reg >= ctx->registers && reg < ctx->registers + LANG_NREGS)
+		flight_record(FLIGHT_REG, reg - ctx->registers, ctx->robot, line, 0, 0, *reg);
+}
+
+/* Count an execution of `line` that cost `fuel`. */
+static
+void profile_hit(LangProfile *p, int line, int fuel)
+{
+	p->total.count++;
+	p->total.fuel += fuel;
+	if (line <= 0)
+		return;
+	if (line > p->_linecap)
+	{
+		int cap = p->_linecap ? p->_linecap : 64;
+		while (cap < line)
+			cap *= 2;
+		p->lines = mem_realloc(MEM_LANG_RUNTIME, p->lines, cap * sizeof(*p->lines));
+		memset(&p->lines[p->_linecap], 0, (cap - p->_linecap) * sizeof(*p->lines));
+		p->_linecap = cap;
+	}
+	if (line > p->nlines)
+		p->nlines = line;
+	p->lines[line - 1].count++;
+	p->lines[line - 1].fuel += fuel;
+}
+
+static
+void eval_ins(State *state, LangContext *ctx, Renderer *renderer, struct rbt_instruction ins);
+
+/* eval_ins traces and times every instruction around the real evaluation */
+static
+void eval_op(State *state, LangContext *ctx, Renderer *renderer, struct rbt_instruction ins);
+
 static
 void eval_ins(State *state, LangContext *ctx, Renderer *renderer, struct rbt_instruction ins)
+{
+	unsigned long long traced = trace_begin();
+	Robots *rs = &state->robots;
+	flight_record(FLIGHT_OP, ins.op, ctx->robot, ins.line, rs->x[ctx->robot], rs->y[ctx->robot], rs->fuel[ctx->robot]);
+#if LANG_OPSTATS
+	unsigned long long start = opstats_begin();
+	eval_op(state, ctx, renderer, ins);
+	opstats_end(ins.op, start);
+#else
+	eval_op(state, ctx, renderer, ins);
+#endif
+	trace_end_line(traced, "lang", rbt_optos[ins.op], ins.line);
+}
+
+static
+void eval_op(State *state, LangContext *ctx, Renderer *renderer, struct rbt_instruction ins)
 {
 	if (!ctx->_renderer)
 		ctx->_renderer = renderer;
 
-	Robot *r = &state->robots[ctx->robot];
-	RobotVisual *rv = renderer_get_visual(renderer, ctx->robot);
+	Robots *rs = &state->robots;
+	int id = ctx->robot;
+	RobotVisual *rv = renderer ? renderer_get_visual(renderer, id) : NULL; /* NULL when headless */
 
 	#	if DEBUG_GAME
 	printf("eval_ins: ");
 	print_ins(ins);
 #	endif
 
-	if (ins.op != rbt_op_end)
-		robot_use_fuel(r, 1);
+	int cost = ins.op == rbt_op_end ? 0 : 1;
+	if (ins.op == rbt_op_radar)
+	{
+		/* the further it looks the more it costs, bad ranges are caught below */
+		int range = eval_val(ctx, ins.args[1]);
+		if (range > 0 && range <= LANG_RADAR_RANGE)
+			cost += (range - 1) / LANG_RADAR_FUEL_RANGE;
+	}
+	if (cost)
+	{
+		robot_use_fuel(rs, id, cost);
+		opstats_fuel(ins.op, cost);
+	}
+	profile_hit(&ctx->profile, ins.line, cost);
 
 	// print_ins(ins);
 	switch (ins.op)
 	{
 	case rbt_op_print:
 		{
-		int n = ins.args[0] ? eval_val(ctx, ins.args[0]) : 1;
-		printf("[PRINT] %d\n", n);
+		int n = ins.args[0].s ? eval_val(ctx, ins.args[0]) : 1;
+		/* one step can print more than the ring holds, e.g. through `run` */
+		if (ctx->prints.drain && ctx->prints.head - ctx->prints.flushed >= LANG_PRINT_CAP)
+			print_flush(&ctx->prints, ctx->prints.drain, 0);
+		LangPrint *p = &ctx->prints.ring[ctx->prints.head++ % LANG_PRINT_CAP];
+		p->value = n;
+		p->line = ins.line;
 		break;
 		}
 	case rbt_op_forward:
 	case rbt_op_backward:
 		{
 		bool moved = (ins.op == rbt_op_forward) ?
-			robot_forward(state, r) :
-			robot_backward(state, r);
+			robot_forward(state, id) :
+			robot_backward(state, id);
+		if (!rv)
+			break;
 		if (moved)
 		{
-			robot_visual_move_to(rv, r->x, r->y);
+			robot_visual_move_to(rv, rs->x[id], rs->y[id]);
 			play_sfx((ins.op == rbt_op_forward) ?
 					SFX_ADVANCING :
 					SFX_REVERSE);
 		}
 		else if (!robot_visual_is_animating(rv))
-			robot_visual_ram(rv, r->dir); /* ram to indicate that the player can't move there. */
+			robot_visual_ram(rv, rs->dir[id]); /* ram to indicate that the player can't move there. */
 		}
 		break;
 	case rbt_op_turn:
 		if (eval_val(ctx, ins.args[0]) == rbt_const_ccw)
-			robot_turn_left(r);
+			robot_turn_left(rs, id);
 		else if (eval_val(ctx, ins.args[0]) == rbt_const_cw)
-			robot_turn_right(r);
+			robot_turn_right(rs, id);
 		else
 		{
 			panic(ctx, rbt_errcode_invalid_argument, "turn expects argument to be either `ccw` or `cw`.");
 			break;
 		}
 		play_sfx(SFX_ROTATING);
-		robot_visual_rotate_to(rv, r->dir);
+		if (rv)
+			robot_visual_rotate_to(rv, rs->dir[id]);
 		break;
 	case rbt_op_refuel:
 		{
-		int *tile = get_tile(state->world, r->x, r->y);
-		if (*tile == TILE_ENERGY)
+		if (bitset_get(&state->world->energy, rs->x[id], rs->y[id]))
 		{
-			robot_refuel(r, FUEL_CANISTER_AMOUNT);
-			*tile = TILE_EMPTY;
+			robot_refuel(rs, id, state->canister_fuel);
+			set_tile(state->world, rs->x[id], rs->y[id], TILE_EMPTY);
 			play_sfx(SFX_REFUELING);
 		}
 		break;
@@ -268,26 +378,20 @@ void eval_ins(State *state, LangContext *ctx, Renderer *renderer, struct rbt_ins
 	case rbt_op_ram:
 		{
 		// target position to ram
-		int tx = (*r).x, ty = (*r).y;
-		switch ((*r).dir)
-		{
-			case North: ty--; break;
-			case East: tx++; break;
-			case South: ty++; break;
-			case West: tx--; break;
-		}
+		int tx = rs->x[id] + direction_dx[rs->dir[id]];
+		int ty = rs->y[id] + direction_dy[rs->dir[id]];
 
 		int target_idx = find_robot_pos(state, tx, ty);
 
-		if (target_idx != -1 && !(*state).robots[target_idx].is_player)
+		if (target_idx != -1 && !robot_is_player(rs, target_idx))
 		{
-			Robot *enemy = &state->robots[target_idx];
-			robot_disassemble(enemy);
-
-			robot_visual_ram(rv, (*r).dir);
+			robot_disassemble(state, target_idx);
 
-			RobotVisual *v = renderer_get_visual(renderer, target_idx);
-			robot_visual_disassemble(v, &renderer->disassembly_anims[target_idx]);
+			if (rv)
+			{
+				robot_visual_ram(rv, rs->dir[id]);
+				renderer_disassemble(renderer, target_idx);
+			}
 			play_sfx(SFX_DISASSEMBLED);
 		}
 		break;
@@ -299,50 +403,47 @@ void eval_ins(State *state, LangContext *ctx, Renderer *renderer, struct rbt_ins
 			break;
 
 		/* scan for robots */
-		int tx = r->x, ty = r->y;
-		switch (r->dir)
-		{
-			case North: ty--; break;
-			case East:  tx++; break;
-			case South: ty++; break;
-			case West:  tx--; break;
-		}
+		int tx = rs->x[id] + direction_dx[rs->dir[id]];
+		int ty = rs->y[id] + direction_dy[rs->dir[id]];
 		int target_idx = find_robot_pos(state, tx, ty);
 		if (target_idx != -1)
 		{
 			*reg = rbt_const_robot;
+			record_reg(ctx, reg, ins.line);
 			break;
 		}
 
-		int *tile = get_tile_with_offset(state->world, r->x, r->y, r->dir);
+		int *tile = get_tile_with_offset(state->world, rs->x[id], rs->y[id], rs->dir[id]);
 		if (reg && tile)
 		{
 			*reg = *tile;
+			record_reg(ctx, reg, ins.line);
 			/* clear fog, if applicable */
-			for (int dy = -1; dy <= 1; dy++)
-			{
-				for (int dx = -1; dx <= 1; dx++)
-				{
-					renderer_set_fog(renderer, r->x + dx, r->y + dy, false);
-				}
-			}
+			if (renderer)
+				renderer_look(renderer, state);
 		}
 		break;
 		}
 	case rbt_op_run:
 		{
-		char *name = ins.args[0];
+		LangSlice name = ins.args[0];
 		LangFn *fn = get_fn(ctx, name);
 		if (!fn)
 		{
-			panic(ctx, rbt_errcode_no_such_fn, "no such function: `%s`", name);
+			panic(ctx, rbt_errcode_no_such_fn, "no such function: `%.*s`", name.len, name.s);
 			break;
 		}
-		log("run: %s\n", name);
+		log("run: %s\n", fn->name);
+		int slot = fn - ctx->fns;
+		unsigned long fuel = ctx->profile.total.fuel;
+		ctx->profile._fndepth[slot]++;
 		for (int i = 0 ; i < fn->_codelen ; i++)
 		{
 			eval_ins(state, ctx, renderer, fn->code[i]);
 		}
+		ctx->profile.fns[slot].count++;
+		if (--ctx->profile._fndepth[slot] == 0)
+			ctx->profile.fns[slot].fuel += ctx->profile.total.fuel - fuel;
 		break;
 		}
 	case rbt_op_if:
@@ -361,7 +462,7 @@ void eval_ins(State *state, LangContext *ctx, Renderer *renderer, struct rbt_ins
 		};
 		for (char **p = &ops[0] ; *p != NULL ; p++)
 		{
-			if (strcmp(*p, ins.args[1]) == 0)
+			if (slice_is(ins.args[1], *p))
 			{
 				op = p - &ops[0];
 				break;
@@ -369,7 +470,7 @@ void eval_ins(State *state, LangContext *ctx, Renderer *renderer, struct rbt_ins
 		}
 		if (op == -1)
 		{
-			panic(ctx, rbt_errcode_syn_invalid_op, "invalid operation: `%s`", ins.args[1]);
+			panic(ctx, rbt_errcode_syn_invalid_op, "invalid operation: `%.*s`", ins.args[1].len, ins.args[1].s);
 			break;
 		}
 		bool res = false;
@@ -384,7 +485,12 @@ void eval_ins(State *state, LangContext *ctx, Renderer *renderer, struct rbt_ins
 		}
 		if (res)
 		{
-			interpret(state, ctx, renderer, ins.args[3]);
+			/* the statement is the rest of the line, run it in place */
+			long pos = 0;
+			LangIns stmt = parse_ins(ctx, &pos, (char *)ins.args[3].s);
+			stmt.line = ins.line;
+			if (stmt.op != rbt_op_err)
+				eval_ins(state, ctx, renderer, stmt);
 		}
 		break;
 		}
@@ -394,36 +500,47 @@ void eval_ins(State *state, LangContext *ctx, Renderer *renderer, struct rbt_ins
 		int val = eval_val(ctx, ins.args[1]);
 		if (reg)
 		{
-			log("set %s = %d\n", ins.args[0], val);
+			log("set %.*s = %d\n", ins.args[0].len, ins.args[0].s, val);
 			*reg = val;
+			record_reg(ctx, reg, ins.line);
 		}
 		break;
 		}
 	case rbt_op_fn:
 		{
-		/* duplicate name since args get freed. */
-		int n = strlen(ins.args[0]);
-		char *name = malloc(n+1);
-		memcpy(&name[0], ins.args[0], n);
-		name[n] = '\0';
-
 		/* check if this function already exists */
-		LangFn *fn = get_fn(ctx, name);
+		LangFn *fn = get_fn(ctx, ins.args[0]);
 		if (fn)
 		{
-			panic(ctx, rbt_errcode_fn_exists, "function already exists: `%s`", name);
-			free(name);
+			panic(ctx, rbt_errcode_fn_exists, "function already exists: `%.*s`", ins.args[0].len, ins.args[0].s);
 			break;
 		}
+
+		if (ctx->_nfns == LANG_NFNS)
+		{
+			panic(ctx, rbt_errcode_internal, "too many functions (the limit is %d)", LANG_NFNS);
+			break;
+		}
+
+		/* the name outlives the program text */
+		int n = ins.args[0].len;
+		char *name = mem_alloc(MEM_LANG_PARSE, n+1);
+		memcpy(&name[0], ins.args[0].s, n);
+		name[n] = '\0';
 		fn = &ctx->fns[ctx->_nfns];
+		if (fn->name) /* stale definition left over from a rewind */
+		{
+			mem_free(fn->name);
+			mem_free(fn->code);
+		}
 		fn->name = name;
 		fn->_codelen = 0;
 		fn->_codecap = 32;
-		fn->code = malloc(fn->_codecap * sizeof(LangIns));
+		fn->code = mem_alloc(MEM_LANG_PARSE, fn->_codecap * sizeof(LangIns));
 		if (!fn->code)
 		{
 			panic(ctx, rbt_errcode_internal, "failed to create function");
-			free(name);
+			mem_free(name);
 			break;
 		}
 		ctx->_curfn = ctx->_nfns;
@@ -449,15 +566,138 @@ void eval_ins(State *state, LangContext *ctx, Renderer *renderer, struct rbt_ins
 		{
 		int *r = get_reg(ctx, ins.args[0]);
 		int n = eval_val(ctx, ins.args[1]);
+		if ((ins.op == rbt_op_div || ins.op == rbt_op_mod) && n == 0)
+		{
+			panic(ctx, rbt_errcode_div_by_zero, "%s by zero", rbt_optos[ins.op]);
+			break;
+		}
 		switch (ins.op)
 		{
 		case rbt_op_add: *r += n; break;
 		case rbt_op_sub: *r -= n; break;
 		case rbt_op_mul: *r *= n; break;
-		case rbt_op_div: *r /= n; break;
-		case rbt_op_mod: *r %= n; break;
+		/* INT_MIN / -1 overflows and traps like a division by zero */
+		case rbt_op_div: *r = (n == -1) ? (int)(0u - (unsigned)*r) : *r / n; break;
+		case rbt_op_mod: *r = (n == -1) ? 0 : *r % n; break;
 		default: break; /* unreachable */
 		}
+		record_reg(ctx, r, ins.line);
+		break;
+		}
+	case rbt_op_goto:
+	case rbt_op_seek:
+		{
+		PathKind kind = PATH_TARGET;
+		int tx = 0, ty = 0;
+		int *reg = NULL;
+		if (ins.op == rbt_op_goto)
+		{
+			tx = eval_val(ctx, ins.args[0]);
+			ty = eval_val(ctx, ins.args[1]);
+			if (!in_bounds(state->world, tx, ty))
+			{
+				panic(ctx, rbt_errcode_invalid_argument, "goto: %d %d is outside of the world", tx, ty);
+				break;
+			}
+			if (ins.args[2].s)
+				reg = get_reg(ctx, ins.args[2]);
+		}
+		else
+		{
+			int what = eval_val(ctx, ins.args[0]);
+			if (what != rbt_const_fuel && what != rbt_const_robot)
+			{
+				panic(ctx, rbt_errcode_invalid_argument, "seek expects argument to be either `fuel` or `robot`.");
+				break;
+			}
+			kind = what == rbt_const_fuel ? PATH_FUEL : PATH_ROBOTS;
+			if (ins.args[1].s)
+				reg = get_reg(ctx, ins.args[1]);
+		}
+
+		/* face the next tile on a shortest path and step onto it, except for
+		 * the enemy robot itself: being next to it and facing it is arriving */
+		Direction dir;
+		int dist = paths_toward(state, id, kind, tx, ty, &dir);
+		int arrive = kind == PATH_ROBOTS ? 1 : 0;
+		if (dist > 0)
+		{
+			if (rs->dir[id] != dir)
+			{
+				rs->dir[id] = dir;
+				play_sfx(SFX_ROTATING);
+				if (rv)
+					robot_visual_rotate_to(rv, dir);
+			}
+			if (dist > arrive)
+			{
+				if (robot_forward(state, id))
+				{
+					dist--;
+					play_sfx(SFX_ADVANCING);
+					if (rv)
+						robot_visual_move_to(rv, rs->x[id], rs->y[id]);
+				}
+				else if (rv && !robot_visual_is_animating(rv))
+					robot_visual_ram(rv, dir); /* someone is in the way */
+			}
+		}
+		if (reg)
+		{
+			*reg = dist == PATH_UNREACHABLE ? -1 : dist - arrive;
+			record_reg(ctx, reg, ins.line);
+		}
+		break;
+		}
+	case rbt_op_radar:
+		{
+		int *reg = get_reg(ctx, ins.args[0]);
+		int range = eval_val(ctx, ins.args[1]);
+		int kind = eval_val(ctx, ins.args[2]);
+		if (reg == &ctx->registers[LANG_NREGS - 1])
+		{
+			panic(ctx, rbt_errcode_invalid_argument, "radar also writes the register after `$%d`, use $0 to $%d", LANG_NREGS - 1, LANG_NREGS - 2);
+			break;
+		}
+		if (range < 1 || range > LANG_RADAR_RANGE)
+		{
+			panic(ctx, rbt_errcode_invalid_argument, "radar range must be from 1 to %d", LANG_RADAR_RANGE);
+			break;
+		}
+		const Bitset *bits;
+		switch (kind)
+		{
+		case rbt_const_wall:  bits = &state->world->walls; break;
+		case rbt_const_fuel:  bits = &state->world->energy; break;
+		case rbt_const_robot: bits = &state->world->robots; break;
+		default:
+			panic(ctx, rbt_errcode_invalid_argument, "radar expects the kind to be `wall`, `fuel` or `robot`.");
+			reg = NULL;
+			break;
+		}
+		if (!reg || reg < ctx->registers || reg >= ctx->registers + LANG_NREGS)
+			break;
+
+		/* the robot's own tile is always in the robots bits, so they start a
+		 * ring further out */
+		int x = rs->x[id], y = rs->y[id], nx = x, ny = y;
+		int dist = bitset_nearest(bits, x, y, kind == rbt_const_robot ? 1 : 0, range, &nx, &ny);
+		int dir = rbt_const_none;
+		if (dist > 0)
+		{
+			int dx = nx - x, dy = ny - y;
+			if (abs(dx) > abs(dy))
+				dir = dx > 0 ? rbt_const_east : rbt_const_west;
+			else
+				dir = dy > 0 ? rbt_const_south : rbt_const_north;
+		}
+		reg[0] = dist;
+		reg[1] = dir;
+		record_reg(ctx, &reg[0], ins.line);
+		record_reg(ctx, &reg[1], ins.line);
+
+		if (renderer)
+			renderer_reveal(renderer, x - range, y - range, x + range + 1, y + range + 1);
 		break;
 		}
 	default:
@@ -466,58 +706,39 @@ void eval_ins(State *state, LangContext *ctx, Renderer *renderer, struct rbt_ins
 	}
 }
 
+static
+bool slice_is(LangSlice sl, const char *s)
+{
+	return sl.s && (int)strlen(s) == sl.len && strncmp(sl.s, s, sl.len) == 0;
+}
+
 static
 struct rbt_instruction parse_ins(LangContext *ctx, long *index, char *program)
 {
-	unsigned lineno = 0;
-	long start = *index;
-	char *ch = &program[*index];
+	const char *ch = &program[*index];
 
 	struct rbt_instruction ins = { .op=rbt_op_err };
 
-#	define advance() (++(*index), ++ch)
-
 	/* skip whitespace and comments */
 	for (;;)
 	{
-		switch (*ch)
-		{
-		case ';':
-			while (*ch != '\n')
-				advance();
+		ch = scan_blank(ch);
+		if (*ch != ';')
 			break;
-		case ' ':
-		case '\t':
-		case '\r':
-			advance();
-			break;
-		case '\n':
-			advance();
-			lineno++;
-			break;
-		case '\0':
-			*index = -1;
-			return ins;
-		default:
-			goto done_skipping_ws;
-		}
+		ch = scan_line_end(ch);
 	}
-done_skipping_ws:
-
-	{ /* parse operation */
-	char *startch = ch;
-	char *s = malloc(LANG_ARGBUFSIZ);
-	memset(s, 0, LANG_ARGBUFSIZ);
-	int n = 0;
-	while (isgraph(*ch))
+	if (*ch == '\0')
 	{
-		s[n++] = *ch;
-		advance();
+		*index = -1;
+		return ins;
 	}
-	s[n] = '\0';
+
+	{ /* parse operation */
+	LangSlice op = { ch, scan_word_end(ch) - ch };
+	ch += op.len;
 	for (char **op_str = &rbt_optos[0] ; *op_str != NULL ; op_str++)
 	{
-		if (strcmp(s, *op_str) == 0)
+		if (slice_is(op, *op_str))
 		{
 			int i = op_str - &rbt_optos[0];
 			ins.op = (enum rbt_op)i;
@@ -526,91 +747,285 @@ done_skipping_ws:
 	}
 	if (ins.op == rbt_op_err)
 	{
-		panic(ctx, rbt_errcode_syn_invalid_op, "no such operation `%s`", s);
+		panic(ctx, rbt_errcode_syn_invalid_op, "no such operation `%.*s`", op.len, op.s);
+		*index = ch - program;
 		return ins;
 	}
-	free(s);
 	} /* parse operation */
 
 	{ /* parse arguments */
 	int i = 0;
-	for (i = 0 ; i < LANG_MAXARGC ; i++)
-		ins.args[i] = NULL;
-	i = 0;
-	bool literal = false;
-	while (*ch != '\n')
-	{
-		/* skip whitespace */
-		while (isspace(*ch))
-			advance(); /* eat spaces */
+	bool literal = false, too_many = false;
+	while (*ch != '\n' && *ch != '\0')
+	{
+		/* skip whitespace, but not onto the next line */
+		while (isspace(*ch) && *ch != '\n')
+			ch++;
 		if (*ch == '\n' || *ch == '\0')
-			return ins;
+			break;
 
-		/* read argument */
-		char *arg = malloc(LANG_ARGBUFSIZ);
-		memset(arg, 0, LANG_ARGBUFSIZ);
-		int n = 0;
-		if (literal)
-		{
-			while (*ch != '\n' && *ch != '\0')
-			{
-				arg[n++] = *ch;
-				advance();
-			}
-		}
-		else
-		{
-			while (isgraph(*ch) && *ch != '\0')
-			{
-				arg[n++] = *ch;
-				advance();
-			}
-		}
-		/* anything after `then` or `:` is literal */
-		if (strcmp(arg, "then") == 0 || strcmp(arg, ":") == 0)
+		/* read argument, anything after `then` or `:` is literal */
+		const char *end = literal ? scan_line_end(ch) : scan_word_end(ch);
+		LangSlice arg = { ch, end - ch };
+		ch = end;
+		if (!literal && (slice_is(arg, "then") || slice_is(arg, ":")))
 		{
 			literal = true;
-			free(arg);
 			continue;
 		}
-		ins.args[i++] = arg;
 
 		/* bounds check */
-		if (i > LANG_MAXARGC)
+		if (i == LANG_MAXARGC)
 		{
-			fprintf(stderr, "error: maximum arguments for an instruction is %d", LANG_MAXARGC);
-			while (*ch != '\n')
-				advance();
-			return ins;
+			too_many = true;
+			ch = scan_line_end(ch);
+			break;
 		}
+		ins.args[i++] = arg;
 	}
-	} /* parse arguments */
+	*index = ch - program;
 
-	/* todo: check that enough arguments were provided or print error with usage message. */
+	/* check the argument count against the usage table */
+	struct rbt_opinfo *info = &rbt_ops[ins.op];
+	if (too_many || i > info->argc || i < info->argc - info->optargs)
+	{
+		if (info->optargs)
+			panic(ctx, rbt_errcode_syn_arity, "`%s` takes %d to %d arguments, usage: `%s`", rbt_optos[ins.op], info->argc - info->optargs, info->argc, info->usage);
+		else
+			panic(ctx, rbt_errcode_syn_arity, "`%s` takes %d argument%s, usage: `%s`", rbt_optos[ins.op], info->argc, info->argc == 1 ? "" : "s", info->usage);
+		return (struct rbt_instruction){ .op=rbt_op_err };
+	}
+	} /* parse arguments */
 
 	return ins;
-
-#	undef advance
 }
 
 static
 void print_ins(struct rbt_instruction ins)
 {
 	printf("%s", rbt_optos[ins.op]);
-	for (int i = 0 ; i < LANG_MAXARGC && ins.args[i] ; i++)
+	for (int i = 0 ; i < LANG_MAXARGC && ins.args[i].s ; i++)
 	{
-		printf(" `%s`", ins.args[i]);
+		printf(" `%.*s`", ins.args[i].len, ins.args[i].s);
 	}
 	printf("\n");
 }
 
 static
-void del_ins(struct rbt_instruction ins)
+void add_tok(LangLine *out, LangTokKind kind, int start, int len)
+{
+	if (out->ntokens < LANG_MAXTOKENS)
+		out->tokens[out->ntokens++] = (LangToken){ kind, start, len };
+}
+
+static
+void line_error(LangLine *out, LangErr err, int start, int len)
+{
+	if (out->errored) /* keep the first */
+		return;
+	out->errored = true;
+	out->err = err;
+	out->err_start = start;
+	out->err_len = len;
+}
+
+/* Find the next word in `s[*pos..len)`. Returns its start, or -1 at the end. */
+static
+int next_word(const char *s, int len, int *pos, int *wlen)
 {
-	for (int i = 0 ; i < LANG_MAXARGC && ins.args[i] ; i++)
+	int i = *pos;
+	while (i < len && isspace((unsigned char)s[i]))
+		i++;
+	if (i >= len)
+		return -1;
+	int start = i;
+	while (i < len && isgraph((unsigned char)s[i]))
+		i++;
+	*wlen = i - start;
+	*pos = i;
+	return start;
+}
+
+static
+bool word_is(const char *w, int wlen, const char *s)
+{
+	return (int)strlen(s) == wlen && strncmp(w, s, wlen) == 0;
+}
+
+static
+int find_word(char **table, const char *w, int wlen)
+{
+	for (char **p = &table[0] ; *p != NULL ; p++)
+		if (word_is(w, wlen, *p))
+			return p - &table[0];
+	return -1;
+}
+
+/* Check one argument against a word of the op's usage string. */
+static
+void check_arg(const char *w, int wlen, int start, const char *uw, int ulen, LangLine *out)
+{
+	static char *compare_ops[] = { "==", "!=", ">", "<", ">=", "<=", NULL };
+
+	if (uw[0] == '[') /* optional, same rules */
+	{
+		uw++;
+		ulen -= 2;
+	}
+
+	bool is_reg = w[0] == '$' && wlen > 1;
+	for (int i = 1 ; is_reg && i < wlen ; i++)
+		is_reg = isdigit((unsigned char)w[i]);
+	if (is_reg && strtol(w + 1, NULL, 10) >= LANG_NREGS)
+		is_reg = false;
+
+	if (word_is(uw, ulen, "REGISTER"))
+	{
+		add_tok(out, is_reg ? rbt_tok_register : rbt_tok_error, start, wlen);
+		if (!is_reg)
+			line_error(out, rbt_errcode_syn_register, start, wlen);
+	}
+	else if (word_is(uw, ulen, "VALUE") || word_is(uw, ulen, "N") || word_is(uw, ulen, "X") || word_is(uw, ulen, "Y"))
+	{
+		if (w[0] == '$')
+		{
+			add_tok(out, is_reg ? rbt_tok_register : rbt_tok_error, start, wlen);
+			if (!is_reg)
+				line_error(out, rbt_errcode_syn_register, start, wlen);
+		}
+		else if (isalpha((unsigned char)w[0]))
+		{
+			bool known = find_word(rbt_consttos, w, wlen) >= 0;
+			add_tok(out, known ? rbt_tok_const : rbt_tok_error, start, wlen);
+			if (!known)
+				line_error(out, rbt_errcode_syn_unknown_const, start, wlen);
+		}
+		else if (isdigit((unsigned char)w[0]) || w[0] == '-')
+			add_tok(out, rbt_tok_number, start, wlen);
+		else
+		{
+			add_tok(out, rbt_tok_error, start, wlen);
+			line_error(out, rbt_errcode_syn_invalid_value, start, wlen);
+		}
+	}
+	else if (word_is(uw, ulen, "OPERATION"))
 	{
-		free(ins.args[i]);
-		ins.args[i] = NULL;
+		bool known = find_word(compare_ops, w, wlen) >= 0;
+		add_tok(out, known ? rbt_tok_keyword : rbt_tok_error, start, wlen);
+		if (!known)
+			line_error(out, rbt_errcode_syn_invalid_op, start, wlen);
+	}
+	else if (memchr(uw, '|', ulen))
+	{
+		/* one of a fixed set of words, e.g. `cw|ccw` */
+		bool known = false;
+		for (const char *alt = uw ; !known && alt < uw + ulen ; )
+		{
+			const char *bar = memchr(alt, '|', uw + ulen - alt);
+			int altlen = (bar ? bar : uw + ulen) - alt;
+			known = altlen == wlen && strncmp(alt, w, wlen) == 0;
+			alt += altlen + 1;
+		}
+		add_tok(out, known ? rbt_tok_const : rbt_tok_error, start, wlen);
+		if (!known)
+			line_error(out, rbt_errcode_invalid_argument, start, wlen);
+	}
+	else /* NAME, FUNCTION */
+		add_tok(out, rbt_tok_name, start, wlen);
+}
+
+/* Check the statement in `line[pos..len)`. Statements nest through `if ... then`. */
+static
+void check_statement(const char *line, int pos, int len, LangLine *out, bool top)
+{
+	int wlen;
+	int start = next_word(line, len, &pos, &wlen);
+	if (start < 0)
+		return;
+	if (line[start] == ';')
+	{
+		add_tok(out, rbt_tok_comment, start, len - start);
+		return;
+	}
+
+	int op = find_word(rbt_optos, line + start, wlen);
+	if (op <= rbt_op_err)
+	{
+		add_tok(out, rbt_tok_error, start, wlen);
+		line_error(out, rbt_errcode_syn_invalid_op, start, wlen);
+		return;
+	}
+	if (top)
+		out->op = op;
+	add_tok(out, rbt_tok_op, start, wlen);
+	int op_start = start, op_len = wlen;
+
+	/* walk the usage string alongside the arguments */
+	const char *usage = rbt_ops[op].usage;
+	int ulen = strlen(usage), upos = 0, uwlen;
+	next_word(usage, ulen, &upos, &uwlen); /* the op itself */
+	for (int ustart ; (ustart = next_word(usage, ulen, &upos, &uwlen)) >= 0 ; )
+	{
+		const char *uw = usage + ustart;
+		if (word_is(uw, uwlen, "STATEMENT"))
+		{
+			int peek = pos;
+			if (next_word(line, len, &peek, &wlen) < 0)
+				line_error(out, rbt_errcode_syn_arity, op_start, op_len);
+			check_statement(line, pos, len, out, false);
+			return;
+		}
+
+		start = next_word(line, len, &pos, &wlen);
+		if (start < 0)
+		{
+			if (uw[0] != '[')
+				line_error(out, rbt_errcode_syn_arity, op_start, op_len);
+			return;
+		}
+		if (word_is(uw, uwlen, "then"))
+		{
+			bool ok = word_is(line + start, wlen, "then") || word_is(line + start, wlen, ":");
+			add_tok(out, ok ? rbt_tok_keyword : rbt_tok_error, start, wlen);
+			if (!ok)
+				line_error(out, rbt_errcode_syn_arity, start, wlen);
+			continue;
+		}
+		check_arg(line + start, wlen, start, uw, uwlen, out);
+	}
+
+	/* anything left over is one argument too many */
+	start = next_word(line, len, &pos, &wlen);
+	if (start >= 0)
+	{
+		add_tok(out, rbt_tok_error, start, len - start);
+		line_error(out, rbt_errcode_syn_arity, start, len - start);
+	}
+}
+
+void lang_check_line(const char *line, int len, LangLine *out)
+{
+	*out = (LangLine){ .op=rbt_op_err };
+	check_statement(line, 0, len, out, true);
+}
+
+const char *lang_strerror(LangErr code)
+{
+	switch (code)
+	{
+	case rbt_errcode_internal:           return "internal error";
+	case rbt_errcode_syn_register:       return "bad register, use $0 to $15";
+	case rbt_errcode_syn_unknown_const:  return "unknown constant";
+	case rbt_errcode_syn_invalid_value:  return "invalid value";
+	case rbt_errcode_syn_invalid_op:     return "invalid operation";
+	case rbt_errcode_syn_fn_in_fn:       return "function inside a function";
+	case rbt_errcode_syn_end_outside_fn: return "end outside of a function";
+	case rbt_errcode_syn_arity:          return "wrong number of arguments";
+	case rbt_errcode_no_such_fn:         return "no such function";
+	case rbt_errcode_fn_exists:          return "function already exists";
+	case rbt_errcode_invalid_argument:   return "invalid argument";
+	case rbt_errcode_div_by_zero:        return "division by zero";
+	default:                             return "unknown error";
 	}
 }
 
@@ -643,7 +1058,7 @@ char *read_program(char *path)
 	unsigned long fs = ftell(fp);
 	fseek(fp, 0, SEEK_SET);
 	/* read file into buffer */
-	char *s = malloc(fs+1);
+	char *s = mem_alloc(MEM_LANG_PARSE, fs+1);
 	if (!s)
 	{
 		fclose(fp);
@@ -653,7 +1068,7 @@ char *read_program(char *path)
 	if (fread(&s[0], 1, fs, fp) != fs)
 	{
 		fclose(fp);
-		free(s);
+		mem_free(s);
 		fprintf(stderr, "error: failed to read `%s`", path);
 		return NULL;
 	}
@@ -663,35 +1078,117 @@ char *read_program(char *path)
 	return s;
 }
 
+char *load_program(char *path, LangMapping *map)
+{
+	*map = (LangMapping){0};
+
+	/* The mapping has to end inside a page so the zero fill past the end
+	 * of the file terminates the text. Small files aren't worth mapping. */
+	struct stat st;
+	long page = sysconf(_SC_PAGESIZE);
+	if (!lang_map_programs || stat(path, &st) != 0 || st.st_size < LANG_MMAP_MIN || st.st_size % page == 0)
+		return read_program(path);
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return read_program(path);
+	char *text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (text == MAP_FAILED)
+		return read_program(path);
+
+	map->size = st.st_size;
+	map->ino = st.st_ino;
+	return text;
+}
+
+void unload_program(char *program, LangMapping *map)
+{
+	if (map->size)
+		munmap(program, map->size);
+	else
+		mem_free(program);
+	*map = (LangMapping){0};
+}
+
 LangStepper *make_stepper(int robot_id, char *program)
 {
+	LangMapping map = {0};
 	if (!program)
 	{
-		program = read_program(DEFAULT_PROGRAM_PATH);
+		program = load_program(DEFAULT_PROGRAM_PATH, &map);
 		log("step interp: %s\n", program);
 	}
-	LangStepper *ls = malloc(sizeof(*ls));
+	LangStepper *ls = mem_alloc(MEM_LANG_RUNTIME, sizeof(*ls));
 	ls->child = false;
 	ls->ctx = new_context(robot_id);
 	ls->program = program;
+	ls->_map = map;
 	ls->n = 0;
 	ls->_lexpos = 0;
+	ls->_line = 1;
+	ls->_linepos = 0;
 	return ls;
 }
 
 static
 LangStepper *make_child_stepper(LangContext *ctx, char *program)
 {
-	LangStepper *ls = malloc(sizeof(*ls));
+	LangStepper *ls = mem_alloc(MEM_LANG_RUNTIME, sizeof(*ls));
 	ls->child = true;
 	ls->ctx = ctx;
 	ls->program = program;
+	ls->_map = (LangMapping){0};
 	ls->n = 0;
 	ls->_lexpos = 0;
+	ls->_line = 1;
+	ls->_linepos = 0;
 	return ls;
 }
 
+/* Number of newlines in text[from, to). */
+static
+int count_lines(const char *text, long from, long to)
+{
+	int n = 0;
+	const char *p = &text[from], *end = &text[to];
+	while (p < end && (p = memchr(p, '\n', end - p)))
+	{
+		n++;
+		p++;
+	}
+	return n;
+}
+
+/* Line of the instruction that ends at `pos`. Instructions never span lines,
+ * so this only counts the newlines since the last instruction, unless the
+ * stepper was moved back by a rewind. */
+static
+int stepper_line(LangStepper *ls, long pos)
+{
+	if (pos < ls->_linepos)
+	{
+		ls->_line = 1;
+		ls->_linepos = 0;
+	}
+	ls->_line += count_lines(ls->program, ls->_linepos, pos);
+	ls->_linepos = pos;
+	return ls->_line;
+}
+
+static
+bool stepper_next(State *state, LangStepper *ls, Renderer *renderer);
+
 bool stepper_step(State *state, LangStepper *ls, Renderer *renderer)
+{
+	unsigned long long traced = trace_begin();
+	bool more = stepper_next(state, ls, renderer);
+	trace_end(traced, "lang", "stepper_step");
+	return more;
+}
+
+static
+bool stepper_next(State *state, LangStepper *ls, Renderer *renderer)
 {
 	if (ls->_lexpos == -1)
 		return false;
@@ -699,7 +1196,13 @@ bool stepper_step(State *state, LangStepper *ls, Renderer *renderer)
 	if (!ls->ctx->_renderer)
 		ls->ctx->_renderer = renderer;
 
+	/* a fresh run starts a fresh journal */
+	bool journaled = state->journal && !ls->child;
+	if (journaled && ls->n == 0)
+		journal_begin(state->journal, state);
+
 	ls->n++;
+	flight_record(FLIGHT_STEP, 0, ls->ctx->robot, 0, 0, 0, ls->n);
 	LangIns ins;
 	/* loop so that we can "skip" function definitions */
 	while (ls->_lexpos != -1)
@@ -707,6 +1210,7 @@ bool stepper_step(State *state, LangStepper *ls, Renderer *renderer)
 		ins = parse_ins(ls->ctx, &ls->_lexpos, ls->program);
 		if (ins.op == rbt_op_err)
 			break;
+		ins.line = stepper_line(ls, ls->_lexpos);
 
 		if (ls->ctx->_curfn > -1 && ins.op != rbt_op_end)
 		{
@@ -721,7 +1225,7 @@ bool stepper_step(State *state, LangStepper *ls, Renderer *renderer)
 			{
 				int newcap = fn->_codecap * 2;
 				log("growing list: %d->%d\n", fn->_codecap, newcap);
-				LangIns *newcode = realloc(fn->code, newcap * sizeof(LangIns));
+				LangIns *newcode = mem_realloc(MEM_LANG_PARSE, fn->code, newcap * sizeof(LangIns));
 				if (!newcode)
 				{
 					panic(ls->ctx, rbt_errcode_internal, "failed to grow array for function code");
@@ -740,12 +1244,13 @@ bool stepper_step(State *state, LangStepper *ls, Renderer *renderer)
 				return false;
 
 			int op = ins.op;
-			del_ins(ins);
 
 			/* We want to "skip" over functions completely. */
 			if (op == rbt_op_fn || op == rbt_op_end)
 				continue;
 
+			if (journaled)
+				journal_record(state->journal, state);
 			return true;
 		}
 	}
@@ -753,18 +1258,419 @@ bool stepper_step(State *state, LangStepper *ls, Renderer *renderer)
 	return false;
 }
 
+/* Restart a stepper on `program`, which it takes ownership of. */
+static
+void stepper_restart(LangStepper *ls, char *program, LangMapping *map)
+{
+	LangContext *old = ls->ctx;
+	ls->ctx = new_context(old->robot);
+	ls->ctx->prints = old->prints; /* the output outlives the run */
+	del_context(old);
+	unload_program(ls->program, &ls->_map);
+	ls->program = program;
+	ls->_map = *map;
+	ls->n = 0;
+	ls->_lexpos = 0;
+	ls->_line = 1;
+	ls->_linepos = 0;
+}
+
 void stepper_reload(LangStepper *ls)
 {
+	unsigned long long traced = trace_begin();
 	if (!ls->child)
 	{
-		int r = ls->ctx->robot;
-		del_context(ls->ctx);
-		free(ls->program);
-		ls->ctx = new_context(r);
-		ls->program = read_program(DEFAULT_PROGRAM_PATH);
+		LangMapping map;
+		char *program = load_program(DEFAULT_PROGRAM_PATH, &map);
+		stepper_restart(ls, program, &map);
 	}
-	ls->n = 0;
-	ls->_lexpos = 0;
+	else
+	{
+		ls->n = 0;
+		ls->_lexpos = 0;
+		ls->_line = 1;
+		ls->_linepos = 0;
+	}
+	trace_end(traced, "lang", "stepper_reload");
+}
+
+
+/* A top-level `fn ... end` block, found by scanning the text line by line. */
+typedef struct
+{
+	const char *name;
+	int namelen;
+	long start, end; /* from the start of the `fn` line to just past the `end` line */
+	long outpos;     /* number of characters outside of blocks that precede it */
+} FnSpan;
+
+/* Read the first word of the line at `*pos` and move `*pos` to the next line. */
+static
+const char *line_word(const char *text, long *pos, int *len)
+{
+	const char *p = &text[*pos];
+	while (*p == ' ' || *p == '\t' || *p == '\r')
+		p++;
+	const char *word = p;
+	while (isgraph(*p) && !(p == word && *p == ';'))
+		p++;
+	*len = p - word;
+
+	while (*p && *p != '\n')
+		p++;
+	if (*p == '\n')
+		p++;
+	*pos = p - text;
+	return word;
+}
+
+/* Find every function block. Returns -1 if there are too many or a block is not closed. */
+static
+int scan_fns(const char *text, FnSpan *spans, int max)
+{
+	int n = 0;
+	long pos = 0, outpos = 0;
+	while (text[pos])
+	{
+		long start = pos;
+		int len;
+		const char *word = line_word(text, &pos, &len);
+		if (len != 2 || strncmp(word, "fn", 2) != 0)
+		{
+			outpos += pos - start;
+			continue;
+		}
+		if (n == max)
+			return -1;
+
+		FnSpan *sp = &spans[n++];
+		sp->start = start;
+		sp->outpos = outpos;
+		sp->name = word + 2;
+		while (*sp->name == ' ' || *sp->name == '\t')
+			sp->name++;
+		for (sp->namelen = 0 ; isgraph(sp->name[sp->namelen]) ; sp->namelen++) ;
+
+		do
+		{
+			if (!text[pos])
+				return -1;
+			word = line_word(text, &pos, &len);
+		} while (len != 3 || strncmp(word, "end", 3) != 0);
+		sp->end = pos;
+	}
+	return n;
+}
+
+static
+FnSpan *find_span(FnSpan *spans, int n, const char *name)
+{
+	for (int i = 0 ; i < n ; i++)
+	{
+		if ((int)strlen(name) == spans[i].namelen && strncmp(spans[i].name, name, spans[i].namelen) == 0)
+			return &spans[i];
+	}
+	return NULL;
+}
+
+/* True if the text outside of function blocks is the same in both programs. */
+static
+bool same_outside(const char *a, FnSpan *as, int na, const char *b, FnSpan *bs, int nb)
+{
+	long i = 0, j = 0;
+	int si = 0, sj = 0;
+	for (;;)
+	{
+		if (si < na && i == as[si].start)
+			i = as[si++].end;
+		else if (sj < nb && j == bs[sj].start)
+			j = bs[sj++].end;
+		else if (a[i] != b[j])
+			return false;
+		else if (!a[i])
+			return true;
+		else
+			i++, j++;
+	}
+}
+
+/* Parse a function block into fresh code. */
+static
+bool compile_fn(LangContext *ctx, const char *program, FnSpan *sp, LangFn *out)
+{
+	long pos = sp->start;
+	parse_ins(ctx, &pos, (char *)program); /* the `fn NAME` line */
+	int line = 1 + count_lines(program, 0, pos);
+	long linepos = pos;
+
+	*out = (LangFn){ ._codecap=32 };
+	out->code = mem_alloc(MEM_LANG_PARSE, out->_codecap * sizeof(LangIns));
+	for (;;)
+	{
+		LangIns ins = parse_ins(ctx, &pos, (char *)program);
+		if (ins.op == rbt_op_end)
+			return true;
+		if (ins.op == rbt_op_err || ins.op == rbt_op_fn || ctx->errored)
+			break;
+		line += count_lines(program, linepos, pos);
+		linepos = pos;
+		ins.line = line;
+		if (out->_codelen == out->_codecap)
+		{
+			out->_codecap *= 2;
+			out->code = mem_realloc(MEM_LANG_PARSE, out->code, out->_codecap * sizeof(LangIns));
+		}
+		out->code[out->_codelen++] = ins;
+	}
+
+	mem_free(out->code);
+	return false;
+}
+
+/* Swap `program` into the stepper without restarting it. Only function
+ * blocks may differ from the running program: changed functions that were
+ * already defined are recompiled, new ones that sit before the stepper's
+ * position are defined, and everything else is picked up as the stepper
+ * reaches it. */
+static
+bool patch_program(LangStepper *ls, char *program, LangMapping *map)
+{
+	static FnSpan old[LANG_NFNS], new[LANG_NFNS];
+	LangContext *ctx = ls->ctx;
+	if (ctx->_curfn != -1 || ctx->errored)
+		return false;
+
+	int nold = scan_fns(ls->program, old, LANG_NFNS);
+	int nnew = scan_fns(program, new, LANG_NFNS);
+	if (nold < 0 || nnew < 0 || !same_outside(ls->program, old, nold, program, new, nnew))
+		return false;
+
+	/* the position as a count of characters outside of function blocks */
+	long off = ls->_lexpos;
+	for (int i = 0 ; off != -1 && i < nold && old[i].end <= ls->_lexpos ; i++)
+		off -= old[i].end - old[i].start;
+
+	/* every live function must still exist */
+	for (int i = 0 ; i < ctx->_nfns ; i++)
+		if (!find_span(new, nnew, ctx->fns[i].name))
+			return false;
+
+	/* Blocks before the position count as already run. A block at the
+	 * position itself only does if it is already defined. */
+	int before = 0;
+	while (before < nnew && (off == -1 || new[before].outpos < off))
+		before++;
+	while (before < nnew && off != -1 && new[before].outpos == off &&
+		get_fn(ctx, (LangSlice){ new[before].name, new[before].namelen }))
+		before++;
+
+	/* compile everything first so a syntax error leaves the stepper untouched */
+	int ndefs = 0, nmoved = 0;
+	struct { LangFn *fn; LangFn code; char *name; } defs[LANG_NFNS];
+	struct { LangFn *fn; long from, to; } moved[LANG_NFNS];
+	bool ok = true;
+	for (int i = 0 ; ok && i < nnew ; i++)
+	{
+		LangFn *fn = get_fn(ctx, (LangSlice){ new[i].name, new[i].namelen });
+		FnSpan *prev = fn ? find_span(old, nold, fn->name) : NULL;
+
+		if (i >= before)
+		{
+			/* not reached yet, must not be defined either */
+			ok = fn == NULL;
+			continue;
+		}
+		if (fn && prev &&
+			prev->end - prev->start == new[i].end - new[i].start &&
+			memcmp(ls->program + prev->start, program + new[i].start, prev->end - prev->start) == 0)
+		{
+			/* unchanged, but its code points into the old text */
+			moved[nmoved].fn = fn;
+			moved[nmoved].from = prev->start;
+			moved[nmoved].to = new[i].start;
+			nmoved++;
+			continue;
+		}
+		if (!fn && ctx->_nfns + ndefs >= LANG_NFNS)
+		{
+			ok = false;
+			continue;
+		}
+
+		defs[ndefs].fn = fn;
+		defs[ndefs].name = NULL;
+		if (!fn)
+		{
+			defs[ndefs].name = mem_alloc(MEM_LANG_PARSE, new[i].namelen + 1);
+			memcpy(defs[ndefs].name, new[i].name, new[i].namelen);
+			defs[ndefs].name[new[i].namelen] = '\0';
+		}
+		if (compile_fn(ctx, program, &new[i], &defs[ndefs].code))
+			ndefs++;
+		else
+		{
+			mem_free(defs[ndefs].name);
+			ok = false;
+		}
+	}
+	if (!ok)
+	{
+		for (int i = 0 ; i < ndefs ; i++)
+		{
+			mem_free(defs[i].name);
+			mem_free(defs[i].code.code);
+		}
+		return false;
+	}
+
+	for (int i = 0 ; i < ndefs ; i++)
+	{
+		LangFn *fn = defs[i].fn;
+		if (fn)
+			mem_free(fn->code);
+		else
+		{
+			fn = &ctx->fns[ctx->_nfns++];
+			if (fn->name) /* stale definition left over from a rewind */
+			{
+				mem_free(fn->name);
+				mem_free(fn->code);
+			}
+			fn->name = defs[i].name;
+		}
+		fn->code = defs[i].code.code;
+		fn->_codelen = defs[i].code._codelen;
+		fn->_codecap = defs[i].code._codecap;
+	}
+
+	for (int i = 0 ; i < nmoved ; i++)
+	{
+		LangFn *fn = moved[i].fn;
+		int lines = count_lines(program, 0, moved[i].to) - count_lines(ls->program, 0, moved[i].from);
+		for (int j = 0 ; j < fn->_codelen ; j++)
+		{
+			fn->code[j].line += lines;
+			for (int k = 0 ; k < LANG_MAXARGC && fn->code[j].args[k].s ; k++)
+				fn->code[j].args[k].s = program + moved[i].to + (fn->code[j].args[k].s - (ls->program + moved[i].from));
+		}
+	}
+	/* slots left over from a rewind still point into the old text */
+	for (int i = ctx->_nfns ; i < LANG_NFNS && ctx->fns[i].name ; i++)
+	{
+		mem_free(ctx->fns[i].name);
+		mem_free(ctx->fns[i].code);
+		ctx->fns[i] = (LangFn){0};
+	}
+
+	if (off != -1)
+	{
+		long pos = off;
+		for (int i = 0 ; i < before ; i++)
+			pos += new[i].end - new[i].start;
+		ls->_lexpos = pos;
+	}
+	unload_program(ls->program, &ls->_map);
+	ls->program = program;
+	ls->_map = *map;
+	ls->_line = 1;
+	ls->_linepos = 0;
+
+	/* the lines profiled so far belong to the old text */
+	mem_free(ctx->profile.lines);
+	ctx->profile = (LangProfile){0};
+	return true;
+}
+
+bool stepper_patch(LangStepper *ls)
+{
+	if (ls->child)
+		return false;
+
+	/* A mapping sees writes made to its file in place, so the old text is
+	 * gone and there is nothing to diff against. */
+	struct stat st;
+	bool stale = ls->_map.size && stat(DEFAULT_PROGRAM_PATH, &st) == 0 && st.st_ino == ls->_map.ino;
+
+	LangMapping map;
+	char *program = load_program(DEFAULT_PROGRAM_PATH, &map);
+	if (!program)
+		return true; /* keep the old program */
+	if (!stale && ls->program && strcmp(ls->program, program) == 0)
+	{
+		unload_program(program, &map);
+		return true;
+	}
+	if (!stale && ls->program && patch_program(ls, program, &map))
+		return true;
+
+	stepper_restart(ls, program, &map);
+	return false;
+}
+
+
+typedef struct
+{
+	LangHits hits;
+	int index; /* line - 1 or function slot */
+} ProfileRow;
+
+static
+int by_fuel(const void *a, const void *b)
+{
+	const ProfileRow *x = a, *y = b;
+	if (x->hits.fuel != y->hits.fuel)
+		return x->hits.fuel < y->hits.fuel ? 1 : -1;
+	if (x->hits.count != y->hits.count)
+		return x->hits.count < y->hits.count ? 1 : -1;
+	return x->index - y->index;
+}
+
+void stepper_profile_report(LangStepper *ls, FILE *fp)
+{
+	LangContext *ctx = ls->ctx;
+	LangProfile *p = &ctx->profile;
+	fprintf(fp, "profile: %lu instructions, %lu fuel\n", p->total.count, p->total.fuel);
+
+	int n = 0, cap = p->nlines > ctx->_nfns ? p->nlines : ctx->_nfns;
+	ProfileRow *rows = mem_alloc(MEM_LANG_RUNTIME, (cap + 1) * sizeof(*rows));
+
+	for (int i = 0 ; i < p->nlines ; i++)
+		if (p->lines[i].count)
+			rows[n++] = (ProfileRow){ p->lines[i], i };
+	qsort(rows, n, sizeof(*rows), by_fuel);
+
+	/* quote each line from the program text */
+	const char **starts = mem_alloc(MEM_LANG_RUNTIME, (p->nlines + 1) * sizeof(*starts));
+	const char *text = ls->program ? ls->program : "";
+	for (int i = 0 ; i < p->nlines ; i++)
+	{
+		starts[i] = text;
+		text = scan_line_end(text);
+		if (*text)
+			text++;
+	}
+	fprintf(fp, "\n%8s %8s %6s  %s\n", "fuel", "count", "line", "source");
+	for (int k = 0 ; k < n ; k++)
+	{
+		const char *src = starts[rows[k].index];
+		while (*src == ' ' || *src == '\t')
+			src++;
+		fprintf(fp, "%8lu %8lu %6d  %.*s\n", rows[k].hits.fuel, rows[k].hits.count, rows[k].index + 1,
+			(int)(scan_line_end(src) - src), src);
+	}
+
+	n = 0;
+	for (int i = 0 ; i < ctx->_nfns ; i++)
+		if (p->fns[i].count && ctx->fns[i].name)
+			rows[n++] = (ProfileRow){ p->fns[i], i };
+	qsort(rows, n, sizeof(*rows), by_fuel);
+	if (n)
+		fprintf(fp, "\n%8s %8s  %s\n", "fuel", "calls", "function");
+	for (int k = 0 ; k < n ; k++)
+		fprintf(fp, "%8lu %8lu  %s\n", rows[k].hits.fuel, rows[k].hits.count, ctx->fns[rows[k].index].name);
+
+	mem_free(starts);
+	mem_free(rows);
 }
 
 void del_stepper(LangStepper *ls)
@@ -772,9 +1678,9 @@ void del_stepper(LangStepper *ls)
 	if (!ls->child)
 	{
 		del_context(ls->ctx);
-		free(ls->program);
+		unload_program(ls->program, &ls->_map);
 	}
-	free(ls);
+	mem_free(ls);
 }
 
 void interpret(State *state, LangContext *ctx, Renderer *renderer, char *program)
@@ -786,7 +1692,7 @@ void interpret(State *state, LangContext *ctx, Renderer *renderer, char *program
 
 LangContext *new_context(int robot_id)
 {
-	LangContext *c = calloc(1, sizeof(*c));
+	LangContext *c = mem_calloc(MEM_LANG_RUNTIME, 1, sizeof(*c));
 	c->robot = robot_id;
 	c->_curfn = -1;
 	return c;
@@ -798,13 +1704,56 @@ void del_context(LangContext *c)
 	{
 		if (c->fns[i].name)
 		{
-			free(c->fns[i].name);
+			mem_free(c->fns[i].name);
 			c->fns[i].name = NULL;
-			for (int j = 0 ; j < c->fns[i]._codelen ; j++)
-				del_ins(c->fns[i].code[j]);
-			free(c->fns[i].code);
+			mem_free(c->fns[i].code);
 			c->fns[i].code = NULL;
 		}
 	}
-	free(c);
+	mem_free(c->profile.lines);
+	mem_free(c);
+}
+
+
+unsigned long print_count(LangPrints *p)
+{
+	return p->head < LANG_PRINT_CAP ? p->head : LANG_PRINT_CAP;
+}
+
+LangPrint *print_recent(LangPrints *p, unsigned long i)
+{
+	return &p->ring[(p->head - 1 - i) % LANG_PRINT_CAP];
+}
+
+unsigned long print_flush(LangPrints *p, FILE *fp, unsigned long max)
+{
+	unsigned long head = p->head, from = p->flushed;
+	if (head - from > LANG_PRINT_CAP)
+		from = head - LANG_PRINT_CAP;
+	if (max && head - from > max)
+		from = head - max;
+	unsigned long skipped = from - p->flushed;
+
+	/* one write for the whole batch */
+	char buf[8192];
+	size_t len = 0;
+	if (skipped)
+		len += snprintf(&buf[len], sizeof(buf) - len, "[PRINT] (%lu skipped)\n", skipped);
+	for (unsigned long i = from ; i < head ; i++)
+	{
+		if (len > sizeof(buf) - 32)
+		{
+			fwrite(buf, 1, len, fp);
+			len = 0;
+		}
+		len += snprintf(&buf[len], sizeof(buf) - len, "[PRINT] %d\n", p->ring[i % LANG_PRINT_CAP].value);
+	}
+	if (len)
+	{
+		fwrite(buf, 1, len, fp);
+		fflush(fp);
+	}
+
+	p->flushed = head;
+	return head - from;
 }
@@ -2,6 +2,7 @@
 #define __robots_lang__
 
 
+#include <stdio.h>
 #include <common.h>
 #include <rendering.h>
 
@@ -22,8 +23,31 @@
 # define LANG_MAXARGC 4
 #endif
 
+/* Programs at least this big are mapped instead of copied. */
+#ifndef LANG_MMAP_MIN
+# define LANG_MMAP_MIN (64 * 1024)
+#endif
+
+/* `radar` sees at most this many tiles out, and each fuel point past the
+ * first buys this much of that range. */
+#ifndef LANG_RADAR_RANGE
+# define LANG_RADAR_RANGE 32
+#endif
+
+#ifndef LANG_RADAR_FUEL_RANGE
+# define LANG_RADAR_FUEL_RANGE 4
+#endif
+
+#ifndef LANG_MAXTOKENS
+# define LANG_MAXTOKENS 16
+#endif
+
 
 extern char *DEFAULT_PROGRAM_PATH;
+/* Whether load_program may map large files. Cleared while the program is
+ * watched for hot reload: an editor that rewrites the file in place would
+ * change the text under a running program, or cut it short and fault. */
+extern bool lang_map_programs;
 
 
 typedef enum rbt_errcode
@@ -38,10 +62,12 @@ typedef enum rbt_errcode
 	rbt_errcode_syn_invalid_op     = 103,
 	rbt_errcode_syn_fn_in_fn       = 104,
 	rbt_errcode_syn_end_outside_fn = 105,
+	rbt_errcode_syn_arity          = 106,
 	/* misc errors (500+) */
 	rbt_errcode_no_such_fn         = 500,
 	rbt_errcode_fn_exists          = 501,
 	rbt_errcode_invalid_argument   = 510,
+	rbt_errcode_div_by_zero        = 520,
 } LangErr;
 
 typedef enum rbt_op
@@ -64,13 +90,55 @@ typedef enum rbt_op
 	rbt_op_mul,
 	rbt_op_div,
 	rbt_op_mod,
+	rbt_op_goto,
+	rbt_op_seek,
+	rbt_op_radar,
+	LANG_NOPS, /* number of operations */
 } LangOp;
 
 
+typedef enum rbt_tokkind
+{
+	rbt_tok_op,
+	rbt_tok_register,
+	rbt_tok_number,
+	rbt_tok_const,
+	rbt_tok_name,
+	rbt_tok_keyword,
+	rbt_tok_comment,
+	rbt_tok_error,
+} LangTokKind;
+
+typedef struct
+{
+	LangTokKind kind;
+	int start, len; /* columns */
+} LangToken;
+
+/* What can be told about a line from its own text. */
+typedef struct
+{
+	LangOp op; /* rbt_op_err for blank and comment lines */
+	int ntokens;
+	LangToken tokens[LANG_MAXTOKENS];
+	bool errored;
+	LangErr err;
+	int err_start, err_len; /* columns covered by the first error */
+} LangLine;
+
+
+/* A piece of the program text. Not NUL-terminated. */
+typedef struct
+{
+	const char *s; /* NULL for a missing argument */
+	int len;
+} LangSlice;
+
 typedef struct rbt_instruction
 {
 	LangOp op;
-	char *args[LANG_MAXARGC];
+	LangSlice args[LANG_MAXARGC]; /* point into the stepper's program text */
+	int line; /* 1-based source line, 0 if unknown */
 } LangIns;
 
 typedef struct rbt_fn
@@ -81,6 +149,43 @@ typedef struct rbt_fn
 	LangIns *code;
 } LangFn;
 
+typedef struct
+{
+	unsigned long count; /* executions, or calls for a function */
+	unsigned long fuel;  /* fuel spent, including called functions for a function */
+} LangHits;
+
+/* Where a run spent its time and fuel. */
+typedef struct rbt_profile
+{
+	LangHits total;
+	int nlines, _linecap;
+	LangHits *lines;         /* indexed by line - 1 */
+	LangHits fns[LANG_NFNS]; /* indexed like LangContext.fns */
+	int _fndepth[LANG_NFNS]; /* recursive calls are only charged once */
+} LangProfile;
+
+/* Values `print` keeps, a power of two. */
+#ifndef LANG_PRINT_CAP
+# define LANG_PRINT_CAP 1024
+#endif
+
+typedef struct
+{
+	int value;
+	int line;
+} LangPrint;
+
+/* Output of `print`. It stays in memory so that printing makes no system
+ * calls, print_flush writes it out in batches and the console reads it. */
+typedef struct
+{
+	LangPrint ring[LANG_PRINT_CAP];
+	unsigned long head;    /* prints so far, the next one goes at head % LANG_PRINT_CAP */
+	unsigned long flushed; /* prints handled by print_flush, written or skipped */
+	FILE *drain; /* when set, a full ring is flushed here instead of being overwritten */
+} LangPrints;
+
 typedef struct
 {
 	int robot; /* robot index */
@@ -90,20 +195,37 @@ typedef struct
 	int _curfn; /* index to the current function being executed */
 	bool errored;
 	char error_msg[LANG_ERRORBUFSIZ];
+	LangProfile profile;
+	LangPrints prints;
 	Renderer *_renderer;
 } LangContext;
 
+/* How a program's text was loaded. */
+typedef struct
+{
+	size_t size;       /* length of the read-only mapping, 0 if the text was copied */
+	unsigned long ino; /* inode of the mapped file */
+} LangMapping;
+
 typedef struct rbt_stepper
 {
 	bool child;
 	LangContext *ctx;
 	char *program;
+	LangMapping _map;
 	unsigned n;
 	long _lexpos;
+	int _line;     /* line number at `_linepos` */
+	long _linepos;
 } LangStepper;
 
 /* Read local program.rbt. */
 char *read_program(char *path);
+/* Load a program to run. Large files are mapped read-only rather than
+ * copied, instructions then point straight into the mapping. */
+char *load_program(char *path, LangMapping *map);
+/* Release a program from load_program. */
+void unload_program(char *program, LangMapping *map);
 
 /* Create a stepper to interpret the code line-by-line. */
 LangStepper *make_stepper(int robot_id, char *program);
@@ -111,10 +233,31 @@ LangStepper *make_stepper(int robot_id, char *program);
 bool stepper_step(State *state, LangStepper *ls, Renderer *renderer);
 /* Reread the program and restart the stepper. */
 void stepper_reload(LangStepper *ls);
+/* Reread the program and recompile only the functions that changed, keeping
+ * the stepper's position and registers. Falls back to a restart and returns
+ * false when code outside of functions changed. */
+bool stepper_patch(LangStepper *ls);
+/* Write the stepper's profile as text, hottest lines and functions first. */
+void stepper_profile_report(LangStepper *ls, FILE *fp);
+
+/* Write the prints that have not been flushed yet to `fp` in one batch, at most
+ * `max` lines of them (0 for no limit). Older prints over the limit, or that
+ * were overwritten before a flush, are skipped and counted in a final line.
+ * Returns the number of prints written. */
+unsigned long print_flush(LangPrints *p, FILE *fp, unsigned long max);
+/* The `i`th most recent print, i < print_count(p). */
+LangPrint *print_recent(LangPrints *p, unsigned long i);
+unsigned long print_count(LangPrints *p);
 /* Free a stepper. */
 void del_stepper(LangStepper *ls);
 /* Interpret the given code instantly. */
 void interpret(State *state, LangContext *ctx, Renderer *renderer, char *program);
+/* Lex and check a single line of `len` characters without running it.
+ * Arguments are checked against the op's usage string. Errors that need
+ * other lines (function nesting, unknown functions) are not reported. */
+void lang_check_line(const char *line, int len, LangLine *out);
+/* Short description of an error code. */
+const char *lang_strerror(LangErr code);
 /* Create a new language context. */
 LangContext *new_context(int robot_id);
 /* Delete a language context. */
@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <level.h>
+#include <common.h>
+#include <mem.h>
+
+
+/* Layout (all integers little-endian):
+ *   header:  u32 magic, u32 version, u32 count, u32 reserved
+ *   index:   count * { u32 offset, u32 size }
+ *   level:   u16 width, u16 height, u16 max_fuel, u16 canister_fuel,
+ *            u16 nrobots, u16 reserved,
+ *            nrobots * { u16 x, u16 y, u8 dir, u8 flags },
+ *            width * height tile bytes */
+#define LEVELPACK_MAGIC   0x4c544252 /* "RBTL" */
+#define LEVELPACK_VERSION 1
+#define LEVELPACK_HEADER  16
+#define LEVEL_HEADER      12
+#define LEVEL_ROBOT       6
+
+#ifndef LEVEL_LINEBUFSIZ
+# define LEVEL_LINEBUFSIZ 1024
+#endif
+
+
+static
+unsigned rd16(const unsigned char *p) { return p[0] | p[1] << 8; }
+
+static
+unsigned rd32(const unsigned char *p) { return p[0] | p[1] << 8 | p[2] << 16 | (unsigned)p[3] << 24; }
+
+/* Level records are built in memory so that the index can be written first. */
+typedef struct
+{
+	unsigned char *data;
+	size_t len, cap;
+} PackBuf;
+
+static
+void put8(PackBuf *b, unsigned v)
+{
+	if (b->len == b->cap)
+	{
+		b->cap = b->cap ? b->cap * 2 : 4096;
+		b->data = mem_realloc(MEM_WORLD, b->data, b->cap);
+	}
+	b->data[b->len++] = v & 0xff;
+}
+
+static
+void put16(PackBuf *b, unsigned v)
+{
+	put8(b, v);
+	put8(b, v >> 8);
+}
+
+static
+void put32(PackBuf *b, unsigned v)
+{
+	put16(b, v & 0xffff);
+	put16(b, v >> 16);
+}
+
+
+bool levelpack_open(LevelPack *p, const char *path)
+{
+	*p = (LevelPack){0};
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "error: failed to read `%s`, are you missing permissions?\n", path);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size < LEVELPACK_HEADER)
+	{
+		fprintf(stderr, "error: `%s` is not a level pack\n", path);
+		close(fd);
+		return false;
+	}
+
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); /* the mapping keeps the file alive */
+	if (data == MAP_FAILED)
+	{
+		fprintf(stderr, "error: failed to map `%s`\n", path);
+		return false;
+	}
+
+	p->data = data;
+	p->size = st.st_size;
+	p->count = rd32(p->data + 8);
+	if (rd32(p->data) != LEVELPACK_MAGIC ||
+		rd32(p->data + 4) != LEVELPACK_VERSION ||
+		LEVELPACK_HEADER + (size_t)p->count * 8 > p->size)
+	{
+		fprintf(stderr, "error: `%s` is not a level pack\n", path);
+		levelpack_close(p);
+		return false;
+	}
+	return true;
+}
+
+void levelpack_close(LevelPack *p)
+{
+	if (p->data)
+		munmap((void *)p->data, p->size);
+	*p = (LevelPack){0};
+}
+
+/* Check everything in a level record that is used as an index, so that a
+ * damaged pack is turned down instead of building a broken world: there has
+ * to be a world and a player, which comes first, every robot has to stand
+ * in the world facing a real direction, and every tile has to be known. */
+static
+bool level_valid(const unsigned char *lv, int width, int height, int nrobots)
+{
+	if (width == 0 || height == 0 || nrobots == 0)
+		return false;
+
+	const unsigned char *r = lv + LEVEL_HEADER;
+	for (int i = 0 ; i < nrobots ; i++, r += LEVEL_ROBOT)
+	{
+		if ((int)rd16(r) >= width || (int)rd16(r + 2) >= height || r[4] > West)
+			return false;
+		if (((r[5] & ROBOT_PLAYER) != 0) != (i == 0))
+			return false;
+	}
+
+	const unsigned char *tiles = r;
+	for (int i = 0 ; i < width * height ; i++)
+	{
+		if (tiles[i] != TILE_EMPTY && tiles[i] != TILE_WALL && tiles[i] != TILE_ENERGY)
+			return false;
+	}
+	return true;
+}
+
+State *levelpack_load(LevelPack *p, unsigned n)
+{
+	if (n >= p->count)
+		return NULL;
+
+	const unsigned char *entry = p->data + LEVELPACK_HEADER + n * 8;
+	size_t offset = rd32(entry), size = rd32(entry + 4);
+	if (offset + size > p->size || size < LEVEL_HEADER)
+		return NULL;
+
+	/* only this level's pages are touched */
+	const unsigned char *lv = p->data + offset;
+	int width = rd16(lv), height = rd16(lv + 2);
+	int nrobots = rd16(lv + 8);
+	if (LEVEL_HEADER + (size_t)nrobots * LEVEL_ROBOT + (size_t)width * height > size)
+		return NULL;
+	if (!level_valid(lv, width, height, nrobots))
+	{
+		fprintf(stderr, "warning: level %u of the pack is corrupt\n", n + 1);
+		return NULL;
+	}
+
+	State *state = new_state(width, height, rd16(lv + 4), rd16(lv + 6));
+
+	const unsigned char *r = lv + LEVEL_HEADER;
+	for (int i = 0 ; i < nrobots ; i++, r += LEVEL_ROBOT)
+		robots_add(&state->robots, r[5] & ROBOT_PLAYER, rd16(r), rd16(r + 2), (Direction)r[4]);
+
+	const unsigned char *tiles = r;
+	for (int i = 0 ; i < width * height ; i++)
+		state->world->tiles[i] = tiles[i];
+	world_sync(state);
+
+	return state;
+}
+
+
+/* A level being read from a text file. */
+typedef struct
+{
+	int width, height;
+	int max_fuel, canister_fuel;
+	char *rows; /* height rows of width tile characters */
+	int nrobots;
+	struct { int x, y; Direction dir; bool player; } robots[256];
+} TextLevel;
+
+static
+bool parse_dir(const char *s, Direction *d)
+{
+	static const char *names[] = { [North]="north", [South]="south", [East]="east", [West]="west" };
+	for (int i = 0 ; i < 4 ; i++)
+	{
+		if (strcmp(s, names[i]) == 0)
+		{
+			*d = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static
+int tile_from_char(char c)
+{
+	switch (c)
+	{
+	case '#': return TILE_WALL;
+	case '*': return TILE_ENERGY;
+	case '.':
+	case ' ': return TILE_EMPTY;
+	default:  return -1;
+	}
+}
+
+/* Append one level record. */
+static
+void write_level(PackBuf *b, TextLevel *lv)
+{
+	put16(b, lv->width);
+	put16(b, lv->height);
+	put16(b, lv->max_fuel);
+	put16(b, lv->canister_fuel);
+	put16(b, lv->nrobots);
+	put16(b, 0);
+	for (int i = 0 ; i < lv->nrobots ; i++)
+	{
+		put16(b, lv->robots[i].x);
+		put16(b, lv->robots[i].y);
+		put8(b, lv->robots[i].dir);
+		put8(b, lv->robots[i].player ? ROBOT_PLAYER : 0);
+	}
+	for (int i = 0 ; i < lv->width * lv->height ; i++)
+		put8(b, tile_from_char(lv->rows[i]));
+}
+
+int levelpack_compile(const char *src_path, const char *out_path)
+{
+	FILE *in = fopen(src_path, "r");
+	if (!in)
+	{
+		fprintf(stderr, "error: failed to read `%s`, are you missing permissions?\n", src_path);
+		return 1;
+	}
+
+	PackBuf index = {0}, levels = {0};
+	unsigned count = 0;
+
+	TextLevel lv = {0};
+	bool in_level = false;
+	char line[LEVEL_LINEBUFSIZ];
+	unsigned lineno = 0;
+	int status = 0;
+
+#	define fail(...) do { \
+		fprintf(stderr, "%s:%u: error: ", src_path, lineno); \
+		fprintf(stderr, __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		status = 1; \
+		goto done; \
+	} while (0)
+
+	while (fgets(line, sizeof(line), in))
+	{
+		lineno++;
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == ';' || (line[0] == '\0' && !in_level))
+			continue;
+
+		char word[32] = {0}, arg[32] = {0};
+		int x = 0, y = 0;
+		sscanf(line, "%31s", word);
+
+		if (!in_level)
+		{
+			if (strcmp(word, "level") != 0)
+				fail("expected `level`, got `%s`", line);
+			lv = (TextLevel){ .max_fuel=MAX_FUEL, .canister_fuel=FUEL_CANISTER_AMOUNT };
+			in_level = true;
+		}
+		else if (strcmp(word, "fuel") == 0)
+		{
+			if (sscanf(line, "%*s %d %d", &lv.max_fuel, &lv.canister_fuel) != 2)
+				fail("usage: fuel MAX CANISTER");
+		}
+		else if (strcmp(word, "player") == 0 || strcmp(word, "enemy") == 0)
+		{
+			Direction d;
+			if (sscanf(line, "%*s %d %d %31s", &x, &y, arg) != 3 || !parse_dir(arg, &d))
+				fail("usage: %s X Y north|south|east|west", word);
+			if (x < 0 || y < 0 || x >= lv.width || y >= lv.height)
+				fail("robot at %d,%d is outside the map", x, y);
+			if (lv.nrobots == (int)(sizeof(lv.robots) / sizeof(lv.robots[0])))
+				fail("too many robots");
+			bool player = word[0] == 'p';
+			if (player != (lv.nrobots == 0))
+				fail("the player must be the first robot and there can only be one");
+			lv.robots[lv.nrobots].x = x;
+			lv.robots[lv.nrobots].y = y;
+			lv.robots[lv.nrobots].dir = d;
+			lv.robots[lv.nrobots].player = player;
+			lv.nrobots++;
+		}
+		else if (strcmp(word, "end") == 0)
+		{
+			if (lv.height == 0)
+				fail("level has no tiles");
+			if (lv.nrobots == 0)
+				fail("level has no player");
+			size_t start = levels.len;
+			write_level(&levels, &lv);
+			put32(&index, start);
+			put32(&index, levels.len - start);
+			count++;
+			mem_free(lv.rows);
+			lv.rows = NULL;
+			in_level = false;
+		}
+		else
+		{
+			/* map row */
+			int w = strlen(line);
+			if (lv.height == 0)
+				lv.width = w;
+			else if (w != lv.width)
+				fail("row is %d tiles wide, expected %d", w, lv.width);
+			for (int i = 0 ; i < w ; i++)
+				if (tile_from_char(line[i]) < 0)
+					fail("unknown tile `%c`", line[i]);
+			lv.rows = mem_realloc(MEM_WORLD, lv.rows, (lv.height + 1) * lv.width);
+			memcpy(lv.rows + lv.height * lv.width, line, lv.width);
+			lv.height++;
+		}
+	}
+	if (in_level)
+		fail("missing `end`");
+
+	FILE *out = fopen(out_path, "wb");
+	if (!out)
+		fail("failed to create `%s`, are you missing permissions?", out_path);
+
+	/* level offsets are relative to the start of the file */
+	PackBuf header = {0};
+	put32(&header, LEVELPACK_MAGIC);
+	put32(&header, LEVELPACK_VERSION);
+	put32(&header, count);
+	put32(&header, 0);
+	size_t base = LEVELPACK_HEADER + index.len;
+	for (unsigned i = 0 ; i < count ; i++)
+	{
+		unsigned char *e = index.data + i * 8;
+		unsigned off = rd32(e) + base;
+		e[0] = off; e[1] = off >> 8; e[2] = off >> 16; e[3] = off >> 24;
+	}
+	fwrite(header.data, 1, header.len, out);
+	fwrite(index.data, 1, index.len, out);
+	fwrite(levels.data, 1, levels.len, out);
+	fclose(out);
+	mem_free(header.data);
+	printf("packed %u levels into `%s`\n", count, out_path);
+
+#	undef fail
+
+done:
+	mem_free(lv.rows);
+	mem_free(index.data);
+	mem_free(levels.data);
+	fclose(in);
+	return status;
+}
@@ -0,0 +1,30 @@
+#ifndef __robots_level__
+#define __robots_level__
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <common.h>
+
+
+/* A level pack is a header, an index of (offset, size) pairs, and one record
+ * per level holding its size, fuel settings, robot spawns and tiles. The pack
+ * is mapped read-only and a level is only decoded when it is loaded. */
+typedef struct
+{
+	const unsigned char *data;
+	size_t size;
+	unsigned count;
+} LevelPack;
+
+/* Map a level pack. */
+bool levelpack_open(LevelPack *p, const char *path);
+/* Unmap a level pack. */
+void levelpack_close(LevelPack *p);
+/* Build the State for level `n` (0-based). Returns NULL if it is out of range or corrupt. */
+State *levelpack_load(LevelPack *p, unsigned n);
+/* Convert a text level file into a level pack. Returns an exit code. */
+int levelpack_compile(const char *src_path, const char *out_path);
+
+
+#endif
@@ -6,11 +6,27 @@
 #include <rendering.h>
 #include <audio.h>
 #include <lang.h>
+#include <journal.h>
+#include <headless.h>
+#include <replay.h>
+#include <level.h>
+#include <watch.h>
+#include <opstats.h>
+#include <frametime.h>
+#include <trace.h>
+#include <flight.h>
+#include <prefetch.h>
+#include <worldgen.h>
 
 #ifdef RENDER_TEST
 #include <render_test.h>
 #endif
 
+// Program output is written every PRINT_FLUSH_FRAMES frames, at most
+// PRINT_FLUSH_LINES lines at a time, so a printing loop can't flood the terminal
+#define PRINT_FLUSH_FRAMES 30
+#define PRINT_FLUSH_LINES 100
+
 // Game states
 typedef enum
 {
@@ -88,23 +104,95 @@ static void draw_gameover_screen(Renderer *renderer, Texture2D *texture)
 static void fill_fog(Renderer *renderer, State *state)
 {
 	renderer_fill_fog(renderer, state->world);
-	for (int dy = -1; dy <= 1; dy++)
-		for (int dx = -1; dx <= 1; dx++)
-			renderer_set_fog(renderer, state->robots[0].x + dx, state->robots[0].y + dy, false);
+	renderer_look(renderer, state);
 }
 
-int main(int argc, char *argv[])
+// Where levels come from: a level pack if one was given, otherwise the generator
+typedef struct
 {
-	init_window();
-	init_sound();
+	LevelPack pack;
+	int width, height, robot_count;
+	WorldLayout layout;
+	Journal *journal;
+} LevelConfig;
+
+// Build a level's state. Also runs on the prefetch thread, so it only reads the config
+static State *build_level(void *data, int level, long seed)
+{
+	LevelConfig *cfg = data;
+	State *state = NULL;
+	if (cfg->pack.count > 0)
+		state = levelpack_load(&cfg->pack, (level - 1) % cfg->pack.count);
+	if (state == NULL)
+		state = generate_world(seed, cfg->width, cfg->height, cfg->robot_count, cfg->layout);
+	return state;
+}
 
-	Renderer *renderer = init_renderer();
+// Make a built level the one being played
+static State *begin_level(LevelConfig *cfg, State *state)
+{
+	state->journal = cfg->journal;
+	if (cfg->journal)
+		journal_begin(cfg->journal, state);
+	return state;
+}
+
+static State *new_level(LevelConfig *cfg, int level, long seed)
+{
+	return begin_level(cfg, build_level(cfg, level, seed));
+}
+
+static void flush_prints(State *state, FILE *out)
+{
+	if (state)
+		print_flush(&state->stepper->ctx->prints, out, PRINT_FLUSH_LINES);
+}
+
+// Write the prints of a headless run half a ring at a time, `print` itself
+// flushes the ring if a single step fills it
+static bool flush_headless_prints(State *state, void *out)
+{
+	LangPrints *prints = &state->stepper->ctx->prints;
+	if (prints->head - prints->flushed >= LANG_PRINT_CAP / 2)
+		print_flush(prints, out, 0);
+	return true;
+}
+
+// Write where the last run spent its fuel, if --profile was given
+static void write_profile(const char *path, State *state)
+{
+	if (path == NULL || state == NULL)
+		return;
+	FILE *fp = fopen(path, "w");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "error: failed to create `%s`, are you missing permissions?\n", path);
+		return;
+	}
+	stepper_profile_report(state->stepper, fp);
+	fclose(fp);
+}
+
+int main(int argc, char *argv[])
+{
 	State *state = NULL;
 	GameState game_state = GAME_TITLE;
 	unsigned long frame = 0, program_frame = 0;
 	bool running = true, showcase = false, foggy = false;
+	bool headless = false, reload_pending = false;
+	char *record_path = NULL, *replay_path = NULL, *profile_path = NULL;
+	char *frame_log_path = NULL;
+	FILE *print_out = stdout;
+	unsigned max_steps = 0;
+	char *levels_path = NULL;
+	int start_level = 1;
 	long seed = -1;
-	int width = DEFAULT_WORLD_WIDTH, height = DEFAULT_WORLD_HEIGHT, robot_count = DEFAULT_ROBOT_COUNT;
+	LevelConfig cfg = { .width=DEFAULT_WORLD_WIDTH, .height=DEFAULT_WORLD_HEIGHT, .robot_count=DEFAULT_ROBOT_COUNT };
+
+#if LANG_OPSTATS
+	atexit(opstats_dump_at_exit);
+#endif
+	flight_catch_signals();
 
 	for (int i = 1 ; i < argc ; i++)
 	{
@@ -115,13 +203,67 @@ int main(int argc, char *argv[])
 		else if (strcmp(argv[i], "--program") == 0 || strcmp(argv[i], "-p") == 0)
 			DEFAULT_PROGRAM_PATH = argv[++i];
 		else if (strcmp(argv[i], "--width") == 0 || strcmp(argv[i], "-w") == 0)
-			width = strtol(argv[++i], NULL, 10);
+			cfg.width = strtol(argv[++i], NULL, 10);
 		else if (strcmp(argv[i], "--height") == 0 || strcmp(argv[i], "-h") == 0)
-			height = strtol(argv[++i], NULL, 10);
+			cfg.height = strtol(argv[++i], NULL, 10);
 		else if (strcmp(argv[i], "--nrobots") == 0 || strcmp(argv[i], "-r") == 0)
-			robot_count = strtol(argv[++i], NULL, 10);
+			cfg.robot_count = strtol(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--layout") == 0)
+		{
+			if (!worldgen_parse_layout(argv[++i], &cfg.layout))
+			{
+				fprintf(stderr, "error: unknown layout `%s`, expected scatter, maze, cave or rooms\n", argv[i]);
+				exit(1);
+			}
+		}
+		else if (strcmp(argv[i], "--threads") == 0)
+			worldgen_threads = strtol(argv[++i], NULL, 10);
 		else if (strcmp(argv[i], "--foggy") == 0 || strcmp(argv[i], "-f") == 0)
 			foggy = true;
+		else if (strcmp(argv[i], "--journal") == 0 || strcmp(argv[i], "-j") == 0)
+			cfg.journal = new_journal();
+		else if (strcmp(argv[i], "--headless") == 0 || strcmp(argv[i], "-H") == 0)
+			headless = true;
+		else if (strcmp(argv[i], "--record") == 0)
+			record_path = argv[++i];
+		else if (strcmp(argv[i], "--replay") == 0)
+			replay_path = argv[++i];
+		else if (strcmp(argv[i], "--profile") == 0)
+			profile_path = argv[++i];
+		else if (strcmp(argv[i], "--frame-log") == 0)
+			frame_log_path = argv[++i];
+		else if (strcmp(argv[i], "--print-log") == 0)
+		{
+			print_out = fopen(argv[++i], "w");
+			if (!print_out)
+			{
+				fprintf(stderr, "error: failed to create `%s`, are you missing permissions?\n", argv[i]);
+				exit(1);
+			}
+		}
+		else if (strcmp(argv[i], "--flight-log") == 0)
+			flight_path = argv[++i];
+		else if (strcmp(argv[i], "--trace") == 0)
+		{
+			if (!trace_open(argv[++i]))
+				exit(1);
+		}
+		else if (strcmp(argv[i], "--max-steps") == 0)
+			max_steps = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--levels") == 0 || strcmp(argv[i], "-L") == 0)
+			levels_path = argv[++i];
+		else if (strcmp(argv[i], "--level") == 0 || strcmp(argv[i], "-l") == 0)
+			start_level = strtol(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--pack") == 0)
+		{
+			// Convert a text level file and exit
+			if (i + 2 >= argc)
+			{
+				fprintf(stderr, "error: usage: --pack LEVELS.txt OUT.pack\n");
+				exit(1);
+			}
+			return levelpack_compile(argv[i + 1], argv[i + 2]);
+		}
 		else
 		{
 			fprintf(stderr, "error: unrecognized option: %s\n", argv[i]);
@@ -129,12 +271,57 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (levels_path && !levelpack_open(&cfg.pack, levels_path))
+		exit(1);
+	if (start_level < 1)
+		start_level = 1;
+
+	// Headless modes run the program once at full speed and exit
+	if (replay_path)
+		return replay_verify(replay_path, max_steps);
+	if (record_path)
+		return replay_record(record_path, seed, cfg.width, cfg.height, cfg.robot_count, cfg.layout, max_steps);
+	if (headless)
+	{
+		state = new_level(&cfg, start_level, seed);
+		state->stepper->ctx->prints.drain = print_out;
+		HeadlessResult res = run_headless(state, max_steps, flush_headless_prints, print_out);
+		print_flush(&state->stepper->ctx->prints, print_out, 0);
+		printf("headless: %u steps, %s\n", res.steps, headless_outcome(&res));
+		write_profile(profile_path, state);
+		free_state(state);
+		if (print_out != stdout)
+			fclose(print_out);
+		return res.errored;
+	}
+
+	init_window();
+	init_sound();
+	if (!frametime_init(frame_log_path))
+		exit(1);
+
+	Renderer *renderer = init_renderer();
+	renderer->level = start_level;
+	unsigned long long traced = trace_begin();
 	Texture2D title_texture = LoadTexture("assets/title.png");
+	trace_end_path(traced, "asset", "load_texture", "assets/title.png");
+	traced = trace_begin();
 	Texture2D gameover_texture = LoadTexture("assets/gameover.png");
+	trace_end_path(traced, "asset", "load_texture", "assets/gameover.png");
+
+	// Hot reload the program when it is edited outside the game. A watched
+	// program is copied rather than mapped, so that saving it can't change
+	// the text of the run that is still going.
+	FileWatch watch;
+	if (watch_open(&watch, DEFAULT_PROGRAM_PATH))
+		lang_map_programs = false;
+
+	// The next level is built on a worker thread while the current one is played
+	LevelPrefetch prefetch = {0};
 
 	if (showcase)
 	{
-		state = generate_world(seed, width, height, robot_count);
+		state = new_level(&cfg, renderer->level, seed);
 		renderer_sync_visuals(renderer, state);
 		game_state = GAME_PLAYING;
 		state->program_running = true;
@@ -146,8 +333,21 @@ int main(int argc, char *argv[])
 	while (running && !WindowShouldClose())
 	{
 		frame++;
+		unsigned long long frame_traced = trace_begin();
 
+		frametime_begin(PHASE_MUSIC);
 		update_music();
+		frametime_end(PHASE_MUSIC);
+
+		// Show or hide the frame timings
+		if (IsKeyPressed(KEY_F3))
+			frametime_toggle_overlay();
+		// Show or hide the heap use
+		if (IsKeyPressed(KEY_F4))
+			toggle_mem_overlay();
+		// Show or hide the program's prints
+		if (IsKeyPressed(KEY_GRAVE) && !renderer_editor_active(renderer))
+			renderer_toggle_console(renderer);
 
 		switch (game_state)
 		{
@@ -159,12 +359,15 @@ int main(int argc, char *argv[])
 					// Initialize game state
 					if (state != NULL)
 					{
+						flush_prints(state, print_out);
 						free_state(state);
 					}
-					state = generate_world(seed, width, height, robot_count);
+					state = new_level(&cfg, renderer->level, seed);
 					if (foggy)
 						fill_fog(renderer, state);
 					renderer_sync_visuals(renderer, state);
+					if (!showcase)
+						prefetch_start(&prefetch, build_level, &cfg, renderer->level + 1, -1, NULL);
 
 					play_sfx(SFX_AWAITING_INSTRUCTIONS);
 					game_state = GAME_PLAYING;
@@ -172,13 +375,17 @@ int main(int argc, char *argv[])
 					// TODO:  Additional initialization?
 				}
 
+				frametime_begin(PHASE_RENDER);
 				draw_title_screen(renderer, &title_texture);
+				frametime_end(PHASE_RENDER);
 			}
 			break;
 
 			case GAME_PLAYING:
 			{
+				frametime_begin(PHASE_UPDATE);
 				renderer_update(renderer, state, ANIM_SPEED);
+				frametime_end(PHASE_UPDATE);
 
 				// Handle editor if active
 				if (renderer_editor_active(renderer))
@@ -186,29 +393,49 @@ int main(int argc, char *argv[])
 					int editor_result = renderer_update_editor(renderer);
 					if (editor_result == 1)
 					{
-						// Saved - reload the program
+						// Saved - reload the program. The save renamed a file over
+						// it, so the watch has seen our own change: drop that (and
+						// any earlier one, which this reload picks up as well)
 						stepper_reload(state->stepper);
+						watch_changed(&watch);
+						reload_pending = false;
 					}
 					// If editor is active, skip game logic and button updates
+					frametime_begin(PHASE_RENDER);
 					renderer_render(renderer, state);
+					frametime_end(PHASE_RENDER);
 					break;
 				}
 
+				frametime_begin(PHASE_LOGIC);
+
 				renderer_update_buttons(renderer);
 
 #ifdef RENDER_TEST
 				render_test_logic(renderer, state);
 #endif
 
+				// A running program is never changed mid-run, the reload waits until it stops
+				if (watch_changed(&watch))
+					reload_pending = true;
+				if (reload_pending && !state->program_running)
+				{
+					reload_pending = false;
+					renderer_set_notif(renderer, stepper_patch(state->stepper) ? "Program reloaded" : "Program restarted");
+				}
+
 				// TODO: Additional game logic here for processing instructions, etc.
-				if (
-					state->program_running &&
-					++program_frame % EXEC_SPEED == 0 &&
-					!stepper_step(state, state->stepper, renderer)
-				)
+				if (state->program_running && ++program_frame % EXEC_SPEED == 0)
 				{
-					state->program_running = false;
-					program_frame = 0;
+					frametime_begin(PHASE_STEP);
+					bool more = stepper_step(state, state->stepper, renderer);
+					frametime_end(PHASE_STEP);
+					if (!more)
+					{
+						state->program_running = false;
+						program_frame = 0;
+						write_profile(profile_path, state);
+					}
 				}
 
 				// Handle button clicks
@@ -223,8 +450,9 @@ int main(int argc, char *argv[])
 				if (renderer_button_clicked(renderer, BTN_RESET))
 				{
 					// Reset level - regenerate with same parameters
+					flush_prints(state, print_out);
 					free_state(state);
-					state = generate_world(showcase ? seed : -1, width, height, robot_count);
+					state = new_level(&cfg, renderer->level, showcase ? seed : -1);
 					renderer_clear_fog(renderer);
 					if (foggy)
 						fill_fog(renderer, state);
@@ -239,10 +467,33 @@ int main(int argc, char *argv[])
 					}
 				}
 
+				// Scrub through the journal while the program is stopped
+				Journal *journal = cfg.journal;
+				if (journal && !state->program_running && journal->nsteps > 0)
+				{
+					unsigned step = state->stepper->n;
+					if ((IsKeyPressed(KEY_LEFT_BRACKET) || IsKeyPressedRepeat(KEY_LEFT_BRACKET)) && step > 0)
+						step--;
+					if ((IsKeyPressed(KEY_RIGHT_BRACKET) || IsKeyPressedRepeat(KEY_RIGHT_BRACKET)) && step < journal->nsteps)
+						step++;
+					if (step != state->stepper->n && journal_seek(journal, state, step))
+						renderer_sync_visuals(renderer, state);
+				}
+
+				// Write what the interpreter did recently
+				if (IsKeyPressed(KEY_F10))
+					renderer_set_notif(renderer, flight_dump("requested with F10") >= 0 ? "Flight log written" : "Flight log failed");
+
+#if LANG_OPSTATS
+				// Print the interpreter statistics so far
+				if (IsKeyPressed(KEY_F9))
+					opstats_dump(stderr);
+#endif
+
 				if (renderer_button_clicked(renderer, BTN_EDIT))
 				{
-					// Open the program editor
-					renderer_open_editor(renderer);
+					// Open the program editor, showing where the last run spent its fuel
+					renderer_open_editor(renderer, &state->stepper->ctx->profile);
 				}
 
 				if (renderer_button_clicked(renderer, BTN_QUIT))
@@ -251,45 +502,25 @@ int main(int argc, char *argv[])
 				}
 
 				// Check for game over condition
-				Robot *player = &state->robots[0];
-				if (player->fuel <= 0)
+				if (state->robots.fuel[0] <= 0)
 				{
 					play_sfx(SFX_GAMEOVER);
 					game_state = GAME_OVER;
 				}
 
-				// TODO: Check for level complete condition
-				int alive_enemies = 0;
-
 				// count alive enemies
-				for (int i = 0; i < MAX_ROBOTS; i++)
-				{
-					if (!(*state).robots[i].is_player &&
-						(*state).robots[i].fuel > 0)
-					{
-						if (!(*state).robots[i].is_disassembled)
-						{
-							alive_enemies++;
-							continue;
-						}
-						RobotVisual *rv = &renderer->visuals[i];
-						Animation *anim = &renderer->disassembly_anims[i];
-						/* Robots that are actively animating their disassembly should be counted as
-						   alive so that we get to see the animation before going to the next level. */
-						if (!rv->disassembled || (rv->disassembled && !anim->finished))
-						{
-							alive_enemies++;
-						}
-					}
-				}
+				/* Robots that are actively animating their disassembly should be counted as
+				   alive so that we get to see the animation before going to the next level. */
+				int alive_enemies = robots_alive_enemies(&state->robots) + renderer->ndisassembling;
 
 				// player has won the level
 				if (alive_enemies == 0)
 				{
 					if (showcase)
 					{
+						flush_prints(state, print_out);
 						free_state(state);
-						state = generate_world(seed, width, height, robot_count);
+						state = new_level(&cfg, renderer->level, seed);
 						renderer_clear_fog(renderer);
 						if (foggy)
 							fill_fog(renderer, state);
@@ -302,20 +533,28 @@ int main(int argc, char *argv[])
 					{
 						// go to the next level
 						int next_level = (*renderer).level + 1;
+						write_profile(profile_path, state);
 
-						// Initialize NEW game state
-						free_state(state);
-
-						state = generate_world(-1, width, height, robot_count);
+						// Swap in the next level, built in the background while this one was played
+						flush_prints(state, print_out);
+						State *finished = state;
+						State *next = prefetch_take(&prefetch, next_level);
+						state = begin_level(&cfg, next ? next : build_level(&cfg, next_level, -1));
 						renderer_clear_fog(renderer);
 						if (foggy)
 							fill_fog(renderer, state);
 						renderer_sync_visuals(renderer, state);
 						(*renderer).level = next_level;
+
+						// Start on the one after, the worker also frees the finished level
+						prefetch_start(&prefetch, build_level, &cfg, next_level + 1, -1, finished);
 					}
 				}
+				frametime_end(PHASE_LOGIC);
 
+				frametime_begin(PHASE_RENDER);
 				renderer_render(renderer, state);
+				frametime_end(PHASE_RENDER);
 			}
 			break;
 
@@ -327,20 +566,36 @@ int main(int argc, char *argv[])
 					game_state = GAME_TITLE;
 				}
 
+				frametime_begin(PHASE_RENDER);
 				draw_gameover_screen(renderer, &gameover_texture);
+				frametime_end(PHASE_RENDER);
 			}
 			break;
 		}
+
+		if (frame % PRINT_FLUSH_FRAMES == 0)
+			flush_prints(state, print_out);
+
+		frametime_end_frame();
+		trace_end(frame_traced, "frame", "frame");
 	}
 
 	// Cleanup
+	prefetch_cancel(&prefetch);
+	frametime_shutdown();
 	UnloadTexture(title_texture);
 	UnloadTexture(gameover_texture);
 	shutdown_sound();
 	if (state != NULL)
 	{
+		flush_prints(state, print_out);
 		free_state(state);
 	}
 	free_renderer(renderer);
+	del_journal(cfg.journal);
+	levelpack_close(&cfg.pack);
+	watch_close(&watch);
+	if (print_out != stdout)
+		fclose(print_out);
 	CloseWindow();
 }
@@ -0,0 +1,117 @@
+#include <mem.h>
+#include <stdbool.h>
+
+
+const char *mem_tag_names[MEM_NTAGS] =
+{
+	[MEM_LANG_PARSE]   = "lang parse",
+	[MEM_LANG_RUNTIME] = "lang runtime",
+	[MEM_WORLD]        = "world",
+	[MEM_RENDERER]     = "renderer",
+	[MEM_EDITOR]       = "editor",
+	[MEM_AUDIO]        = "audio",
+	[MEM_JOURNAL]      = "journal",
+	[MEM_MISC]         = "misc",
+};
+
+#if MEM_TRACKING
+
+/* Every block starts with its size and tag, padded so that the memory handed
+ * out keeps malloc's alignment. */
+typedef union
+{
+	struct
+	{
+		size_t size;
+		int tag;
+	} h;
+	long double align;
+	void *palign;
+} MemHeader;
+
+/* Updated from any thread, hence the atomics. */
+static MemStats stats[MEM_NTAGS];
+
+
+static
+void count(int tag, size_t added, size_t removed, int blocks, int allocs)
+{
+	MemStats *s = &stats[tag];
+	size_t live = __atomic_add_fetch(&s->live, added - removed, __ATOMIC_RELAXED);
+	size_t peak = __atomic_load_n(&s->peak, __ATOMIC_RELAXED);
+	while (live > peak && !__atomic_compare_exchange_n(&s->peak, &peak, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	if (blocks)
+		__atomic_add_fetch(&s->blocks, (unsigned long)blocks, __ATOMIC_RELAXED);
+	if (allocs)
+		__atomic_add_fetch(&s->allocs, 1, __ATOMIC_RELAXED);
+}
+
+static
+void *track(int tag, MemHeader *h, size_t size)
+{
+	if (!h)
+		return NULL;
+	h->h.size = size;
+	h->h.tag = tag;
+	count(tag, size, 0, 1, 1);
+	return h + 1;
+}
+
+void *mem_alloc(int tag, size_t size)
+{
+	return track(tag, malloc(sizeof(MemHeader) + size), size);
+}
+
+void *mem_calloc(int tag, size_t n, size_t size)
+{
+	if (size && n > (size_t)-1 / size - sizeof(MemHeader))
+		return NULL;
+	return track(tag, calloc(1, sizeof(MemHeader) + n * size), n * size);
+}
+
+void *mem_realloc(int tag, void *p, size_t size)
+{
+	if (!p)
+		return mem_alloc(tag, size);
+
+	MemHeader *h = (MemHeader *)p - 1;
+	size_t old = h->h.size;
+	tag = h->h.tag;
+	h = realloc(h, sizeof(MemHeader) + size);
+	if (!h)
+		return NULL;
+	h->h.size = size;
+	count(tag, size, old, 0, 1);
+	return h + 1;
+}
+
+void mem_free(void *p)
+{
+	if (!p)
+		return;
+	MemHeader *h = (MemHeader *)p - 1;
+	count(h->h.tag, 0, h->h.size, -1, 0);
+	free(h);
+}
+
+void mem_stats(MemStats out[MEM_NTAGS])
+{
+	for (int i = 0 ; i < MEM_NTAGS ; i++)
+	{
+		out[i].live = __atomic_load_n(&stats[i].live, __ATOMIC_RELAXED);
+		out[i].peak = __atomic_load_n(&stats[i].peak, __ATOMIC_RELAXED);
+		out[i].allocs = __atomic_load_n(&stats[i].allocs, __ATOMIC_RELAXED);
+		out[i].blocks = __atomic_load_n(&stats[i].blocks, __ATOMIC_RELAXED);
+	}
+}
+
+unsigned long mem_allocs(void)
+{
+	unsigned long n = 0;
+	for (int i = 0 ; i < MEM_NTAGS ; i++)
+		n += __atomic_load_n(&stats[i].allocs, __ATOMIC_RELAXED);
+	return n;
+}
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef __robots_mem__
+#define __robots_mem__
+
+#include <stddef.h>
+#include <stdlib.h>
+
+
+/* Tracking allocator. Every allocation in the game goes through mem_alloc and
+ * friends with the subsystem it belongs to, which keeps live and peak bytes
+ * and an allocation count per subsystem. Release builds (-DNDEBUG, `./run.sh
+ * --release`) compile the counters out and call the C library directly.
+ * Memory from mem_* must be released with mem_free and the other way around. */
+
+#ifndef MEM_TRACKING
+# ifdef NDEBUG
+#  define MEM_TRACKING 0
+# else
+#  define MEM_TRACKING 1
+# endif
+#endif
+
+enum
+{
+	MEM_LANG_PARSE,   /* program text and compiled functions */
+	MEM_LANG_RUNTIME, /* contexts, steppers and profiles */
+	MEM_WORLD,        /* worlds, robots and level packs */
+	MEM_RENDERER,
+	MEM_EDITOR,
+	MEM_AUDIO,
+	MEM_JOURNAL,      /* journals and replays */
+	MEM_MISC,
+	MEM_NTAGS
+};
+
+extern const char *mem_tag_names[MEM_NTAGS];
+
+#if MEM_TRACKING
+
+typedef struct
+{
+	size_t live, peak;    /* bytes */
+	unsigned long allocs; /* calls to mem_alloc, mem_calloc and mem_realloc */
+	unsigned long blocks; /* allocations not yet freed */
+} MemStats;
+
+void *mem_alloc(int tag, size_t size);
+void *mem_calloc(int tag, size_t n, size_t size);
+/* A block keeps the tag it was first allocated with. */
+void *mem_realloc(int tag, void *p, size_t size);
+void mem_free(void *p);
+
+/* Copy the counters of every tag into `out`. */
+void mem_stats(MemStats out[MEM_NTAGS]);
+/* Total calls to allocate so far, for counting allocations per operation. */
+unsigned long mem_allocs(void);
+
+#else
+
+# define mem_alloc(tag, size)      malloc(size)
+# define mem_calloc(tag, n, size)  calloc((n), (size))
+# define mem_realloc(tag, p, size) realloc((p), (size))
+# define mem_free(p)               free(p)
+# define mem_allocs()              0UL
+
+#endif
+
+
+#endif
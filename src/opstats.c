@@ -0,0 +1,124 @@
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+#include <opstats.h>
+
+#if LANG_OPSTATS
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+extern char *rbt_optos[];
+
+OpStats opstats[LANG_NOPS];
+
+/* Time spent in nested instructions, per nesting level. */
+static unsigned long long child_ns[OPSTATS_MAXDEPTH];
+static int depth;
+
+
+static
+unsigned long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+unsigned long long opstats_begin(void)
+{
+	if (depth < OPSTATS_MAXDEPTH)
+		child_ns[depth] = 0;
+	depth++;
+	return now_ns();
+}
+
+void opstats_end(LangOp op, unsigned long long start)
+{
+	unsigned long long dt = now_ns() - start;
+	depth--;
+
+	OpStats *s = &opstats[op];
+	s->count++;
+	s->total_ns += dt;
+	if (depth < OPSTATS_MAXDEPTH)
+		s->self_ns += dt - child_ns[depth];
+	if (depth > 0 && depth <= OPSTATS_MAXDEPTH)
+		child_ns[depth - 1] += dt;
+
+	int b = 0;
+	while ((dt >>= 1) && b < OPSTATS_BUCKETS - 1)
+		b++;
+	s->hist[b]++;
+}
+
+/* Upper bound of the bucket holding the `q`th fraction of the samples. */
+static
+unsigned long long percentile_ns(OpStats *s, double q)
+{
+	unsigned long seen = 0, want = s->count * q;
+	for (int b = 0 ; b < OPSTATS_BUCKETS ; b++)
+	{
+		seen += s->hist[b];
+		if (seen > want)
+			return 2ULL << b;
+	}
+	return 2ULL << (OPSTATS_BUCKETS - 1);
+}
+
+static
+int by_self_time(const void *a, const void *b)
+{
+	const OpStats *x = &opstats[*(const int *)a], *y = &opstats[*(const int *)b];
+	return (x->self_ns < y->self_ns) - (x->self_ns > y->self_ns);
+}
+
+void opstats_dump(FILE *fp)
+{
+	int order[LANG_NOPS], n = 0;
+	unsigned long long self_total = 0;
+	for (int i = 0 ; i < LANG_NOPS ; i++)
+	{
+		if (opstats[i].count)
+			order[n++] = i;
+		self_total += opstats[i].self_ns;
+	}
+	qsort(order, n, sizeof(order[0]), by_self_time);
+
+	fprintf(fp, "opstats: %-9s %10s %10s %11s %11s %6s %9s %9s %9s\n",
+		"op", "count", "fuel", "total ms", "self ms", "self%", "mean ns", "p50 ns", "p99 ns");
+	for (int k = 0 ; k < n ; k++)
+	{
+		OpStats *s = &opstats[order[k]];
+		fprintf(fp, "opstats: %-9s %10lu %10lu %11.3f %11.3f %6.1f %9.0f %9llu %9llu\n",
+			rbt_optos[order[k]], s->count, s->fuel, s->total_ns / 1e6, s->self_ns / 1e6,
+			self_total ? 100.0 * s->self_ns / self_total : 0.0,
+			(double)s->total_ns / s->count, percentile_ns(s, 0.5), percentile_ns(s, 0.99));
+	}
+
+	/* latency histograms, `<N` is the upper bound of each bucket in ns */
+	for (int k = 0 ; k < n ; k++)
+	{
+		OpStats *s = &opstats[order[k]];
+		fprintf(fp, "opstats: %-9s", rbt_optos[order[k]]);
+		for (int b = 0 ; b < OPSTATS_BUCKETS ; b++)
+		{
+			if (s->hist[b])
+				fprintf(fp, " <%llu:%lu", 2ULL << b, s->hist[b]);
+		}
+		fprintf(fp, "\n");
+	}
+	fflush(fp);
+}
+
+void opstats_dump_at_exit(void)
+{
+	opstats_dump(stderr);
+}
+
+void opstats_reset(void)
+{
+	memset(opstats, 0, sizeof(opstats));
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef __robots_opstats__
+#define __robots_opstats__
+
+
+/* Per-operation interpreter statistics. Only built with -DLANG_OPSTATS
+ * (`./run.sh --opstats`), otherwise every hook below compiles to nothing. */
+#if LANG_OPSTATS
+
+#include <stdio.h>
+#include <lang.h>
+
+
+/* Latency buckets, bucket `b` holds instructions that took [2^b, 2^(b+1)) ns. */
+#ifndef OPSTATS_BUCKETS
+# define OPSTATS_BUCKETS 40
+#endif
+
+/* Deepest `run` nesting that self time is tracked for. */
+#ifndef OPSTATS_MAXDEPTH
+# define OPSTATS_MAXDEPTH 64
+#endif
+
+
+typedef struct
+{
+	unsigned long count;
+	unsigned long fuel;          /* fuel charged by the operation itself */
+	unsigned long long total_ns; /* including the instructions it ran (`run`, `if`) */
+	unsigned long long self_ns;  /* excluding them */
+	unsigned long hist[OPSTATS_BUCKETS];
+} OpStats;
+
+extern OpStats opstats[];
+
+/* Start timing an instruction, returns its start time. */
+unsigned long long opstats_begin(void);
+/* Finish timing an instruction started with opstats_begin. */
+void opstats_end(LangOp op, unsigned long long start);
+/* Print a table sorted by self time followed by the histograms. */
+void opstats_dump(FILE *fp);
+/* For atexit(). */
+void opstats_dump_at_exit(void);
+void opstats_reset(void);
+
+# define opstats_fuel(op, n) (opstats[op].fuel += (n))
+
+#else
+
+# define opstats_fuel(op, n) ((void)0)
+
+#endif
+
+
+#endif
@@ -0,0 +1,63 @@
+#define _POSIX_C_SOURCE 200809L /* sysconf */
+#include <pthread.h>
+#include <unistd.h>
+#include <parallel.h>
+#include <trace.h>
+
+
+typedef struct
+{
+	ParallelTask task;
+	void *data;
+	int count;
+	int next; /* the next index to hand out, shared by every thread */
+} ParallelWork;
+
+static
+void parallel_drain(ParallelWork *work)
+{
+	int i;
+	while ((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->count)
+		work->task(work->data, i);
+}
+
+static
+void *parallel_main(void *arg)
+{
+	if (trace_enabled)
+		trace_thread_name("worker");
+	parallel_drain(arg);
+	return NULL;
+}
+
+int parallel_threads(int threads)
+{
+	if (threads > 0)
+		return threads;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? (int)cpus : 1;
+}
+
+/* Workers are started for each call rather than kept around: the callers
+ * (world generation) are rare and much slower than starting a thread. If a
+ * thread cannot be started the others, at least the caller, take its share. */
+void parallel_for(int threads, int count, ParallelTask task, void *data)
+{
+	ParallelWork work = { .task=task, .data=data, .count=count };
+	int n = parallel_threads(threads);
+	if (n > count)
+		n = count;
+	if (n > PARALLEL_MAX_THREADS)
+		n = PARALLEL_MAX_THREADS;
+
+	pthread_t workers[PARALLEL_MAX_THREADS];
+	int started = 0;
+	for (int i = 1 ; i < n ; i++)
+	{
+		if (pthread_create(&workers[started], NULL, parallel_main, &work) == 0)
+			started++;
+	}
+	parallel_drain(&work);
+	for (int i = 0 ; i < started ; i++)
+		pthread_join(workers[i], NULL);
+}
@@ -0,0 +1,21 @@
+#ifndef __robots_parallel__
+#define __robots_parallel__
+
+
+/* Upper bound on the threads a single parallel_for uses. */
+#ifndef PARALLEL_MAX_THREADS
+# define PARALLEL_MAX_THREADS 64
+#endif
+
+typedef void (*ParallelTask)(void *data, int index);
+
+/* The number of threads `parallel_for` uses for `threads`: itself, or one per
+ * online CPU if it is 0 or less. */
+int parallel_threads(int threads);
+/* Call `task(data, i)` for every i in [0, count) on up to `threads` threads,
+ * the calling one included, and return once all of them are done. Tasks are
+ * handed out one at a time, so they may run in any order and on any thread. */
+void parallel_for(int threads, int count, ParallelTask task, void *data);
+
+
+#endif
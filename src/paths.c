@@ -0,0 +1,313 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <paths.h>
+#include <trace.h>
+#include <mem.h>
+
+
+#define REPAIRING (-2) /* `source` of a tile whose distance is being repaired */
+
+
+Paths *paths_new(int width, int height)
+{
+	Paths *p = mem_calloc(MEM_WORLD, 1, sizeof(Paths));
+	p->width = width;
+	p->height = height;
+	p->scratch = mem_alloc(MEM_WORLD, 2 * (size_t)width * height * sizeof(int));
+	return p;
+}
+
+static
+void field_free(DistField *f)
+{
+	mem_free(f->dist);
+	mem_free(f->source);
+}
+
+void paths_free(Paths *p)
+{
+	if (!p)
+		return;
+	field_free(&p->fuel);
+	field_free(&p->robots);
+	for (int i = 0 ; i < PATHS_TARGETS ; i++)
+		field_free(&p->targets[i]);
+	mem_free(p->scratch);
+	mem_free(p);
+}
+
+void paths_invalidate(Paths *p)
+{
+	p->fuel.valid = false;
+	p->robots.valid = false;
+	for (int i = 0 ; i < PATHS_TARGETS ; i++)
+		p->targets[i].valid = false;
+}
+
+
+/* Spread the distances outward from the `nsources` tiles at the front of
+ * `queue`, which must already have their distance and source set. */
+static
+void field_spread(Paths *p, DistField *f, const Bitset *walls, int *queue, int nsources)
+{
+	int w = p->width, h = p->height;
+	for (int head = 0, tail = nsources ; head < tail ; head++)
+	{
+		int t = queue[head], x = t % w, y = t / w;
+		for (int d = 0 ; d < 4 ; d++)
+		{
+			int nx = x + direction_dx[d], ny = y + direction_dy[d];
+			if (nx < 0 || ny < 0 || nx >= w || ny >= h || bitset_get(walls, nx, ny))
+				continue;
+			int n = ny * w + nx;
+			if (f->dist[n] != INT_MAX)
+				continue;
+			f->dist[n] = f->dist[t] + 1;
+			f->source[n] = f->source[t];
+			queue[tail++] = n;
+		}
+	}
+}
+
+static
+void field_build(Paths *p, DistField *f, World *world, Robots *rs, PathKind kind)
+{
+	unsigned long long traced = trace_begin();
+	long n = (long)p->width * p->height;
+	if (!f->dist)
+	{
+		f->dist = mem_alloc(MEM_WORLD, n * sizeof(int));
+		f->source = mem_alloc(MEM_WORLD, n * sizeof(int));
+	}
+	for (long i = 0 ; i < n ; i++)
+	{
+		f->dist[i] = INT_MAX;
+		f->source[i] = -1;
+	}
+
+	int *queue = p->scratch, nsources = 0;
+	switch (kind)
+	{
+	case PATH_FUEL:
+		for (int y = 0 ; y < p->height ; y++)
+		{
+			const uint64_t *row = bitset_row(&world->energy, y);
+			for (int i = 0 ; i < world->energy.stride ; i++)
+			{
+				for (uint64_t bits = row[i] ; bits ; bits &= bits - 1)
+					queue[nsources++] = y * p->width + i * 64 + __builtin_ctzll(bits);
+			}
+		}
+		break;
+	case PATH_ROBOTS:
+		for (int k = 0 ; k < rs->nlive ; k++)
+		{
+			int i = rs->live[k];
+			if (!(rs->flags[i] & ROBOT_PLAYER))
+				queue[nsources++] = rs->y[i] * p->width + rs->x[i];
+		}
+		break;
+	case PATH_TARGET:
+		if (!bitset_get(&world->walls, f->target % p->width, f->target / p->width))
+			queue[nsources++] = f->target;
+		break;
+	}
+	for (int i = 0 ; i < nsources ; i++)
+	{
+		f->dist[queue[i]] = 0;
+		f->source[queue[i]] = queue[i];
+	}
+	field_spread(p, f, &world->walls, queue, nsources);
+	f->valid = true;
+	trace_end(traced, "paths", "build");
+}
+
+static
+int compare_dist(const void *a, const void *b)
+{
+	const int *x = a, *y = b;
+	return (x[0] > y[0]) - (x[0] < y[0]);
+}
+
+/* Take the source tile `s` out of a field. Only the tiles that had `s` as their
+ * nearest source can get further away, and each of them now gets its distance
+ * from the tiles around that area, which are still right. */
+static
+void field_remove_source(Paths *p, DistField *f, int s)
+{
+	if (!f->valid || f->source[s] != s || f->dist[s] != 0)
+		return;
+	unsigned long long traced = trace_begin();
+	int w = p->width, h = p->height;
+
+	/* every tile that was closest to `s`, which are connected through each other */
+	int *area = p->scratch, narea = 0;
+	area[narea++] = s;
+	f->source[s] = REPAIRING;
+	for (int i = 0 ; i < narea ; i++)
+	{
+		int t = area[i], x = t % w, y = t / w;
+		for (int d = 0 ; d < 4 ; d++)
+		{
+			int nx = x + direction_dx[d], ny = y + direction_dy[d];
+			if (nx < 0 || ny < 0 || nx >= w || ny >= h)
+				continue;
+			int n = ny * w + nx;
+			if (f->source[n] == s)
+			{
+				f->source[n] = REPAIRING;
+				area[narea++] = n;
+			}
+		}
+	}
+
+	/* the tiles around the area, as (distance, tile) pairs nearest first */
+	int *edge = mem_alloc(MEM_WORLD, 4 * 2 * (size_t)narea * sizeof(int)), nedge = 0;
+	for (int i = 0 ; i < narea ; i++)
+	{
+		int t = area[i], x = t % w, y = t / w;
+		f->dist[t] = INT_MAX;
+		for (int d = 0 ; d < 4 ; d++)
+		{
+			int nx = x + direction_dx[d], ny = y + direction_dy[d];
+			if (nx < 0 || ny < 0 || nx >= w || ny >= h)
+				continue;
+			int n = ny * w + nx;
+			if (f->source[n] >= 0)
+			{
+				edge[2 * nedge] = f->dist[n];
+				edge[2 * nedge + 1] = n;
+				nedge++;
+			}
+		}
+	}
+	qsort(edge, nedge, 2 * sizeof(int), compare_dist);
+
+	/* a breadth-first search into the area that starts from every edge tile at
+	 * its own distance: taking whichever of the next edge tile and the head of
+	 * the queue is nearer visits the tiles in order of distance */
+	int *queue = p->scratch + (long)w * h, head = 0, tail = 0;
+	for (int e = 0 ; e < nedge || head < tail ; )
+	{
+		int t;
+		if (head < tail && (e == nedge || f->dist[queue[head]] <= edge[2 * e]))
+			t = queue[head++];
+		else
+			t = edge[2 * e++ + 1];
+		int x = t % w, y = t / w;
+		for (int d = 0 ; d < 4 ; d++)
+		{
+			int nx = x + direction_dx[d], ny = y + direction_dy[d];
+			if (nx < 0 || ny < 0 || nx >= w || ny >= h)
+				continue;
+			int n = ny * w + nx;
+			if (f->source[n] != REPAIRING)
+				continue;
+			f->dist[n] = f->dist[t] + 1;
+			f->source[n] = f->source[t];
+			queue[tail++] = n;
+		}
+	}
+	mem_free(edge);
+
+	/* whatever is left has been cut off from every other source */
+	for (int i = 0 ; i < narea ; i++)
+	{
+		if (f->source[area[i]] == REPAIRING)
+			f->source[area[i]] = -1;
+	}
+	trace_end(traced, "paths", "repair");
+}
+
+void paths_tile_changed(Paths *p, int x, int y, int old, int tile)
+{
+	if (old == tile)
+		return;
+	if (old == TILE_WALL || tile == TILE_WALL)
+		paths_invalidate(p);
+	else if (old == TILE_ENERGY)
+		field_remove_source(p, &p->fuel, y * p->width + x);
+	else if (tile == TILE_ENERGY)
+		p->fuel.valid = false;
+}
+
+void paths_robot_removed(Paths *p, int x, int y)
+{
+	field_remove_source(p, &p->robots, y * p->width + x);
+}
+
+void paths_robots_moved(Paths *p)
+{
+	p->robots.valid = false;
+}
+
+
+static
+DistField *paths_field(Paths *p, State *state, PathKind kind, int target)
+{
+	DistField *f = NULL;
+	switch (kind)
+	{
+	case PATH_FUEL:   f = &p->fuel; break;
+	case PATH_ROBOTS: f = &p->robots; break;
+	case PATH_TARGET:
+		/* the field for this target, or else the one used longest ago */
+		for (int i = 0 ; i < PATHS_TARGETS ; i++)
+		{
+			DistField *t = &p->targets[i];
+			if (t->valid && t->target == target)
+			{
+				f = t;
+				break;
+			}
+			if (!f || !t->valid || (f->valid && t->used < f->used))
+				f = t;
+		}
+		if (!f->valid || f->target != target)
+		{
+			f->valid = false;
+			f->target = target;
+		}
+		break;
+	}
+	f->used = ++p->clock;
+	if (!f->valid)
+		field_build(p, f, state->world, &state->robots, kind);
+	return f;
+}
+
+int paths_toward(State *state, int id, PathKind kind, int tx, int ty, Direction *dir)
+{
+	World *w = state->world;
+	Robots *rs = &state->robots;
+	if (!w->paths)
+		w->paths = paths_new(w->width, w->height);
+
+	DistField *f = paths_field(w->paths, state, kind, ty * w->width + tx);
+	int x = rs->x[id], y = rs->y[id];
+	int here = f->dist[y * w->width + x];
+	if (here == INT_MAX)
+		return PATH_UNREACHABLE;
+	if (here == 0)
+		return 0;
+
+	/* any neighbour one step closer will do, the robot's own heading is tried
+	 * first so that it keeps going straight where it can */
+	int best = -1;
+	for (int k = -1 ; k < 4 ; k++)
+	{
+		int d = k < 0 ? (int)rs->dir[id] : k;
+		int nx = x + direction_dx[d], ny = y + direction_dy[d];
+		if (!in_bounds(w, nx, ny) || f->dist[ny * w->width + nx] != here - 1)
+			continue;
+		if (best < 0)
+			best = d;
+		if (!bitset_get(&w->robots, nx, ny))
+		{
+			best = d;
+			break;
+		}
+	}
+	*dir = best;
+	return here;
+}
@@ -0,0 +1,63 @@
+#ifndef __robots_paths__
+#define __robots_paths__
+
+
+#include <stdbool.h>
+#include <common.h>
+
+
+#define PATH_UNREACHABLE (-1)
+#define PATHS_TARGETS 4 /* `goto` targets whose fields are kept at once */
+
+typedef enum
+{
+	PATH_FUEL,   /* the nearest fuel canister */
+	PATH_ROBOTS, /* the nearest enemy robot */
+	PATH_TARGET, /* a single tile */
+} PathKind;
+
+/* The number of steps from every tile to the nearest of a set of source
+ * tiles, going around walls. Robots are not obstacles here: they move and
+ * get disassembled far more often than walls change, so they are dealt with
+ * when a step is taken instead. */
+typedef struct
+{
+	bool valid;
+	int target;    /* the source tile of a PATH_TARGET field */
+	unsigned used; /* when it was last asked for, the oldest is rebuilt first */
+	int *dist;     /* INT_MAX where no source can be reached */
+	int *source;   /* the index of the nearest source, -1 where there is none */
+} DistField;
+
+/* The distance fields of a world. Each one is built by a breadth-first search
+ * the first time it is needed and then kept until the world changes under it:
+ * fuel that is used up or an enemy that is disassembled only repairs the
+ * tiles that were closest to it, while new walls or fuel throw fields away. */
+struct rbt_paths
+{
+	int width, height;
+	DistField fuel, robots;
+	DistField targets[PATHS_TARGETS];
+	unsigned clock;
+	int *scratch; /* two queues of width * height tiles */
+};
+
+Paths *paths_new(int width, int height);
+void paths_free(Paths *p);
+/* Drop every field, for when the world was rewritten wholesale. */
+void paths_invalidate(Paths *p);
+/* Keep the fields in step with a tile going from `old` to `tile`. */
+void paths_tile_changed(Paths *p, int x, int y, int old, int tile);
+/* Keep the fields in step with the enemy robot at (x, y) being disassembled. */
+void paths_robot_removed(Paths *p, int x, int y);
+/* Drop the field of the enemy robots, for when one of them moved. */
+void paths_robots_moved(Paths *p);
+
+/* How many steps robot `id` is from the nearest source of `kind` (for
+ * PATH_TARGET the tile tx, ty), or PATH_UNREACHABLE. When it is not there yet,
+ * `*dir` is set to a neighbouring tile one step closer, preferring one that no
+ * robot stands on and then the way the robot already faces. */
+int paths_toward(State *state, int id, PathKind kind, int tx, int ty, Direction *dir);
+
+
+#endif
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <prefetch.h>
+#include <trace.h>
+
+
+static
+void *prefetch_main(void *arg)
+{
+	LevelPrefetch *p = arg;
+	if (trace_enabled)
+		trace_thread_name("prefetch");
+	unsigned long long traced = trace_begin();
+	free_state(p->retired);
+	p->retired = NULL;
+	p->state = p->build(p->data, p->level, p->seed);
+	trace_end(traced, "world", "prefetch");
+	return NULL;
+}
+
+void prefetch_start(LevelPrefetch *p, LevelBuildFn build, void *data, int level, long seed, State *retired)
+{
+	prefetch_cancel(p);
+	p->build = build;
+	p->data = data;
+	p->level = level;
+	p->seed = seed;
+	p->retired = retired;
+	p->state = NULL;
+	p->started = pthread_create(&p->thread, NULL, prefetch_main, p) == 0;
+	if (!p->started)
+	{
+		fprintf(stderr, "warning: failed to start building level %d in the background\n", level);
+		free_state(retired);
+		p->retired = NULL;
+	}
+}
+
+State *prefetch_take(LevelPrefetch *p, int level)
+{
+	if (!p->started)
+		return NULL;
+	if (p->level != level)
+	{
+		prefetch_cancel(p);
+		return NULL;
+	}
+	pthread_join(p->thread, NULL);
+	p->started = false;
+	State *state = p->state;
+	p->state = NULL;
+	return state;
+}
+
+void prefetch_cancel(LevelPrefetch *p)
+{
+	if (!p->started)
+		return;
+	pthread_join(p->thread, NULL);
+	p->started = false;
+	free_state(p->state);
+	p->state = NULL;
+}
@@ -0,0 +1,38 @@
+#ifndef __robots_prefetch__
+#define __robots_prefetch__
+
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <common.h>
+
+
+/* Builds the state of a level. Called on a worker thread, so it may only touch
+ * `data` in ways that are safe while the game keeps running. */
+typedef State *(*LevelBuildFn)(void *data, int level, long seed);
+
+/* Builds the next level on a worker thread while the current one is played,
+ * so that moving on only has to swap in the finished state. */
+typedef struct
+{
+	pthread_t thread;
+	bool started;
+	LevelBuildFn build;
+	void *data;
+	int level;
+	long seed;
+	State *retired; /* freed by the worker before it builds */
+	State *state;   /* written by the worker, read after joining it */
+} LevelPrefetch;
+
+/* Start building `level`. Anything still prefetched is discarded first.
+ * `retired` (may be NULL) is a finished level to free on the worker too. */
+void prefetch_start(LevelPrefetch *p, LevelBuildFn build, void *data, int level, long seed, State *retired);
+/* The prefetched state for `level`, waiting for it if it is not done yet.
+ * NULL if a different level (or nothing) was being built, which is then freed. */
+State *prefetch_take(LevelPrefetch *p, int level);
+/* Wait for the worker and free whatever it built. */
+void prefetch_cancel(LevelPrefetch *p);
+
+
+#endif
@@ -14,7 +14,7 @@ void render_test_logic(Renderer *renderer, State *state)
 {
 	static int last_move = MOVE_NONE;
 
-	Robot *player = &state->robots[0];
+	Robots *rs = &state->robots;
 	RobotVisual *player_visual = renderer_get_visual(renderer, 0);
 
 	// Test movement input
@@ -22,8 +22,8 @@ void render_test_logic(Renderer *renderer, State *state)
 	{
 		if (IsKeyPressed(KEY_UP))
 		{
-			robot_forward(player);
-			robot_visual_move_to(player_visual, player->x, player->y);
+			robot_forward(state, 0);
+			robot_visual_move_to(player_visual, rs->x[0], rs->y[0]);
 			if (last_move != MOVE_FORWARD)
 			{
 				play_sfx(SFX_ADVANCING);
@@ -32,8 +32,8 @@ void render_test_logic(Renderer *renderer, State *state)
 		}
 		else if (IsKeyPressed(KEY_DOWN))
 		{
-			robot_backward(player);
-			robot_visual_move_to(player_visual, player->x, player->y);
+			robot_backward(state, 0);
+			robot_visual_move_to(player_visual, rs->x[0], rs->y[0]);
 			if (last_move != MOVE_BACKWARD)
 			{
 				play_sfx(SFX_REVERSE);
@@ -42,8 +42,8 @@ void render_test_logic(Renderer *renderer, State *state)
 		}
 		else if (IsKeyPressed(KEY_LEFT))
 		{
-			robot_turn_left(player);
-			robot_visual_rotate_to(player_visual, player->dir);
+			robot_turn_left(rs, 0);
+			robot_visual_rotate_to(player_visual, rs->dir[0]);
 			if (last_move != MOVE_ROTATE)
 			{
 				play_sfx(SFX_ROTATING);
@@ -52,8 +52,8 @@ void render_test_logic(Renderer *renderer, State *state)
 		}
 		else if (IsKeyPressed(KEY_RIGHT))
 		{
-			robot_turn_right(player);
-			robot_visual_rotate_to(player_visual, player->dir);
+			robot_turn_right(rs, 0);
+			robot_visual_rotate_to(player_visual, rs->dir[0]);
 			if (last_move != MOVE_ROTATE)
 			{
 				play_sfx(SFX_ROTATING);
@@ -65,36 +65,27 @@ void render_test_logic(Renderer *renderer, State *state)
 	// Test: press B to disassemble a random robot that hasn't been disassembled
 	if (IsKeyPressed(KEY_B))
 	{
-		int available[MAX_ROBOTS];
-		int available_count = 0;
-
-		for (int i = 0; i < state->robot_count; i++)
+		if (rs->nlive > 0)
 		{
-			if (!robot_visual_is_disassembled(renderer_get_visual(renderer, i)))
+			int idx = rs->live[rand() % rs->nlive];
+			if (!robot_visual_is_disassembled(renderer_get_visual(renderer, idx)))
 			{
-				available[available_count++] = i;
+				renderer_disassemble(renderer, idx);
+				play_sfx(SFX_DISASSEMBLED);
 			}
 		}
-
-		if (available_count > 0)
-		{
-			int idx = available[rand() % available_count];
-			RobotVisual *v = renderer_get_visual(renderer, idx);
-			robot_visual_disassemble(v, &renderer->disassembly_anims[idx]);
-			play_sfx(SFX_DISASSEMBLED);
-		}
 	}
 
 	// Test: press R to ram in the player's current direction
 	if (IsKeyPressed(KEY_R) && !robot_visual_is_animating(player_visual))
 	{
-		robot_visual_ram(player_visual, player->dir);
+		robot_visual_ram(player_visual, rs->dir[0]);
 	}
 
 	// Test: press F to set fuel to zero (triggers game over)
 	if (IsKeyPressed(KEY_F))
 	{
-		player->fuel = 0;
+		rs->fuel[0] = 0;
 	}
 
 	// Test: press G to fill fog of war
@@ -110,7 +101,7 @@ void render_test_logic(Renderer *renderer, State *state)
 		{
 			for (int dx = -1; dx <= 1; dx++)
 			{
-				renderer_set_fog(renderer, player->x + dx, player->y + dy, false);
+				renderer_set_fog(renderer, rs->x[0] + dx, rs->y[0] + dy, false);
 			}
 		}
 	}
@@ -1,12 +1,17 @@
 #include <rendering.h>
 #include <common.h>
 #include <lang.h>
+#include <journal.h>
+#include <frametime.h>
+#include <trace.h>
+#include <sight.h>
 #include <ui.h>
 #include <math.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mem.h>
 
 // Forward declarations
 static void render_fog(Renderer *r, World *w, int screen_x, int screen_y);
@@ -27,7 +32,9 @@ static float direction_to_angle(Direction dir)
 Tileset load_tileset(const char *path)
 {
 	Tileset ts;
+	unsigned long long traced = trace_begin();
 	ts.texture = LoadTexture(path);
+	trace_end_path(traced, "asset", "load_tileset", path);
 	ts.cols = ts.texture.width / TILE_SIZE;
 	ts.rows = ts.texture.height / TILE_SIZE;
 	return ts;
@@ -69,10 +76,51 @@ void begin_virtual_drawing(RenderTexture2D target)
 	ClearBackground(BLACK);
 }
 
+#if MEM_TRACKING
+static bool mem_overlay = false;
+static unsigned long mem_last_allocs[MEM_NTAGS];
+
+void toggle_mem_overlay(void)
+{
+	mem_overlay = !mem_overlay;
+}
+
+// Live and peak heap per subsystem, and the allocations made since the last frame
+static void draw_mem_overlay(int x, int y)
+{
+	MemStats stats[MEM_NTAGS];
+	mem_stats(stats);
+
+	const int size = 8;
+	DrawRectangle(x, y, 150, size * (MEM_NTAGS + 1) + 2, (Color){ 0, 0, 0, 180 });
+	DrawText("heap KB   live   peak  /frame", x + 2, y + 1, size, WHITE);
+	for (int i = 0; i < MEM_NTAGS; i++)
+	{
+		unsigned long per_frame = stats[i].allocs - mem_last_allocs[i];
+		mem_last_allocs[i] = stats[i].allocs;
+		DrawText(TextFormat("%-12s %6.1f %6.1f %5lu", mem_tag_names[i], stats[i].live / 1024.0, stats[i].peak / 1024.0, per_frame),
+			x + 2, y + 1 + size * (i + 1), size, per_frame ? ORANGE : YELLOW);
+	}
+}
+#else
+void toggle_mem_overlay(void)
+{
+}
+#endif
+
 void end_virtual_drawing(RenderTexture2D target)
 {
+	// Frame timings go over every screen, F3 toggles them
+	frametime_draw(VIRTUAL_WIDTH - 94, 2);
+#if MEM_TRACKING
+	// Heap use goes on the other side, F4 toggles it
+	if (mem_overlay)
+		draw_mem_overlay(2, 2);
+#endif
 	EndTextureMode();
 
+	frametime_begin(PHASE_PRESENT);
+
 	BeginDrawing();
 	ClearBackground(BLACK);
 
@@ -81,15 +129,18 @@ void end_virtual_drawing(RenderTexture2D target)
 	DrawTexturePro(target.texture, src, dst, (Vector2){ 0, 0 }, 0.0f, WHITE);
 
 	EndDrawing();
+	frametime_end(PHASE_PRESENT);
 }
 
 Animation load_animation(const char *path, int fps, bool looping)
 {
 	Animation anim;
 	int frames = 0;
+	unsigned long long traced = trace_begin();
 	anim.image = LoadImageAnim(path, &frames);
 
 	anim.texture = LoadTextureFromImage(anim.image);
+	trace_end_path(traced, "asset", "load_animation", path);
 	SetTextureFilter(anim.texture, TEXTURE_FILTER_POINT);
 	anim.frame_count = frames;
 	anim.frame_width = anim.image.width;
@@ -334,28 +385,32 @@ void robot_visual_ram(RobotVisual *v, Direction dir)
 	v->animating = true;
 }
 
-void render_robots(State *state, RobotVisual *visuals, Animation *player_anim, Animation *enemy_anim, int screen_x, int screen_y)
+void render_robots(State *state, RobotVisual *visuals, Animation *player_anim, Animation *enemy_anim, int *disassembling, int ndisassembling, int screen_x, int screen_y)
 {
-	for (int i = 0; i < state->robot_count; i++)
+	Robots *rs = &state->robots;
+
+	// Robots that are still in play
+	for (int k = 0; k < rs->nlive; k++)
 	{
-		Robot *r = &state->robots[i];
+		int i = rs->live[k];
 		RobotVisual *v = &visuals[i];
-		int px = screen_x + (int)v->x;
-		int py = screen_y + (int)v->y;
-
 		if (v->disassembled)
+			continue;
+
+		Animation *anim = robot_is_player(rs, i) ? player_anim : enemy_anim;
+		draw_animation_rotated_angle(anim, screen_x + (int)v->x, screen_y + (int)v->y, v->rotation);
+	}
+
+	// Robots that are mid-disassembly
+	for (int k = 0; k < ndisassembling; k++)
+	{
+		RobotVisual *v = &visuals[disassembling[k]];
+
+		// Don't render if animation finished
+		if (v->disassembly_anim && !animation_finished(v->disassembly_anim))
 		{
-			// Don't render if animation finished
-			if (v->disassembly_anim && !animation_finished(v->disassembly_anim))
-			{
-				// Draw without rotation
-				draw_animation(v->disassembly_anim, px, py);
-			}
-		}
-		else
-		{
-			Animation *anim = r->is_player ? player_anim : enemy_anim;
-			draw_animation_rotated_angle(anim, px, py, v->rotation);
+			// Draw without rotation
+			draw_animation(v->disassembly_anim, screen_x + (int)v->x, screen_y + (int)v->y);
 		}
 	}
 }
@@ -367,7 +422,7 @@ void draw_hud(State *state, int fuel, int enemy_count, int level)
 	int y = 2;  // At top of screen
 
 	// Build status line and center it
-	snprintf(buffer, sizeof(buffer), "Fuel: %d/%d  Enemies: %d  Level: %d", fuel, MAX_FUEL, enemy_count, level);
+	snprintf(buffer, sizeof(buffer), "Fuel: %d/%d  Enemies: %d  Level: %d", fuel, state->robots.max_fuel, enemy_count, level);
 	int text_width = MeasureText(buffer, font_size);
 	int x = (VIRTUAL_WIDTH - text_width) / 2;
 	DrawText(buffer, x, y, font_size, WHITE);
@@ -380,31 +435,40 @@ void draw_hud(State *state, int fuel, int enemy_count, int level)
 		x = (VIRTUAL_WIDTH - text_width) / 2;
 		DrawText(buffer, x, y + font_size + 1, font_size, WHITE);
 	}
+	else if (state->journal && state->journal->nsteps > 0)
+	{
+		snprintf(buffer, sizeof(buffer), "Step: %d/%u  [ ] to scrub", state->stepper->n, state->journal->nsteps);
+		text_width = MeasureText(buffer, font_size);
+		x = (VIRTUAL_WIDTH - text_width) / 2;
+		DrawText(buffer, x, y + font_size + 1, font_size, WHITE);
+	}
 }
 
 Renderer *init_renderer(void)
 {
-	Renderer *r = malloc(sizeof(Renderer));
+	Renderer *r = mem_alloc(MEM_RENDERER, sizeof(Renderer));
 
 	r->target = init_render_target();
 	r->tileset = load_tileset("assets/tiles.png");
 	r->player_anim = load_animation("assets/robot.gif", ANIM_FPS_ROBOT, true);
 	r->enemy_anim = load_animation("assets/enemy.gif", ANIM_FPS_ROBOT, true);
 
-	for (int i = 0; i < MAX_ROBOTS; i++)
-	{
-		r->disassembly_anims[i] = load_animation("assets/rapid_disassembly.gif", ANIM_FPS_DISASSEMBLY, false);
-	}
+	r->visuals_cap = 0;
+	r->visuals = NULL;
+	r->disassembly_anims = NULL;
+	r->disassembling = NULL;
+	r->ndisassembling = 0;
 
 	r->level = 1;
 
 	// Fog of war
+	unsigned long long traced = trace_begin();
 	r->fog_texture = LoadTexture("assets/fog_of_war.png");
+	trace_end_path(traced, "asset", "load_texture", "assets/fog_of_war.png");
 	r->fog_scroll = 0.0f;
-	for (int i = 0; i < MAX_WORLD_WIDTH * MAX_WORLD_HEIGHT; i++)
-	{
-		r->fog_map[i] = false;
-	}
+	r->fog = (Bitset){ 0 };
+	r->sight = (Bitset){ 0 };
+	r->sight_valid = false;
 
 	// Initialize buttons - positioned at bottom of HUD area
 	int start_x = (VIRTUAL_WIDTH - (BTN_WIDTH * BTN_COUNT + BTN_GAP * (BTN_COUNT - 1))) / 2;
@@ -424,6 +488,8 @@ Renderer *init_renderer(void)
 
 	/* Initialize notifications */
 	r->notification_msg = NULL;
+	r->console_open = false;
+	r->console_scroll = 0;
 
 	return r;
 }
@@ -432,41 +498,72 @@ void free_renderer(Renderer *r)
 {
 	unload_animation(&r->player_anim);
 	unload_animation(&r->enemy_anim);
-	for (int i = 0; i < MAX_ROBOTS; i++)
+	for (int i = 0; i < r->visuals_cap; i++)
 	{
-		unload_animation(&r->disassembly_anims[i]);
+		if (r->disassembly_anims[i].frame_count > 0)
+			unload_animation(&r->disassembly_anims[i]);
 	}
+	mem_free(r->visuals);
+	mem_free(r->disassembly_anims);
+	mem_free(r->disassembling);
 	unload_tileset(&r->tileset);
 	UnloadTexture(r->fog_texture);
+	bitset_free(&r->fog);
+	bitset_free(&r->sight);
 	UnloadRenderTexture(r->target);
-	free(r);
+	editor_free(&r->editor);
+	mem_free(r);
 }
 
 void renderer_sync_visuals(Renderer *r, State *state)
 {
-	for (int i = 0; i < state->robot_count; i++)
+	Robots *rs = &state->robots;
+
+	// Grow the per-robot arrays to match the new robot count
+	if (rs->count > r->visuals_cap)
+	{
+		int newcap = rs->count;
+		r->visuals = mem_realloc(MEM_RENDERER, r->visuals, newcap * sizeof(*r->visuals));
+		r->disassembly_anims = mem_realloc(MEM_RENDERER, r->disassembly_anims, newcap * sizeof(*r->disassembly_anims));
+		r->disassembling = mem_realloc(MEM_RENDERER, r->disassembling, newcap * sizeof(*r->disassembling));
+		memset(&r->disassembly_anims[r->visuals_cap], 0, (newcap - r->visuals_cap) * sizeof(*r->disassembly_anims));
+		r->visuals_cap = newcap;
+	}
+
+	for (int i = 0; i < rs->count; i++)
 	{
-		Robot *robot = &state->robots[i];
-		robot_visual_init(&r->visuals[i], robot->x, robot->y, robot->dir);
+		robot_visual_init(&r->visuals[i], rs->x[i], rs->y[i], rs->dir[i]);
 	}
+	r->ndisassembling = 0;
 }
 
 void renderer_update(Renderer *r, State *state, float speed)
 {
+	Robots *rs = &state->robots;
+
 	// Update sprite animations
 	update_animation(&r->player_anim);
 	update_animation(&r->enemy_anim);
-	for (int i = 0; i < state->robot_count; i++)
+	for (int k = 0; k < r->ndisassembling; k++)
 	{
-		update_animation(&r->disassembly_anims[i]);
+		Animation *anim = &r->disassembly_anims[r->disassembling[k]];
+		update_animation(anim);
+
+		// Drop finished animations so that the list only holds robots still on screen
+		if (animation_finished(anim))
+		{
+			r->disassembling[k--] = r->disassembling[--r->ndisassembling];
+		}
 	}
 
 	// Update robot visual animations (smooth movement/rotation)
-	for (int i = 0; i < state->robot_count; i++)
+	for (int k = 0; k < rs->nlive; k++)
 	{
-		robot_visual_update(&r->visuals[i], speed);
+		robot_visual_update(&r->visuals[rs->live[k]], speed);
 	}
 
+	renderer_look(r, state);
+
 	// Update fog scroll (slow scroll to the left)
 	r->fog_scroll += FOG_SCROLL_SPEED;
 	if (r->fog_scroll >= TILE_SIZE)
@@ -475,6 +572,43 @@ void renderer_update(Renderer *r, State *state, float speed)
 	}
 }
 
+void renderer_toggle_console(Renderer *r)
+{
+	r->console_open = !r->console_open;
+	r->console_scroll = 0;
+}
+
+// The most recent prints, newest at the bottom, scrolled with the mouse wheel
+static void draw_console(Renderer *r, LangPrints *prints)
+{
+	const int size = HUD_FONT_SIZE;
+	const int x = 4, y = HUD_TOP_MARGIN + 2;
+	const int width = VIRTUAL_WIDTH - 8, height = size * (CONSOLE_LINES + 1) + 4;
+
+	int count = (int)print_count(prints);
+	int max_scroll = count > CONSOLE_LINES ? count - CONSOLE_LINES : 0;
+	r->console_scroll += (int)GetMouseWheelMove();
+	if (r->console_scroll > max_scroll)
+		r->console_scroll = max_scroll;
+	if (r->console_scroll < 0)
+		r->console_scroll = 0;
+
+	DrawRectangle(x, y, width, height, (Color){ 0, 0, 0, 200 });
+	DrawRectangleLines(x, y, width, height, BTN_BORDER);
+	const char *title = r->console_scroll ? TextFormat("print (%d back)", r->console_scroll) : "print";
+	DrawText(title, x + 3, y + 2, size, BTN_BORDER);
+
+	int shown = count - r->console_scroll < CONSOLE_LINES ? count - r->console_scroll : CONSOLE_LINES;
+	for (int i = 0; i < shown; i++)
+	{
+		// row 0 is the oldest shown
+		LangPrint *p = print_recent(prints, r->console_scroll + shown - 1 - i);
+		int ly = y + 2 + size * (i + 1);
+		DrawText(TextFormat("%4d", p->line), x + 3, ly, size, GRAY);
+		DrawText(TextFormat("%d", p->value), x + 30, ly, size, WHITE);
+	}
+}
+
 void renderer_render(Renderer *r, State *state)
 {
 	begin_virtual_drawing(r->target);
@@ -484,25 +618,15 @@ void renderer_render(Renderer *r, State *state)
 	int world_height = state->world->height * TILE_SIZE;
 	int offset_y = HUD_TOP_MARGIN + (BTN_Y - HUD_TOP_MARGIN - world_height) / 2;
 	render_world(&r->tileset, state->world, offset_x, offset_y);
-	render_robots(state, r->visuals, &r->player_anim, &r->enemy_anim, offset_x, offset_y);
+	render_robots(state, r->visuals, &r->player_anim, &r->enemy_anim, r->disassembling, r->ndisassembling, offset_x, offset_y);
 	render_fog(r, state->world, offset_x, offset_y);
 
 	// Calculate enemy count for HUD
-	int enemy_count = 0;
-	Robot *player = NULL;
-	for (int i = 0; i < state->robot_count; i++)
-	{
-		if (state->robots[i].is_player)
-		{
-			player = &state->robots[i];
-		}
-		else if (!robot_visual_is_disassembled(&r->visuals[i]))
-		{
-			enemy_count++;
-		}
-	}
+	Robots *rs = &state->robots;
+	int enemy_count = robots_alive_enemies(rs);
+	bool has_player = rs->count > 0 && robot_is_player(rs, 0);
 
-	int fuel = player ? player->fuel : 0;
+	int fuel = has_player ? rs->fuel[0] : 0;
 	draw_hud(state, fuel, enemy_count, r->level);
 
 	// Draw buttons (only if editor is not active)
@@ -517,6 +641,9 @@ void renderer_render(Renderer *r, State *state)
 	// Draw editor on top if active
 	editor_draw(&r->editor);
 
+	if (r->console_open && !editor_is_active(&r->editor))
+		draw_console(r, &state->stepper->ctx->prints);
+
 	/* Draw notification if present */
 	if (r->notification_msg)
 	{
@@ -563,7 +690,10 @@ void renderer_render(Renderer *r, State *state)
 	int size = 8;
 	int y = 0;
 	DrawText(TextFormat("FPS: %d", GetFPS()), 0, y, size, RED); y += size;
-	DrawText(TextFormat("Pos: %d,%d", player->x, player->y), 0, y, size, RED); y += size;
+	if (has_player)
+	{
+		DrawText(TextFormat("Pos: %d,%d", rs->x[0], rs->y[0]), 0, y, size, RED); y += size;
+	}
 	#endif
 
 	end_virtual_drawing(r->target);
@@ -574,39 +704,89 @@ RobotVisual *renderer_get_visual(Renderer *r, int index)
 	return &r->visuals[index];
 }
 
+void renderer_disassemble(Renderer *r, int index)
+{
+	Animation *anim = &r->disassembly_anims[index];
+
+	// Animations are only loaded for robots that actually get disassembled
+	if (anim->frame_count == 0)
+	{
+		*anim = load_animation("assets/rapid_disassembly.gif", ANIM_FPS_DISASSEMBLY, false);
+	}
+
+	robot_visual_disassemble(&r->visuals[index], anim);
+	r->disassembling[r->ndisassembling++] = index;
+}
+
 void renderer_set_fog(Renderer *r, int x, int y, bool fogged)
 {
-	if (x >= 0 && x < MAX_WORLD_WIDTH && y >= 0 && y < MAX_WORLD_HEIGHT)
+	if (x >= 0 && x < r->fog.width && y >= 0 && y < r->fog.height)
 	{
-		r->fog_map[y * MAX_WORLD_WIDTH + x] = fogged;
+		bitset_set(&r->fog, x, y, fogged);
 	}
 }
 
 bool renderer_get_fog(Renderer *r, int x, int y)
 {
-	if (x >= 0 && x < MAX_WORLD_WIDTH && y >= 0 && y < MAX_WORLD_HEIGHT)
+	if (x >= 0 && x < r->fog.width && y >= 0 && y < r->fog.height)
 	{
-		return r->fog_map[y * MAX_WORLD_WIDTH + x];
+		return bitset_get(&r->fog, x, y);
 	}
-	return true; // Out of bounds is fogged
+	return false; // Nothing is fogged until renderer_fill_fog
 }
 
 void renderer_clear_fog(Renderer *r)
 {
-	for (int i = 0; i < MAX_WORLD_WIDTH * MAX_WORLD_HEIGHT; i++)
+	bitset_free(&r->fog);
+	r->fog = (Bitset){ 0 };
+}
+
+void renderer_fill_fog(Renderer *r, World *w)
+{
+	// levels can change size, so the fog follows the world it covers
+	if (r->fog.width != w->width || r->fog.height != w->height)
 	{
-		r->fog_map[i] = false;
+		bitset_free(&r->fog);
+		bitset_free(&r->sight);
+		bitset_init(&r->fog, w->width, w->height);
+		bitset_init(&r->sight, w->width, w->height);
 	}
+	bitset_fill_rect(&r->fog, 0, 0, w->width, w->height, true);
+	r->sight_valid = false;
 }
 
-void renderer_fill_fog(Renderer *r, World *w)
+void renderer_reveal(Renderer *r, int x0, int y0, int x1, int y1)
+{
+	if (r->fog.words)
+		bitset_fill_rect(&r->fog, x0, y0, x1, y1, false);
+}
+
+void renderer_look(Renderer *r, State *state)
 {
-	for (int y = 0; y < w->height && y < MAX_WORLD_HEIGHT; y++)
+	World *w = state->world;
+	int x = state->robots.x[0], y = state->robots.y[0];
+	if (!r->fog.words || r->fog.width != w->width || r->fog.height != w->height)
+		return;
+	if (r->sight_valid && r->sight_x == x && r->sight_y == y && r->sight_walls == w->wall_edits)
+		return;
+
+	sight_cast(&r->sight, &w->walls, x, y, SIGHT_RADIUS);
+	r->sight_valid = true;
+	r->sight_x = x;
+	r->sight_y = y;
+	r->sight_walls = w->wall_edits;
+
+	// only the words around the player can have anything newly seen in them
+	int y0 = y - SIGHT_RADIUS > 0 ? y - SIGHT_RADIUS : 0;
+	int y1 = y + SIGHT_RADIUS < w->height - 1 ? y + SIGHT_RADIUS : w->height - 1;
+	int x0 = x - SIGHT_RADIUS > 0 ? x - SIGHT_RADIUS : 0;
+	int x1 = x + SIGHT_RADIUS < w->width - 1 ? x + SIGHT_RADIUS : w->width - 1;
+	for (int row = y0; row <= y1; row++)
 	{
-		for (int x = 0; x < w->width && x < MAX_WORLD_WIDTH; x++)
-		{
-			r->fog_map[y * MAX_WORLD_WIDTH + x] = true;
-		}
+		uint64_t *fog = bitset_row(&r->fog, row);
+		const uint64_t *seen = bitset_row(&r->sight, row);
+		for (int i = x0 >> 6; i <= x1 >> 6; i++)
+			fog[i] &= ~seen[i];
 	}
 }
 
@@ -664,9 +844,9 @@ bool renderer_button_clicked(Renderer *r, int button_id)
 	return button_clicked(&r->buttons[button_id]);
 }
 
-void renderer_open_editor(Renderer *r)
+void renderer_open_editor(Renderer *r, const struct rbt_profile *profile)
 {
-	editor_open(&r->editor);
+	editor_open(&r->editor, profile);
 }
 
 void renderer_close_editor(Renderer *r)
@@ -689,7 +869,7 @@ void renderer_set_notif(Renderer *r, char *msg)
 {
 	renderer_clear_notif(r);
 	unsigned n = strlen(msg);
-	char *s = malloc(n+1);
+	char *s = mem_alloc(MEM_RENDERER, n+1);
 	memcpy(&s[0], msg, n);
 	s[n] = '\0';
 	r->notification_msg = s;
@@ -699,7 +879,7 @@ void renderer_clear_notif(Renderer *r)
 {
 	if (r->notification_msg)
 	{
-		free(r->notification_msg);
+		mem_free(r->notification_msg);
 		r->notification_msg = NULL;
 	}
 }
@@ -15,6 +15,7 @@
 #define BTN_HEIGHT 14
 #define BTN_Y 182
 #define BTN_GAP 2
+#define CONSOLE_LINES 12
 
 // Animation constants
 #define ANIM_FPS_ROBOT 10
@@ -37,6 +38,8 @@ void render_world(Tileset *ts, World *w, int screen_x, int screen_y);
 RenderTexture2D init_render_target(void);
 void begin_virtual_drawing(RenderTexture2D target);
 void end_virtual_drawing(RenderTexture2D target);
+// Show or hide heap use per subsystem (does nothing in release builds)
+void toggle_mem_overlay(void);
 
 typedef struct
 {
@@ -86,14 +89,10 @@ void robot_visual_disassemble(RobotVisual *v, Animation *disassembly_anim);
 bool robot_visual_is_disassembled(RobotVisual *v);
 void robot_visual_ram(RobotVisual *v, Direction dir);
 
-void render_robots(State *state, RobotVisual *visuals, Animation *player_anim, Animation *enemy_anim, int screen_x, int screen_y);
+void render_robots(State *state, RobotVisual *visuals, Animation *player_anim, Animation *enemy_anim, int *disassembling, int ndisassembling, int screen_x, int screen_y);
 
 void draw_hud(State *state, int fuel, int enemy_count, int level);
 
-// Maximum world size for fog map
-#define MAX_WORLD_WIDTH 16
-#define MAX_WORLD_HEIGHT 16
-
 // Button indices
 #define BTN_EXECUTE 0
 #define BTN_RESET 1
@@ -108,19 +107,31 @@ typedef struct
 	Tileset tileset;
 	Animation player_anim;
 	Animation enemy_anim;
-	Animation disassembly_anims[MAX_ROBOTS];
-	RobotVisual visuals[MAX_ROBOTS];
+	// Per-robot state, grown to match the robot count by renderer_sync_visuals
+	int visuals_cap;
+	RobotVisual *visuals;
+	Animation *disassembly_anims; /* loaded lazily, frame_count is 0 until first use */
+	int *disassembling; /* indices of robots whose disassembly animation is still playing */
+	int ndisassembling;
 	int level;
 	// Fog of war
 	Texture2D fog_texture;
 	float fog_scroll;
-	bool fog_map[MAX_WORLD_WIDTH * MAX_WORLD_HEIGHT];
+	Bitset fog; // set where fogged, sized to the world by renderer_fill_fog
+	// What the player saw last, so sight is only recast when it moves or walls change
+	Bitset sight;
+	bool sight_valid;
+	int sight_x, sight_y;
+	unsigned sight_walls;
 	// UI buttons
 	Button buttons[BTN_COUNT];
 	// Editor
 	Editor editor;
 	// Notification
 	char *notification_msg; /* when NULL, no notification is shown. */
+	// Console showing the program's prints
+	bool console_open;
+	int console_scroll; /* lines scrolled back from the newest print */
 } Renderer;
 
 Renderer *init_renderer(void);
@@ -129,23 +140,31 @@ void renderer_sync_visuals(Renderer *r, State *state);
 void renderer_update(Renderer *r, State *state, float speed);
 void renderer_render(Renderer *r, State *state);
 RobotVisual *renderer_get_visual(Renderer *r, int index);
+void renderer_disassemble(Renderer *r, int index);
 
 // Fog of war functions
 void renderer_set_fog(Renderer *r, int x, int y, bool fogged);
 bool renderer_get_fog(Renderer *r, int x, int y);
 void renderer_clear_fog(Renderer *r);
 void renderer_fill_fog(Renderer *r, World *w);
+// Clear the fog over [x0, x1) x [y0, y1), clipped to the world
+void renderer_reveal(Renderer *r, int x0, int y0, int x1, int y1);
+// Clear the fog over what the player can see from where it stands
+void renderer_look(Renderer *r, State *state);
 
 // UI functions
 void renderer_update_buttons(Renderer *r);
 bool renderer_button_clicked(Renderer *r, int button_id);
 
 // Editor functions
-void renderer_open_editor(Renderer *r);
+void renderer_open_editor(Renderer *r, const struct rbt_profile *profile);
 void renderer_close_editor(Renderer *r);
 bool renderer_editor_active(Renderer *r);
 int renderer_update_editor(Renderer *r);
 
+// Console functions
+void renderer_toggle_console(Renderer *r);
+
 // Notification functions
 void renderer_set_notif(Renderer *r, char *msg); /* duplicates the given string */
 void renderer_clear_notif(Renderer *r);
@@ -0,0 +1,286 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <replay.h>
+#include <headless.h>
+#include <common.h>
+#include <lang.h>
+#include <mem.h>
+
+
+#define REPLAY_MAGIC   0x52544252 /* "RBTR" */
+#define REPLAY_VERSION 2
+#define REPLAY_HEADER  44 /* bytes before the checksums */
+
+#define FNV32_OFFSET 0x811c9dc5u
+#define FNV32_PRIME  0x01000193u
+#define FNV64_OFFSET 0xcbf29ce484222325ull
+#define FNV64_PRIME  0x100000001b3ull
+
+
+uint64_t hash_program(const char *text)
+{
+	uint64_t h = FNV64_OFFSET;
+	for (const unsigned char *p = (const unsigned char *)text ; p && *p ; p++)
+	{
+		h ^= *p;
+		h *= FNV64_PRIME;
+	}
+	return h;
+}
+
+static
+uint32_t fnv32(uint32_t h, const void *data, size_t n)
+{
+	const unsigned char *p = data;
+	for (size_t i = 0 ; i < n ; i++)
+	{
+		h ^= p[i];
+		h *= FNV32_PRIME;
+	}
+	return h;
+}
+
+uint32_t state_checksum(State *state, uint32_t prev)
+{
+	Robots *rs = &state->robots;
+	LangStepper *ls = state->stepper;
+	uint32_t h = prev ? prev : FNV32_OFFSET;
+
+	h = fnv32(h, state->world->tiles, state->world->width * state->world->height * sizeof(int));
+	h = fnv32(h, rs->x, rs->count * sizeof(*rs->x));
+	h = fnv32(h, rs->y, rs->count * sizeof(*rs->y));
+	h = fnv32(h, rs->fuel, rs->count * sizeof(*rs->fuel));
+	h = fnv32(h, rs->dir, rs->count * sizeof(*rs->dir));
+	h = fnv32(h, rs->flags, rs->count * sizeof(*rs->flags));
+	h = fnv32(h, ls->ctx->registers, sizeof(ls->ctx->registers));
+	h = fnv32(h, &ls->_lexpos, sizeof(ls->_lexpos));
+	h = fnv32(h, &ls->n, sizeof(ls->n));
+	return h;
+}
+
+
+/* Fields are written little-endian so replays move between machines. */
+static
+void put_u32(FILE *fp, uint32_t v)
+{
+	unsigned char b[4] = { v, v >> 8, v >> 16, v >> 24 };
+	fwrite(b, 1, sizeof(b), fp);
+}
+
+static
+void put_u64(FILE *fp, uint64_t v)
+{
+	put_u32(fp, (uint32_t)v);
+	put_u32(fp, (uint32_t)(v >> 32));
+}
+
+static
+bool get_u32(FILE *fp, uint32_t *v)
+{
+	unsigned char b[4];
+	if (fread(b, 1, sizeof(b), fp) != sizeof(b))
+		return false;
+	*v = b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+	return true;
+}
+
+static
+bool get_u64(FILE *fp, uint64_t *v)
+{
+	uint32_t lo, hi;
+	if (!get_u32(fp, &lo) || !get_u32(fp, &hi))
+		return false;
+	*v = lo | (uint64_t)hi << 32;
+	return true;
+}
+
+bool replay_save(Replay *rp, const char *path)
+{
+	FILE *fp = fopen(path, "wb");
+	if (!fp)
+	{
+		fprintf(stderr, "error: failed to create `%s`, are you missing permissions?\n", path);
+		return false;
+	}
+	put_u32(fp, REPLAY_MAGIC);
+	put_u32(fp, REPLAY_VERSION);
+	put_u64(fp, (uint64_t)rp->seed);
+	put_u32(fp, rp->width);
+	put_u32(fp, rp->height);
+	put_u32(fp, rp->robot_count);
+	put_u32(fp, rp->layout);
+	put_u64(fp, rp->program_hash);
+	put_u32(fp, rp->nsteps);
+	for (unsigned i = 0 ; i < rp->nsteps ; i++)
+		put_u32(fp, rp->checksums[i]);
+	fclose(fp);
+	return true;
+}
+
+/* Replays get passed around with bug reports, so a header is checked before
+ * anything is sized from it: the world has to have an interior and fit the
+ * int tile indices, there has to be a player and room for every robot, and
+ * the checksums have to actually be in the file. */
+static
+bool replay_valid(uint32_t width, uint32_t height, uint32_t robot_count, uint32_t nsteps, long file_size)
+{
+	if (width < 3 || height < 3 || (uint64_t)width * height > INT_MAX)
+		return false;
+	if (robot_count < 1 || robot_count > (uint64_t)(width - 2) * (height - 2))
+		return false;
+	return file_size >= REPLAY_HEADER && nsteps <= (uint64_t)(file_size - REPLAY_HEADER) / sizeof(uint32_t);
+}
+
+bool replay_load(Replay *rp, const char *path)
+{
+	*rp = (Replay){0};
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+	{
+		fprintf(stderr, "error: failed to read `%s`, are you missing permissions?\n", path);
+		return false;
+	}
+
+	uint32_t magic, version, width, height, robot_count, layout, nsteps;
+	uint64_t seed;
+	bool ok = get_u32(fp, &magic) && magic == REPLAY_MAGIC &&
+		get_u32(fp, &version) && version == REPLAY_VERSION &&
+		get_u64(fp, &seed) &&
+		get_u32(fp, &width) &&
+		get_u32(fp, &height) &&
+		get_u32(fp, &robot_count) &&
+		get_u32(fp, &layout) && layout < LAYOUT_COUNT &&
+		get_u64(fp, &rp->program_hash) &&
+		get_u32(fp, &nsteps);
+	long file_size = -1;
+	if (ok && fseek(fp, 0, SEEK_END) == 0)
+	{
+		file_size = ftell(fp);
+		fseek(fp, REPLAY_HEADER, SEEK_SET);
+	}
+	ok = ok && replay_valid(width, height, robot_count, nsteps, file_size);
+	if (ok)
+	{
+		rp->seed = (long)seed;
+		rp->width = width;
+		rp->height = height;
+		rp->robot_count = robot_count;
+		rp->layout = layout;
+		rp->checksums = mem_alloc(MEM_JOURNAL, nsteps * sizeof(*rp->checksums));
+		rp->nsteps = rp->_cap = nsteps;
+		for (unsigned i = 0 ; ok && i < nsteps ; i++)
+			ok = get_u32(fp, &rp->checksums[i]);
+	}
+	fclose(fp);
+
+	if (!ok)
+	{
+		fprintf(stderr, "error: `%s` is not a valid replay file\n", path);
+		replay_free(rp);
+	}
+	return ok;
+}
+
+void replay_free(Replay *rp)
+{
+	mem_free(rp->checksums);
+	*rp = (Replay){0};
+}
+
+
+static
+bool record_step(State *state, void *data)
+{
+	Replay *rp = data;
+	if (rp->nsteps == rp->_cap)
+	{
+		rp->_cap = rp->_cap ? rp->_cap * 2 : 256;
+		rp->checksums = mem_realloc(MEM_JOURNAL, rp->checksums, rp->_cap * sizeof(*rp->checksums));
+	}
+	uint32_t prev = rp->nsteps ? rp->checksums[rp->nsteps - 1] : 0;
+	rp->checksums[rp->nsteps++] = state_checksum(state, prev);
+	return true;
+}
+
+int replay_record(const char *path, long seed, int width, int height, int robot_count, WorldLayout layout, unsigned max_steps)
+{
+	/* a replay needs a concrete seed to be reproducible */
+	if (seed == -1)
+		seed = (long)time(NULL);
+
+	Replay rp = { .seed=seed, .width=width, .height=height, .robot_count=robot_count, .layout=layout };
+	State *state = generate_world(seed, width, height, robot_count, layout);
+	HeadlessResult res = run_headless(state, max_steps, record_step, &rp);
+	rp.program_hash = hash_program(state->stepper->program);
+
+	bool ok = replay_save(&rp, path);
+	if (ok)
+		printf("replay: recorded %u steps (%s) to `%s`, seed %ld\n", rp.nsteps, headless_outcome(&res), path, seed);
+
+	free_state(state);
+	replay_free(&rp);
+	return ok ? 0 : 1;
+}
+
+
+typedef struct
+{
+	Replay *expected;
+	unsigned step;
+	uint32_t checksum;
+	bool diverged;
+} ReplayCheck;
+
+static
+bool verify_step(State *state, void *data)
+{
+	ReplayCheck *rc = data;
+	rc->checksum = state_checksum(state, rc->checksum);
+	if (rc->step >= rc->expected->nsteps || rc->checksum != rc->expected->checksums[rc->step])
+	{
+		rc->diverged = true;
+		return false;
+	}
+	rc->step++;
+	return true;
+}
+
+int replay_verify(const char *path, unsigned max_steps)
+{
+	Replay rp;
+	if (!replay_load(&rp, path))
+		return 1;
+
+	State *state = generate_world(rp.seed, rp.width, rp.height, rp.robot_count, rp.layout);
+	ReplayCheck rc = { .expected=&rp };
+	run_headless(state, max_steps, verify_step, &rc);
+
+	if (hash_program(state->stepper->program) != rp.program_hash)
+		printf("replay: warning: program text differs from the recording\n");
+
+	int status = 0;
+	if (rc.diverged)
+	{
+		if (rc.step < rp.nsteps)
+			printf("replay: diverged at step %u (expected %08x, got %08x)\n", rc.step + 1, rp.checksums[rc.step], rc.checksum);
+		else
+			printf("replay: diverged at step %u (recording ended after %u steps)\n", rc.step + 1, rp.nsteps);
+		status = 1;
+	}
+	else if (rc.step < rp.nsteps)
+	{
+		printf("replay: diverged at step %u (run ended after %u steps)\n", rc.step + 1, rc.step);
+		status = 1;
+	}
+	else
+	{
+		printf("replay: ok, %u steps match\n", rc.step);
+	}
+
+	free_state(state);
+	replay_free(&rp);
+	return status;
+}
@@ -0,0 +1,37 @@
+#ifndef __robots_replay__
+#define __robots_replay__
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <common.h>
+
+
+/* A recorded run: everything needed to regenerate the world, a hash of the
+ * program that was run, and a rolling checksum of the State after each step. */
+typedef struct
+{
+	long seed;
+	int width, height, robot_count;
+	WorldLayout layout;
+	uint64_t program_hash;
+	unsigned nsteps, _cap;
+	uint32_t *checksums;
+} Replay;
+
+/* FNV-1a hash of the program text. */
+uint64_t hash_program(const char *text);
+/* Fold the tiles, robots, registers and program counter of `state` into `prev`. */
+uint32_t state_checksum(State *state, uint32_t prev);
+
+bool replay_save(Replay *rp, const char *path);
+bool replay_load(Replay *rp, const char *path);
+void replay_free(Replay *rp);
+
+/* Run the program headlessly and write a replay file. Returns an exit code. */
+int replay_record(const char *path, long seed, int width, int height, int robot_count, WorldLayout layout, unsigned max_steps);
+/* Rerun a replay file and report the first step whose checksum differs. Returns an exit code. */
+int replay_verify(const char *path, unsigned max_steps);
+
+
+#endif
@@ -0,0 +1,128 @@
+#include <stdint.h>
+#include <scan.h>
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+#if defined(__AVX2__)
+# define VEC_WIDTH 32
+typedef __m256i Vec;
+# define vec_load(p)      _mm256_load_si256((const Vec *)(p))
+# define vec_set(c)       _mm256_set1_epi8(c)
+# define vec_eq(a, b)     _mm256_cmpeq_epi8(a, b)
+# define vec_gt(a, b)     _mm256_cmpgt_epi8(a, b)
+# define vec_or(a, b)     _mm256_or_si256(a, b)
+# define vec_andnot(a, b) _mm256_andnot_si256(a, b)
+# define vec_mask(v)      ((uint32_t)_mm256_movemask_epi8(v))
+# define VEC_ALL          0xffffffffu
+#else
+# define VEC_WIDTH 16
+typedef __m128i Vec;
+# define vec_load(p)      _mm_load_si128((const Vec *)(p))
+# define vec_set(c)       _mm_set1_epi8(c)
+# define vec_eq(a, b)     _mm_cmpeq_epi8(a, b)
+# define vec_gt(a, b)     _mm_cmpgt_epi8(a, b)
+# define vec_or(a, b)     _mm_or_si128(a, b)
+# define vec_andnot(a, b) _mm_andnot_si128(a, b)
+# define vec_mask(v)      ((uint32_t)_mm_movemask_epi8(v))
+# define VEC_ALL          0xffffu
+#endif
+
+/* Bit i is set where byte i ends the scan. */
+static inline
+uint32_t blank_stops(Vec v)
+{
+	Vec blank = vec_or(vec_or(vec_eq(v, vec_set(' ')), vec_eq(v, vec_set('\t'))),
+		vec_or(vec_eq(v, vec_set('\r')), vec_eq(v, vec_set('\n'))));
+	return ~vec_mask(blank) & VEC_ALL;
+}
+
+static inline
+uint32_t line_end_stops(Vec v)
+{
+	return vec_mask(vec_or(vec_eq(v, vec_set('\n')), vec_eq(v, vec_set('\0'))));
+}
+
+static inline
+uint32_t word_end_stops(Vec v)
+{
+	/* printable is 0x21-0x7e; bytes from 0x80 are negative as signed chars */
+	Vec graph = vec_andnot(vec_eq(v, vec_set(0x7f)), vec_gt(v, vec_set(0x20)));
+	return ~vec_mask(graph) & VEC_ALL;
+}
+
+/* Aligned loads may read past the terminator within its page. That is safe
+ * but looks like an overflow to AddressSanitizer. */
+#if defined(__SANITIZE_ADDRESS__)
+# define NO_ASAN __attribute__((no_sanitize_address))
+#else
+# define NO_ASAN
+#endif
+
+/* Start at the aligned block holding `p` and ignore the bytes before it. */
+#define SCAN(p, stops) \
+	do { \
+		uintptr_t off = (uintptr_t)(p) & (VEC_WIDTH - 1); \
+		const char *block = (p) - off; \
+		uint32_t m = stops(vec_load(block)) >> off; \
+		if (m) \
+			return (p) + __builtin_ctz(m); \
+		for (block += VEC_WIDTH ; ; block += VEC_WIDTH) \
+		{ \
+			m = stops(vec_load(block)); \
+			if (m) \
+				return block + __builtin_ctz(m); \
+		} \
+	} while (0)
+
+NO_ASAN
+const char *scan_blank(const char *p)
+{
+	/* most runs are a single space or a newline and an indent */
+	if (*p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+		return p;
+	SCAN(p, blank_stops);
+}
+
+NO_ASAN
+const char *scan_line_end(const char *p)
+{
+	SCAN(p, line_end_stops);
+}
+
+NO_ASAN
+const char *scan_word_end(const char *p)
+{
+	SCAN(p, word_end_stops);
+}
+
+#else /* scalar fallback */
+
+const char *scan_blank(const char *p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+		p++;
+	return p;
+}
+
+const char *scan_line_end(const char *p)
+{
+	while (*p != '\n' && *p != '\0')
+		p++;
+	return p;
+}
+
+const char *scan_word_end(const char *p)
+{
+	while (*p > 0x20 && *p < 0x7f)
+		p++;
+	return p;
+}
+
+#endif
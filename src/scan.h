@@ -0,0 +1,18 @@
+#ifndef __robots_scan__
+#define __robots_scan__
+
+
+/* Character scanning for the lexer. These use AVX2 or SSE2 when the build
+ * enables them and plain loops otherwise. The text must be NUL-terminated;
+ * every scan stops at the NUL. Vector loads are aligned, so they never read
+ * past the page holding the terminator. */
+
+/* Skip spaces, tabs, carriage returns and newlines. */
+const char *scan_blank(const char *p);
+/* Find the next newline or the terminating NUL. */
+const char *scan_line_end(const char *p);
+/* Find the first character that is not printable (see isgraph). */
+const char *scan_word_end(const char *p);
+
+
+#endif
@@ -0,0 +1,81 @@
+#include <sight.h>
+
+
+/* Recursive shadowcasting: each of the eight octants around the origin is
+ * scanned row by row going outward, and every wall met splits off the part of
+ * the view that is still open into its own scan of the rows behind it. Tiles
+ * are visited at most once per octant and walls are read from the bitset. */
+
+typedef struct
+{
+	Bitset *seen;
+	const Bitset *walls;
+	int x, y, radius;
+	int xx, xy, yx, yy; /* maps octant coordinates onto the grid */
+} Caster;
+
+/* Row `row` onward of an octant, between the slopes `start` and `end` */
+static
+void cast_light(const Caster *c, int row, double start, double end)
+{
+	if (start < end)
+		return;
+
+	int r2 = c->radius * (c->radius + 1); /* a little past r*r for rounder edges */
+	double next_start = start;
+	for (int j = row ; j <= c->radius ; j++)
+	{
+		bool blocked = false;
+		for (int dx = -j, dy = -j ; dx <= 0 ; dx++)
+		{
+			double left = (dx - 0.5) / (dy + 0.5), right = (dx + 0.5) / (dy - 0.5);
+			if (start < right)
+				continue;
+			if (end > left)
+				break;
+
+			int tx = c->x + dx * c->xx + dy * c->xy;
+			int ty = c->y + dx * c->yx + dy * c->yy;
+			bool inside = tx >= 0 && ty >= 0 && tx < c->walls->width && ty < c->walls->height;
+			if (inside && dx * dx + dy * dy <= r2)
+				bitset_set(c->seen, tx, ty, true);
+
+			bool wall = !inside || bitset_get(c->walls, tx, ty);
+			if (blocked)
+			{
+				if (wall)
+				{
+					next_start = right;
+					continue;
+				}
+				blocked = false;
+				start = next_start;
+			}
+			else if (wall && j < c->radius)
+			{
+				blocked = true;
+				cast_light(c, j + 1, start, left);
+				next_start = right;
+			}
+		}
+		if (blocked)
+			break;
+	}
+}
+
+void sight_cast(Bitset *seen, const Bitset *walls, int x, int y, int radius)
+{
+	static const int octants[8][4] =
+	{
+		{ 1,  0,  0,  1 }, { 0,  1,  1,  0 }, { 0, -1,  1,  0 }, { -1,  0,  0,  1 },
+		{ -1, 0,  0, -1 }, { 0, -1, -1,  0 }, { 0,  1, -1,  0 }, { 1,  0,  0, -1 },
+	};
+
+	bitset_fill_rect(seen, x - radius, y - radius, x + radius + 1, y + radius + 1, false);
+	bitset_set(seen, x, y, true);
+	for (int i = 0 ; i < 8 ; i++)
+	{
+		Caster c = { seen, walls, x, y, radius, octants[i][0], octants[i][1], octants[i][2], octants[i][3] };
+		cast_light(&c, 1, 1.0, 0.0);
+	}
+}
@@ -0,0 +1,18 @@
+#ifndef __robots_sight__
+#define __robots_sight__
+
+
+#include <bitset.h>
+
+
+/* How many tiles out a robot can see */
+#define SIGHT_RADIUS 4
+
+/* Set in `seen` every tile within `radius` of (x, y) that a straight line
+ * from the middle of (x, y) gets to without passing through a wall, the
+ * walls that stop it included, and clear the rest of the square around it.
+ * `seen` and `walls` must be the same size. */
+void sight_cast(Bitset *seen, const Bitset *walls, int x, int y, int radius);
+
+
+#endif
@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include <string.h>
+#include <textbuf.h>
+#include <mem.h>
+
+
+#define GAP_LEN(tb)      ((tb)->gap_end - (tb)->gap_start)
+#define LINE_GAP_LEN(tb) ((tb)->line_gap_end - (tb)->line_gap_start)
+
+
+void textbuf_init(TextBuffer *tb)
+{
+	*tb = (TextBuffer){0};
+	textbuf_set(tb, "");
+}
+
+void textbuf_free(TextBuffer *tb)
+{
+	mem_free(tb->data);
+	mem_free(tb->lines);
+	*tb = (TextBuffer){0};
+}
+
+int textbuf_length(TextBuffer *tb)
+{
+	return tb->cap - GAP_LEN(tb);
+}
+
+int textbuf_line_count(TextBuffer *tb)
+{
+	return tb->lines_cap - LINE_GAP_LEN(tb);
+}
+
+int textbuf_line_start(TextBuffer *tb, int line)
+{
+	if (line < tb->line_gap_start)
+		return tb->lines[line];
+	return textbuf_length(tb) - tb->lines[line + LINE_GAP_LEN(tb)];
+}
+
+int textbuf_line_length(TextBuffer *tb, int line)
+{
+	int end = line + 1 < textbuf_line_count(tb) ?
+		textbuf_line_start(tb, line + 1) - 1 :
+		textbuf_length(tb);
+	return end - textbuf_line_start(tb, line);
+}
+
+int textbuf_copy_line(TextBuffer *tb, int line, char *out, int size)
+{
+	int start = textbuf_line_start(tb, line);
+	int len = textbuf_line_length(tb, line);
+	if (len > size - 1)
+		len = size - 1;
+
+	/* at most two runs, either side of the gap */
+	int before = tb->gap_start - start;
+	if (before < 0)
+		before = 0;
+	if (before > len)
+		before = len;
+	memcpy(out, tb->data + start, before);
+	memcpy(out + before, tb->data + start + before + GAP_LEN(tb), len - before);
+	out[len] = '\0';
+	return len;
+}
+
+
+/* Move the text gap so that it starts at `pos`. */
+static
+void move_gap(TextBuffer *tb, int pos)
+{
+	if (pos < tb->gap_start)
+	{
+		int n = tb->gap_start - pos;
+		memmove(tb->data + tb->gap_end - n, tb->data + pos, n);
+		tb->gap_start -= n;
+		tb->gap_end -= n;
+	}
+	else if (pos > tb->gap_start)
+	{
+		int n = pos - tb->gap_start;
+		memmove(tb->data + tb->gap_start, tb->data + tb->gap_end, n);
+		tb->gap_start += n;
+		tb->gap_end += n;
+	}
+}
+
+static
+void grow_gap(TextBuffer *tb, int need)
+{
+	if (GAP_LEN(tb) >= need)
+		return;
+	int cap = tb->cap ? tb->cap : 256;
+	while (cap - textbuf_length(tb) < need)
+		cap *= 2;
+	int after = tb->cap - tb->gap_end;
+	tb->data = mem_realloc(MEM_EDITOR, tb->data, cap);
+	memmove(tb->data + cap - after, tb->data + tb->gap_end, after);
+	tb->gap_end = cap - after;
+	tb->cap = cap;
+}
+
+/* Move the line gap so that every line starting at or before `pos` is in front of it. */
+static
+void move_line_gap(TextBuffer *tb, int pos)
+{
+	int len = textbuf_length(tb);
+	while (tb->line_gap_start > 1 && tb->lines[tb->line_gap_start - 1] > pos)
+	{
+		tb->line_gap_start--;
+		tb->line_gap_end--;
+		tb->lines[tb->line_gap_end] = len - tb->lines[tb->line_gap_start];
+	}
+	while (tb->line_gap_end < tb->lines_cap && len - tb->lines[tb->line_gap_end] <= pos)
+	{
+		tb->lines[tb->line_gap_start] = len - tb->lines[tb->line_gap_end];
+		tb->line_gap_start++;
+		tb->line_gap_end++;
+	}
+}
+
+static
+void grow_line_gap(TextBuffer *tb, int need)
+{
+	if (LINE_GAP_LEN(tb) >= need)
+		return;
+	int cap = tb->lines_cap ? tb->lines_cap : 64;
+	while (cap - textbuf_line_count(tb) < need)
+		cap *= 2;
+	int after = tb->lines_cap - tb->line_gap_end;
+	tb->lines = mem_realloc(MEM_EDITOR, tb->lines, cap * sizeof(*tb->lines));
+	memmove(tb->lines + cap - after, tb->lines + tb->line_gap_end, after * sizeof(*tb->lines));
+	tb->line_gap_end = cap - after;
+	tb->lines_cap = cap;
+}
+
+void textbuf_set(TextBuffer *tb, const char *text)
+{
+	int len = strlen(text);
+	tb->gap_start = 0;
+	tb->gap_end = tb->cap;
+	tb->line_gap_start = 0;
+	tb->line_gap_end = tb->lines_cap;
+
+	grow_line_gap(tb, 1);
+	tb->lines[tb->line_gap_start++] = 0;
+	textbuf_insert(tb, 0, text, len);
+}
+
+void textbuf_insert(TextBuffer *tb, int pos, const char *text, int len)
+{
+	if (len <= 0)
+		return;
+	move_gap(tb, pos);
+	grow_gap(tb, len);
+	move_line_gap(tb, pos);
+
+	/* lines after the gap are stored from the end, so only new lines need entries */
+	for (int i = 0 ; i < len ; i++)
+	{
+		if (text[i] == '\n')
+		{
+			grow_line_gap(tb, 1);
+			tb->lines[tb->line_gap_start++] = pos + i + 1;
+		}
+	}
+	memcpy(tb->data + tb->gap_start, text, len);
+	tb->gap_start += len;
+}
+
+void textbuf_delete(TextBuffer *tb, int pos, int len)
+{
+	if (len <= 0)
+		return;
+	move_gap(tb, pos);
+	move_line_gap(tb, pos);
+
+	/* drop the lines that started inside the deleted range */
+	int total = textbuf_length(tb);
+	while (tb->line_gap_end < tb->lines_cap && total - tb->lines[tb->line_gap_end] <= pos + len)
+		tb->line_gap_end++;
+	tb->gap_end += len;
+}
+
+void textbuf_replace_line(TextBuffer *tb, int line, const char *text)
+{
+	while (textbuf_line_count(tb) <= line)
+		textbuf_insert(tb, textbuf_length(tb), "\n", 1);
+
+	int start = textbuf_line_start(tb, line);
+	textbuf_delete(tb, start, textbuf_line_length(tb, line));
+	textbuf_insert(tb, start, text, strlen(text));
+}
+
+void textbuf_delete_line(TextBuffer *tb, int line)
+{
+	int n = textbuf_line_count(tb);
+	if (line < 0 || line >= n)
+		return;
+
+	int start = textbuf_line_start(tb, line);
+	if (line + 1 < n)
+		textbuf_delete(tb, start, textbuf_line_start(tb, line + 1) - start);
+	else if (line > 0)
+		textbuf_delete(tb, start - 1, textbuf_length(tb) - start + 1); /* take the previous newline */
+	else
+		textbuf_delete(tb, 0, textbuf_length(tb));
+}
+
+bool textbuf_write(TextBuffer *tb, FILE *fp)
+{
+	int after = tb->cap - tb->gap_end;
+	return fwrite(tb->data, 1, tb->gap_start, fp) == (size_t)tb->gap_start &&
+		fwrite(tb->data + tb->gap_end, 1, after, fp) == (size_t)after;
+}
@@ -0,0 +1,50 @@
+#ifndef __robots_textbuf__
+#define __robots_textbuf__
+
+
+#include <stdio.h>
+#include <stdbool.h>
+
+
+/* Text in a gap buffer with an index of line starts.
+ *
+ * The line index has a gap of its own that follows the last edit: starts of
+ * lines before it are stored from the beginning of the text, starts of lines
+ * after it from the end. An edit therefore only touches the entries of the
+ * lines it adds or removes, plus whatever the two gaps have to move since
+ * the previous edit. */
+typedef struct
+{
+	char *data;
+	int gap_start, gap_end, cap;
+	int *lines;
+	int line_gap_start, line_gap_end, lines_cap;
+} TextBuffer;
+
+void textbuf_init(TextBuffer *tb);
+void textbuf_free(TextBuffer *tb);
+/* Replace the whole text. */
+void textbuf_set(TextBuffer *tb, const char *text);
+/* Number of characters. */
+int textbuf_length(TextBuffer *tb);
+/* Number of lines, always at least 1. */
+int textbuf_line_count(TextBuffer *tb);
+/* Offset of the first character of `line` (0-based). */
+int textbuf_line_start(TextBuffer *tb, int line);
+/* Length of `line` without its newline. */
+int textbuf_line_length(TextBuffer *tb, int line);
+/* Copy `line` into `out` (truncated to `size` - 1 characters). Returns the copied length. */
+int textbuf_copy_line(TextBuffer *tb, int line, char *out, int size);
+/* Insert `len` characters at `pos`. */
+void textbuf_insert(TextBuffer *tb, int pos, const char *text, int len);
+/* Delete `len` characters at `pos`. */
+void textbuf_delete(TextBuffer *tb, int pos, int len);
+/* Replace the text of `line`, appending empty lines first if it does not exist yet. */
+void textbuf_replace_line(TextBuffer *tb, int line, const char *text);
+/* Remove `line` and its newline. */
+void textbuf_delete_line(TextBuffer *tb, int line);
+/* Write the whole text to `fp`. */
+bool textbuf_write(TextBuffer *tb, FILE *fp);
+
+
+#endif
@@ -0,0 +1,283 @@
+#define _POSIX_C_SOURCE 200809L /* clock_gettime, nanosleep */
+#include <trace.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <mem.h>
+
+
+typedef struct
+{
+	unsigned long long ts, dur;
+	const char *cat, *name, *path;
+	int line;
+} TraceEvent;
+
+/* Written by one thread and read by the writer, so `head` and `tail` are the
+ * only shared state and each has a single writer. When its thread exits the
+ * ring is retired, and once the writer has drained it the ring is kept for the
+ * next thread that starts tracing: world generation starts fresh workers for
+ * every level and they should not each leave a ring behind. */
+typedef struct trace_ring
+{
+	TraceEvent ev[TRACE_RING_SIZE];
+	unsigned long head;    /* next slot to fill, owned by the recording thread */
+	unsigned long tail;    /* next slot to write out, owned by the writer */
+	unsigned long dropped; /* events lost while the ring was full */
+	const char *thread;
+	int tid;
+	bool retired; /* set when the thread has exited */
+	struct trace_ring *next;
+} TraceRing;
+
+bool trace_enabled = false;
+
+static __thread TraceRing *local;
+static pthread_key_t local_key; /* only to retire the ring when a thread exits */
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceRing *rings; /* the rings of threads that trace, newest first */
+static TraceRing *spare; /* drained rings of threads that have exited */
+static unsigned long retired_dropped;
+static int nthreads;
+
+static FILE *out;
+static bool first_event;
+static unsigned long long epoch;
+static pthread_t writer;
+static int writer_stop;
+
+
+unsigned long long trace_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static
+TraceRing *local_ring(void)
+{
+	if (local)
+		return local;
+
+	pthread_mutex_lock(&rings_lock);
+	TraceRing *r = spare;
+	if (r)
+	{
+		spare = r->next;
+		r->head = r->tail = r->dropped = 0;
+		r->retired = false;
+	}
+	else
+		r = mem_calloc(MEM_MISC, 1, sizeof(TraceRing));
+	if (r)
+	{
+		r->tid = ++nthreads;
+		r->thread = r->tid == 1 ? "main" : NULL;
+		r->next = rings;
+		rings = r;
+	}
+	pthread_mutex_unlock(&rings_lock);
+	if (!r)
+		return NULL;
+	pthread_setspecific(local_key, r);
+	return local = r;
+}
+
+static
+void retire_ring(void *ring)
+{
+	TraceRing *r = ring;
+	__atomic_store_n(&r->retired, true, __ATOMIC_RELEASE);
+}
+
+void trace_thread_name(const char *name)
+{
+	TraceRing *r = local_ring();
+	if (r)
+		r->thread = name;
+}
+
+void trace_span(unsigned long long start, const char *cat, const char *name, int line, const char *path)
+{
+	if (!trace_enabled)
+		return;
+	unsigned long long now = trace_now();
+	TraceRing *r = local_ring();
+	if (!r)
+		return;
+
+	unsigned long head = r->head;
+	if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= TRACE_RING_SIZE)
+	{
+		r->dropped++;
+		return;
+	}
+	TraceEvent *e = &r->ev[head % TRACE_RING_SIZE];
+	e->ts = start;
+	e->dur = now - start;
+	e->cat = cat;
+	e->name = name;
+	e->path = path;
+	e->line = line;
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+static
+void write_string(const char *s)
+{
+	fputc('"', out);
+	for ( ; *s ; s++)
+	{
+		if (*s == '"' || *s == '\\')
+			fputc('\\', out);
+		if ((unsigned char)*s >= ' ')
+			fputc(*s, out);
+	}
+	fputc('"', out);
+}
+
+/* Timestamps are in microseconds, kept to the nanosecond. */
+static
+void write_event(TraceRing *r, TraceEvent *e)
+{
+	unsigned long long ts = e->ts - epoch;
+	fprintf(out, "%s\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%llu.%03llu,\"dur\":%llu.%03llu,\"cat\":\"%s\",\"name\":",
+		first_event ? "" : ",", r->tid, ts / 1000, ts % 1000, e->dur / 1000, e->dur % 1000, e->cat);
+	write_string(e->name);
+	if (e->line > 0)
+		fprintf(out, ",\"args\":{\"line\":%d}", e->line);
+	else if (e->path)
+	{
+		fprintf(out, ",\"args\":{\"path\":");
+		write_string(e->path);
+		fputc('}', out);
+	}
+	fputc('}', out);
+	first_event = false;
+}
+
+static
+void write_thread_name(TraceRing *r)
+{
+	if (!r->thread)
+		return;
+	fprintf(out, "%s\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":",
+		first_event ? "" : ",", r->tid);
+	write_string(r->thread);
+	fprintf(out, "}}");
+	first_event = false;
+}
+
+/* Write out everything recorded so far, returns the number of events. The
+ * rings of threads that have exited are set aside once they are empty. */
+static
+unsigned long drain(void)
+{
+	unsigned long n = 0;
+	pthread_mutex_lock(&rings_lock);
+	for (TraceRing **link = &rings, *r ; (r = *link) ; )
+	{
+		/* a retired ring's thread is done with it, so what is read after
+		 * `retired` is everything it will ever record */
+		bool retired = __atomic_load_n(&r->retired, __ATOMIC_ACQUIRE);
+		unsigned long head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		unsigned long tail = r->tail;
+		for ( ; tail != head ; tail++, n++)
+			write_event(r, &r->ev[tail % TRACE_RING_SIZE]);
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+		if (!retired)
+		{
+			link = &r->next;
+			continue;
+		}
+		write_thread_name(r);
+		retired_dropped += r->dropped;
+		*link = r->next;
+		r->next = spare;
+		spare = r;
+	}
+	pthread_mutex_unlock(&rings_lock);
+	return n;
+}
+
+static
+void *writer_main(void *arg)
+{
+	(void)arg;
+	struct timespec pause = { 0, 2000000 };
+	while (!__atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE))
+	{
+		if (drain() == 0)
+			nanosleep(&pause, NULL);
+	}
+	return NULL;
+}
+
+bool trace_open(const char *path)
+{
+	out = fopen(path, "w");
+	if (!out)
+	{
+		fprintf(stderr, "error: failed to create `%s`, are you missing permissions?\n", path);
+		return false;
+	}
+	setvbuf(out, NULL, _IOFBF, 1 << 20);
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	first_event = true;
+	epoch = trace_now();
+	if (pthread_key_create(&local_key, retire_ring) != 0)
+	{
+		fprintf(stderr, "error: failed to start the trace writer\n");
+		fclose(out);
+		out = NULL;
+		return false;
+	}
+
+	writer_stop = 0;
+	if (pthread_create(&writer, NULL, writer_main, NULL) != 0)
+	{
+		fprintf(stderr, "error: failed to start the trace writer\n");
+		fclose(out);
+		out = NULL;
+		return false;
+	}
+	trace_enabled = true;
+	atexit(trace_close);
+	return true;
+}
+
+void trace_close(void)
+{
+	if (!out)
+		return;
+	trace_enabled = false;
+	__atomic_store_n(&writer_stop, 1, __ATOMIC_RELEASE);
+	pthread_join(writer, NULL);
+	drain();
+
+	unsigned long dropped = retired_dropped;
+	pthread_mutex_lock(&rings_lock);
+	for (TraceRing *r = rings ; r ; r = r->next)
+	{
+		dropped += r->dropped;
+		write_thread_name(r);
+	}
+	while (spare)
+	{
+		TraceRing *r = spare;
+		spare = r->next;
+		mem_free(r);
+	}
+	pthread_mutex_unlock(&rings_lock);
+	fprintf(out, "\n]}\n");
+	fclose(out);
+	out = NULL;
+
+	if (dropped)
+		fprintf(stderr, "trace: dropped %lu events, the writer could not keep up\n", dropped);
+}
@@ -0,0 +1,41 @@
+#ifndef __robots_trace__
+#define __robots_trace__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/* Timeline tracing in the Trace Event Format, for Perfetto or chrome://tracing
+ * (`--trace FILE`). Every thread records into its own ring and a writer thread
+ * turns the rings into JSON, so a traced span costs two clock reads and a copy.
+ * When tracing is off each hook below is a single branch. */
+
+/* Events per thread that may wait for the writer before new ones are dropped. */
+#ifndef TRACE_RING_SIZE
+# define TRACE_RING_SIZE (1 << 16)
+#endif
+
+extern bool trace_enabled;
+
+/* Start writing events to `path`, the file is completed at exit. */
+bool trace_open(const char *path);
+void trace_close(void);
+/* Name the calling thread in the timeline. */
+void trace_thread_name(const char *name);
+
+unsigned long long trace_now(void);
+/* Record a span from `start` to now. `name`, `cat` and `path` must outlive the
+ * trace, which string literals and asset paths do. `line` is left out if < 1. */
+void trace_span(unsigned long long start, const char *cat, const char *name, int line, const char *path);
+
+/* unsigned long long t = trace_begin(); ... trace_end(t, "cat", "name"); */
+#define trace_begin() (trace_enabled ? trace_now() : 0)
+#define trace_end(start, cat, name) \
+	((start) ? trace_span((start), (cat), (name), 0, NULL) : (void)0)
+#define trace_end_line(start, cat, name, line) \
+	((start) ? trace_span((start), (cat), (name), (line), NULL) : (void)0)
+#define trace_end_path(start, cat, name, path) \
+	((start) ? trace_span((start), (cat), (name), 0, (path)) : (void)0)
+
+
+#endif
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <watch.h>
+#include <mem.h>
+
+#ifdef __linux__
+# include <errno.h>
+# include <unistd.h>
+# include <sys/inotify.h>
+#endif
+
+
+#ifdef __linux__
+
+bool watch_open(FileWatch *w, const char *path)
+{
+	*w = (FileWatch){ .fd=-1, .wd=-1 };
+
+	/* split into directory and file name */
+	const char *slash = strrchr(path, '/');
+	const char *name = slash ? slash + 1 : path;
+	int dirlen = slash ? slash - path + (slash == path) : 1; /* keep `/` for the root */
+	char *dir = mem_alloc(MEM_MISC, dirlen + 1);
+	memcpy(dir, slash ? path : ".", dirlen);
+	dir[dirlen] = '\0';
+	w->name = mem_alloc(MEM_MISC, strlen(name) + 1);
+	strcpy(w->name, name);
+
+	w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (w->fd >= 0)
+		w->wd = inotify_add_watch(w->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+	if (w->fd < 0 || w->wd < 0)
+	{
+		fprintf(stderr, "error: failed to watch `%s` for changes\n", path);
+		mem_free(dir);
+		watch_close(w);
+		return false;
+	}
+	mem_free(dir);
+	return true;
+}
+
+void watch_close(FileWatch *w)
+{
+	if (w->fd >= 0)
+		close(w->fd);
+	mem_free(w->name);
+	*w = (FileWatch){ .fd=-1, .wd=-1 };
+}
+
+bool watch_changed(FileWatch *w)
+{
+	if (w->fd < 0)
+		return false;
+
+	/* aligned as the man page asks so the event headers can be read in place */
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool changed = false;
+	for (;;)
+	{
+		ssize_t len = read(w->fd, buf, sizeof(buf));
+		if (len <= 0)
+			break; /* EAGAIN: nothing left */
+
+		for (char *p = buf ; p < buf + len ; )
+		{
+			struct inotify_event *ev = (struct inotify_event *)p;
+			if (ev->len && strcmp(ev->name, w->name) == 0)
+				changed = true;
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+	return changed;
+}
+
+#else /* no inotify, hot reload is disabled */
+
+bool watch_open(FileWatch *w, const char *path)
+{
+	(void)path;
+	*w = (FileWatch){ .fd=-1, .wd=-1 };
+	return false;
+}
+
+void watch_close(FileWatch *w)
+{
+	*w = (FileWatch){ .fd=-1, .wd=-1 };
+}
+
+bool watch_changed(FileWatch *w)
+{
+	(void)w;
+	return false;
+}
+
+#endif
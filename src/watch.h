@@ -0,0 +1,26 @@
+#ifndef __robots_watch__
+#define __robots_watch__
+
+
+#include <stdbool.h>
+
+
+/* Watches a single file for changes. The containing directory is watched
+ * instead of the file itself so that editors which save by writing a new
+ * file and renaming it over the old one are picked up too. */
+typedef struct
+{
+	int fd; /* -1 when not watching */
+	int wd;
+	char *name; /* file name within the watched directory */
+} FileWatch;
+
+/* Start watching `path`. On failure `w` is left inert and false is returned. */
+bool watch_open(FileWatch *w, const char *path);
+/* Stop watching. */
+void watch_close(FileWatch *w);
+/* Drain pending events without blocking. True if the file was written or replaced. */
+bool watch_changed(FileWatch *w);
+
+
+#endif
@@ -0,0 +1,294 @@
+#include <string.h>
+#include <worldgen.h>
+#include <parallel.h>
+#include <trace.h>
+
+
+int worldgen_threads = 0;
+
+const char *const worldgen_layout_names[LAYOUT_COUNT] =
+{
+	[LAYOUT_SCATTER]="scatter",
+	[LAYOUT_MAZE]="maze",
+	[LAYOUT_CAVE]="cave",
+	[LAYOUT_ROOMS]="rooms",
+};
+
+bool worldgen_parse_layout(const char *name, WorldLayout *layout)
+{
+	for (int i = 0 ; i < LAYOUT_COUNT ; i++)
+	{
+		if (strcmp(name, worldgen_layout_names[i]) == 0)
+		{
+			*layout = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+/* Streams derived from the world's key */
+#define STREAM_NOISE 0
+#define STREAM_DOORS 1
+#define STREAM_CHUNKS 2 /* one per chunk from here on */
+
+typedef struct
+{
+	World *world;
+	WorldLayout layout;
+	unsigned long long key;
+	int chunks_x, chunks_y;
+} WorldGen;
+
+static
+unsigned long long stream_key(unsigned long long key, unsigned long long stream)
+{
+	return (unsigned long long)rng_at(key, 2 * stream) << 32 | rng_at(key, 2 * stream + 1);
+}
+
+/* Uniform in [0, n) from a single counter-based draw. */
+static
+int stream_range(unsigned long long key, unsigned long long n, int range)
+{
+	return (int)(((unsigned long long)rng_at(key, n) * (unsigned)range) >> 32);
+}
+
+static
+bool is_interior(World *w, int x, int y)
+{
+	return x > 0 && y > 0 && x < w->width - 1 && y < w->height - 1;
+}
+
+static
+void put_tile(World *w, int x, int y, int tile)
+{
+	if (is_interior(w, x, y))
+		write_tile(w, x, y, tile);
+}
+
+static
+void fill_chunk(World *w, int cx, int cy, int tile)
+{
+	for (int y = cy * WORLDGEN_CHUNK ; y < (cy + 1) * WORLDGEN_CHUNK ; y++)
+	{
+		for (int x = cx * WORLDGEN_CHUNK ; x < (cx + 1) * WORLDGEN_CHUNK ; x++)
+			put_tile(w, x, y, tile);
+	}
+}
+
+
+/* A perfect maze over the cells on odd coordinates of the chunk, made with a
+ * depth-first walk, plus a door through the west and north walls. The cells
+ * along those walls exist in the neighbouring chunks too, so every chunk with
+ * a cell is connected to the rest. */
+static
+void maze_chunk(WorldGen *g, int cx, int cy)
+{
+	enum { CELLS = WORLDGEN_CHUNK / 2 };
+	World *w = g->world;
+	int x0 = cx * WORLDGEN_CHUNK, y0 = cy * WORLDGEN_CHUNK;
+	fill_chunk(w, cx, cy, TILE_WALL);
+
+	int nx = 0, ny = 0;
+	while (nx < CELLS && x0 + 2 * nx + 1 < w->width - 1)
+		nx++;
+	while (ny < CELLS && y0 + 2 * ny + 1 < w->height - 1)
+		ny++;
+	if (nx == 0 || ny == 0)
+		return;
+
+	Rng rng = { stream_key(g->key, STREAM_CHUNKS + cy * g->chunks_x + cx) };
+	bool seen[CELLS * CELLS] = {0};
+	short stack[CELLS * CELLS];
+	int top = 0;
+
+	int start = rng_range(&rng, nx * ny);
+	seen[start] = true;
+	stack[top++] = start;
+	put_tile(w, x0 + 2 * (start % nx) + 1, y0 + 2 * (start / nx) + 1, TILE_EMPTY);
+	while (top > 0)
+	{
+		int c = stack[top - 1], i = c % nx, j = c / nx;
+		int next[4], n = 0;
+		if (i > 0 && !seen[c - 1])
+			next[n++] = c - 1;
+		if (i < nx - 1 && !seen[c + 1])
+			next[n++] = c + 1;
+		if (j > 0 && !seen[c - nx])
+			next[n++] = c - nx;
+		if (j < ny - 1 && !seen[c + nx])
+			next[n++] = c + nx;
+		if (n == 0)
+		{
+			top--;
+			continue;
+		}
+
+		int d = next[rng_range(&rng, n)];
+		seen[d] = true;
+		stack[top++] = d;
+		/* the cell and the wall between the two */
+		put_tile(w, x0 + 2 * (d % nx) + 1, y0 + 2 * (d / nx) + 1, TILE_EMPTY);
+		put_tile(w, x0 + (d % nx) + i + 1, y0 + (d / nx) + j + 1, TILE_EMPTY);
+	}
+
+	if (cx > 0)
+		put_tile(w, x0, y0 + 2 * rng_range(&rng, ny) + 1, TILE_EMPTY);
+	if (cy > 0)
+		put_tile(w, x0 + 2 * rng_range(&rng, nx) + 1, y0, TILE_EMPTY);
+}
+
+
+/* Smoothed noise: a tile becomes a wall when at least 5 of the 9 tiles around
+ * it are. The noise comes from the tile's own coordinates, and each chunk
+ * runs the automaton over a margin of CAVE_STEPS tiles around itself, which
+ * is all that can reach its tiles, so chunks agree where they meet. */
+static
+void cave_chunk(WorldGen *g, int cx, int cy)
+{
+	enum { SIDE = WORLDGEN_CHUNK + 2 * CAVE_STEPS };
+	World *w = g->world;
+	int x0 = cx * WORLDGEN_CHUNK - CAVE_STEPS, y0 = cy * WORLDGEN_CHUNK - CAVE_STEPS;
+	unsigned long long noise = stream_key(g->key, STREAM_NOISE);
+
+	/* tiles outside the interior stay walls whatever their neighbours are */
+	unsigned char edge[SIDE][SIDE], buf[2][SIDE][SIDE];
+	unsigned char (*cur)[SIDE] = buf[0], (*next)[SIDE] = buf[1];
+	for (int y = 0 ; y < SIDE ; y++)
+	{
+		for (int x = 0 ; x < SIDE ; x++)
+		{
+			int gx = x0 + x, gy = y0 + y;
+			edge[y][x] = !is_interior(w, gx, gy);
+			cur[y][x] = edge[y][x] ||
+				stream_range(noise, (unsigned long long)gy * w->width + gx, 100) < CAVE_FILL;
+		}
+	}
+
+	/* each round is only right one tile further in than the last */
+	for (int step = 1 ; step <= CAVE_STEPS ; step++)
+	{
+		for (int y = step ; y < SIDE - step ; y++)
+		{
+			unsigned char rows[SIDE];
+			for (int x = 0 ; x < SIDE ; x++)
+				rows[x] = cur[y - 1][x] + cur[y][x] + cur[y + 1][x];
+			for (int x = step ; x < SIDE - step ; x++)
+				next[y][x] = edge[y][x] | (rows[x - 1] + rows[x] + rows[x + 1] >= 5);
+		}
+		unsigned char (*t)[SIDE] = cur;
+		cur = next;
+		next = t;
+	}
+
+	for (int y = CAVE_STEPS ; y < SIDE - CAVE_STEPS ; y++)
+	{
+		for (int x = CAVE_STEPS ; x < SIDE - CAVE_STEPS ; x++)
+			put_tile(w, x0 + x, y0 + y, cur[y][x] ? TILE_WALL : TILE_EMPTY);
+	}
+}
+
+
+/* The door of a chunk's west (or north) side, at an offset in [lo, hi) that
+ * the chunk on the other side can look up as well. */
+static
+int room_door(WorldGen *g, int cx, int cy, int north, int lo, int hi)
+{
+	unsigned long long doors = stream_key(g->key, STREAM_DOORS);
+	return lo + stream_range(doors, 2 * ((unsigned long long)cy * g->chunks_x + cx) + north, hi - lo);
+}
+
+/* Dig from (x, y) to (tx, ty), along the row or the column first. */
+static
+void dig(World *w, int x, int y, int tx, int ty, bool row_first)
+{
+	put_tile(w, x, y, TILE_EMPTY);
+	while (x != tx || y != ty)
+	{
+		if ((row_first || y == ty) && x != tx)
+			x += x < tx ? 1 : -1;
+		else
+			y += y < ty ? 1 : -1;
+		put_tile(w, x, y, TILE_EMPTY);
+	}
+}
+
+/* A room somewhere in the chunk, with a corridor to a door on each side that
+ * has a chunk behind it. */
+static
+void rooms_chunk(WorldGen *g, int cx, int cy)
+{
+	World *w = g->world;
+	fill_chunk(w, cx, cy, TILE_WALL);
+
+	/* the interior part of the chunk */
+	int lx = cx * WORLDGEN_CHUNK, hx = lx + WORLDGEN_CHUNK;
+	int ly = cy * WORLDGEN_CHUNK, hy = ly + WORLDGEN_CHUNK;
+	lx = lx > 1 ? lx : 1;
+	ly = ly > 1 ? ly : 1;
+	hx = hx < w->width - 1 ? hx : w->width - 1;
+	hy = hy < w->height - 1 ? hy : w->height - 1;
+	if (lx >= hx || ly >= hy)
+		return;
+
+	Rng rng = { stream_key(g->key, STREAM_CHUNKS + cy * g->chunks_x + cx) };
+	int rw = ROOM_MIN + rng_range(&rng, ROOM_MAX - ROOM_MIN + 1);
+	int rh = ROOM_MIN + rng_range(&rng, ROOM_MAX - ROOM_MIN + 1);
+	rw = rw < hx - lx ? rw : hx - lx;
+	rh = rh < hy - ly ? rh : hy - ly;
+	int rx = lx + rng_range(&rng, hx - lx - rw + 1);
+	int ry = ly + rng_range(&rng, hy - ly - rh + 1);
+	for (int y = ry ; y < ry + rh ; y++)
+	{
+		for (int x = rx ; x < rx + rw ; x++)
+			put_tile(w, x, y, TILE_EMPTY);
+	}
+
+	int mx = rx + rw / 2, my = ry + rh / 2;
+	if (cx > 0)
+		dig(w, mx, my, lx, room_door(g, cx, cy, 0, ly, hy), false);
+	if (cy > 0)
+		dig(w, mx, my, room_door(g, cx, cy, 1, lx, hx), ly, true);
+	if ((cx + 1) * WORLDGEN_CHUNK < w->width - 1)
+		dig(w, mx, my, hx - 1, room_door(g, cx + 1, cy, 0, ly, hy), false);
+	if ((cy + 1) * WORLDGEN_CHUNK < w->height - 1)
+		dig(w, mx, my, room_door(g, cx, cy + 1, 1, lx, hx), hy - 1, true);
+}
+
+
+static
+void layout_chunk(void *data, int index)
+{
+	WorldGen *g = data;
+	int cx = index % g->chunks_x, cy = index / g->chunks_x;
+	switch (g->layout)
+	{
+	case LAYOUT_MAZE:
+		maze_chunk(g, cx, cy);
+		break;
+	case LAYOUT_CAVE:
+		cave_chunk(g, cx, cy);
+		break;
+	case LAYOUT_ROOMS:
+		rooms_chunk(g, cx, cy);
+		break;
+	default:
+		break;
+	}
+}
+
+void worldgen_layout(World *w, unsigned long long key, WorldLayout layout)
+{
+	unsigned long long traced = trace_begin();
+	WorldGen g =
+	{
+		.world=w,
+		.layout=layout,
+		.key=key,
+		.chunks_x=(w->width + WORLDGEN_CHUNK - 1) / WORLDGEN_CHUNK,
+		.chunks_y=(w->height + WORLDGEN_CHUNK - 1) / WORLDGEN_CHUNK,
+	};
+	parallel_for(worldgen_threads, g.chunks_x * g.chunks_y, layout_chunk, &g);
+	trace_end(traced, "world", "worldgen_layout");
+}
@@ -0,0 +1,33 @@
+#ifndef __robots_worldgen__
+#define __robots_worldgen__
+
+
+#include <stdbool.h>
+#include <common.h>
+
+
+/* Large worlds are laid out in square chunks, each built by whichever worker
+ * thread takes it. A chunk only writes its own tiles and only draws random
+ * numbers from streams named by its position, so the result depends on the
+ * key alone and not on the number of threads or the order chunks run in.
+ * Chunks are as wide as a bitset word, so a chunk's tiles are also whole
+ * words of the world's wall and energy bits. Tiles are written with
+ * write_tile, which leaves the counters shared by the whole world alone. */
+#define WORLDGEN_CHUNK 64
+
+#define CAVE_FILL 45   /* percent of walls in the starting noise */
+#define CAVE_STEPS 4   /* cellular automaton rounds */
+#define ROOM_MIN 8     /* room sides */
+#define ROOM_MAX 40
+
+/* Worker threads used for layouts, 0 for one per CPU (`--threads N`). */
+extern int worldgen_threads;
+extern const char *const worldgen_layout_names[LAYOUT_COUNT];
+
+/* Look a layout up by its name, false if there is none. */
+bool worldgen_parse_layout(const char *name, WorldLayout *layout);
+/* Lay out the walls of every interior tile of `w`, leaving its border alone. */
+void worldgen_layout(World *w, unsigned long long key, WorldLayout layout);
+
+
+#endif